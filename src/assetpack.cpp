@@ -0,0 +1,46 @@
+// Asset packer: concatenates models, textures and their baked or cached companions into one file
+// that the runtime maps once (AssimpMC --pack FILE). Files are stored under their normalized paths,
+// which must match the paths the runtime asks for, so run it from the directory the app runs in.
+// Usage: assetpack <pack> <file>...
+
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include "utils/asset_pack.h"
+
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " <pack> <file>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files(argv + 2, argv + argc);
+    if(!AssetPack::write(argv[1], files))
+    {
+        return 1;
+    }
+
+    // Read the pack back to check every file resolves through the table of contents
+    AssetPack pack;
+    if(!pack.open(argv[1]))
+    {
+        return 1;
+    }
+
+    bool ok = true;
+    for (unsigned int i = 0; i < files.size(); i++)
+    {
+        const unsigned char *data;
+        size_t size;
+        if(!pack.find(files[i], data, size))
+        {
+            std::cout << "ERROR::ASSETPACK::MISSING " << files[i] << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1104 @@
+// CPU benchmarks of the loading and per-frame hot paths. Needs no window or GL context.
+// Usage: AssimpMC_bench [--model PATH] [--iterations N] [--json FILE] [--baseline FILE] [--threshold PERCENT]
+//
+// Every stage runs once to warm up, then N timed iterations. --json writes the results, and a file written
+// that way can be passed back as --baseline: stages whose median got slower by more than the threshold
+// are reported and the exit code is 1.
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <functional>
+
+#include "utils/model_loader.h"
+#include "utils/model_cache.h"
+#include "utils/camera.h"
+#include "utils/frustum_culling.h"
+#include "utils/bounds.h"
+#include "utils/lod.h"
+#include "utils/mesh_optimizer.h"
+#include "utils/transform_graph.h"
+#include "utils/asset_pack.h"
+#include "utils/light_clusters.h"
+#include "utils/occlusion_culling.h"
+#include "utils/vertex_format.h"
+#include "utils/texture_compression.h"
+#include "utils/ktx.h"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+struct BenchResult {
+    std::string name;
+    double min;
+    double median;
+    double mean;
+};
+
+class Bench
+{
+public:
+    explicit Bench(unsigned int iterations)
+        : iterations(iterations)
+    {
+    }
+
+    // setup runs before every iteration and is not timed
+    void run(const std::string &name, std::function<void()> setup, std::function<void()> body)
+    {
+        std::vector<double> samples;
+        for (unsigned int i = 0; i <= this->iterations; i++)
+        {
+            setup();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            body();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            // The first run only warms caches and the allocator
+            if(i > 0)
+            {
+                samples.push_back(ms);
+            }
+        }
+
+        std::sort(samples.begin(), samples.end());
+        BenchResult result;
+        result.name = name;
+        result.min = samples.front();
+        result.median = samples[samples.size() / 2];
+        result.mean = 0.0;
+        for (unsigned int i = 0; i < samples.size(); i++)
+        {
+            result.mean += samples[i] / samples.size();
+        }
+        this->results.push_back(result);
+
+        std::printf("%-20s min %10.3f ms   median %10.3f ms   mean %10.3f ms\n", name.c_str(), result.min, result.median, result.mean);
+    }
+
+    void run(const std::string &name, std::function<void()> body)
+    {
+        this->run(name, []() {}, body);
+    }
+
+    bool writeJson(const std::string &path, const std::string &model) const
+    {
+        std::ofstream out(path.c_str(), std::ios::trunc);
+        out << "{\n"
+            << "    \"model\": \"" << model << "\",\n"
+            << "    \"iterations\": " << this->iterations << ",\n"
+            << "    \"stages\": {\n";
+        for (unsigned int i = 0; i < this->results.size(); i++)
+        {
+            const BenchResult &result = this->results[i];
+            out << "        \"" << result.name << "\": {\"min_ms\": " << result.min
+                << ", \"median_ms\": " << result.median
+                << ", \"mean_ms\": " << result.mean << "}"
+                << (i + 1 < this->results.size() ? "," : "") << "\n";
+        }
+        out << "    }\n}\n";
+
+        if(!out)
+        {
+            std::cout << "ERROR::BENCH::WRITE_FAILED " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Reads the medians of a file written by writeJson, one stage per line. Returns the number of regressions
+    int compare(const std::string &path, double thresholdPercent) const
+    {
+        std::ifstream in(path.c_str());
+        if(!in)
+        {
+            std::cout << "ERROR::BENCH::NO_BASELINE " << path << std::endl;
+            return -1;
+        }
+
+        std::map<std::string, double> baseline;
+        std::string line;
+        while(std::getline(in, line))
+        {
+            char name[128];
+            double min, median;
+            if(std::sscanf(line.c_str(), " \"%127[^\"]\": {\"min_ms\": %lf, \"median_ms\": %lf", name, &min, &median) == 3)
+            {
+                baseline[name] = median;
+            }
+        }
+
+        int regressions = 0;
+        std::cout << "Against " << path << ":" << std::endl;
+        for (unsigned int i = 0; i < this->results.size(); i++)
+        {
+            const BenchResult &result = this->results[i];
+            std::map<std::string, double>::const_iterator it = baseline.find(result.name);
+            if(it == baseline.end() || it->second <= 0.0)
+            {
+                std::printf("%-20s not in baseline\n", result.name.c_str());
+                continue;
+            }
+
+            double change = (result.median / it->second - 1.0) * 100.0;
+            bool regressed = change > thresholdPercent;
+            regressions += regressed;
+            std::printf("%-20s %+8.1f %%%s\n", result.name.c_str(), change, regressed ? "   REGRESSION" : "");
+        }
+        return regressions;
+    }
+
+private:
+    unsigned int iterations;
+    std::vector<BenchResult> results;
+};
+
+// Flat grid of quads between two corners, spanned by the x and z of corner0 to corner1 at y of corner0,
+// or by x and y at z of corner0 when vertical
+void AddQuadGrid(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, const glm::vec3 &corner0, const glm::vec3 &corner1, unsigned int cells, bool vertical)
+{
+    unsigned int first = vertices.size();
+    for (unsigned int j = 0; j <= cells; j++)
+    {
+        for (unsigned int i = 0; i <= cells; i++)
+        {
+            float u = (float)i / cells;
+            float v = (float)j / cells;
+            Vertex vertex;
+            vertex.Position.x = corner0.x + (corner1.x - corner0.x) * u;
+            vertex.Position.y = vertical ? corner0.y + (corner1.y - corner0.y) * v : corner0.y;
+            vertex.Position.z = vertical ? corner0.z : corner0.z + (corner1.z - corner0.z) * v;
+            vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+            vertex.TexCoords = glm::vec2(u, v);
+            vertices.push_back(vertex);
+        }
+    }
+
+    for (unsigned int j = 0; j < cells; j++)
+    {
+        for (unsigned int i = 0; i < cells; i++)
+        {
+            unsigned int a = first + j * (cells + 1) + i;
+            unsigned int b = a + cells + 1;
+            unsigned int quad[6] = { a, a + 1, b, a + 1, b + 1, b };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+// Packs vertices with CompactFromVertex and unpacks them again. Positions must land within one snorm16 step
+// of the bounds' extent, normals within a fixed angle, texture coordinates within one half float step
+bool CompactRoundTripWithinBounds(const std::vector<Vertex> &vertices, const char *name)
+{
+    // 16-bit octahedral normals measure a few thousandths of a degree off at worst
+    const float MAX_NORMAL_DEGREES = 0.01f;
+
+    QuantizationBounds bounds = ComputeQuantizationBounds(vertices);
+    glm::vec3 positionStep = bounds.extent / SNORM16_MAX;
+    for (unsigned int i = 0; i < vertices.size(); i++)
+    {
+        const Vertex &vertex = vertices[i];
+        CompactVertex compact = CompactFromVertex(vertex, bounds);
+
+        glm::vec3 positionError = glm::abs(DequantizePosition(compact, bounds) - vertex.Position);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if(positionError[axis] > positionStep[axis])
+            {
+                std::cout << "ERROR::BENCH::COMPACT_POSITION " << name << " vertex " << i << " axis " << axis
+                          << ": error " << positionError[axis] << ", step " << positionStep[axis] << std::endl;
+                return false;
+            }
+        }
+
+        // atan2 of the sine and cosine, acos loses the small angles to rounding
+        glm::vec3 normal = glm::normalize(vertex.Normal);
+        glm::vec3 decoded = DequantizeNormal(compact);
+        float degrees = glm::degrees(std::atan2(glm::length(glm::cross(decoded, normal)), glm::dot(decoded, normal)));
+        if(!(degrees <= MAX_NORMAL_DEGREES))
+        {
+            std::cout << "ERROR::BENCH::COMPACT_NORMAL " << name << " vertex " << i << ": "
+                      << degrees << " degrees off" << std::endl;
+            return false;
+        }
+
+        // Half floats keep 11 significant bits, with the smallest normal exponent below that
+        glm::vec2 texCoords = DequantizeTexCoords(compact);
+        for (int axis = 0; axis < 2; axis++)
+        {
+            float value = vertex.TexCoords[axis];
+            float step = std::max(std::fabs(value), std::ldexp(1.0f, -14)) * std::ldexp(1.0f, -11);
+            if(std::fabs(texCoords[axis] - value) > step)
+            {
+                std::cout << "ERROR::BENCH::COMPACT_TEXCOORDS " << name << " vertex " << i << ": "
+                          << texCoords[axis] << ", expected " << value << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Random vertices plus the edge cases: axis aligned normals, a mesh flat along one axis and a single point
+bool CompactVerticesRoundTrip()
+{
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+
+    std::vector<Vertex> vertices;
+    for (unsigned int i = 0; i < 10000; i++)
+    {
+        Vertex vertex;
+        vertex.Position = glm::vec3(signedUnit(random) * 50.0f, signedUnit(random) * 0.01f, signedUnit(random) * 3.0f + 7.0f);
+        glm::vec3 normal(signedUnit(random), signedUnit(random), signedUnit(random));
+        vertex.Normal = glm::dot(normal, normal) > 1e-4f ? normal : glm::vec3(0.0f, 0.0f, 1.0f);
+        vertex.TexCoords = glm::vec2(signedUnit(random) * 4.0f, signedUnit(random) * 0.5f + 0.5f);
+        vertices.push_back(vertex);
+    }
+
+    const glm::vec3 AXES[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    const float TEX_COORDS[6] = { 0.0f, 1.0f, 0.5f, -1.0f, 1e-6f, 1000.0f };
+    for (int i = 0; i < 6; i++)
+    {
+        vertices[i].Normal = AXES[i];
+        vertices[i].TexCoords = glm::vec2(TEX_COORDS[i], TEX_COORDS[5 - i]);
+    }
+
+    std::vector<Vertex> flat = vertices;
+    for (unsigned int i = 0; i < flat.size(); i++)
+    {
+        flat[i].Position.y = 2.0f;
+    }
+
+    std::vector<Vertex> point(vertices.begin(), vertices.begin() + 6);
+    for (unsigned int i = 0; i < point.size(); i++)
+    {
+        point[i].Position = glm::vec3(-3.0f, 0.25f, 9.0f);
+    }
+
+    bool ok = CompactRoundTripWithinBounds(vertices, "random");
+    ok = CompactRoundTripWithinBounds(flat, "flat") && ok;
+    ok = CompactRoundTripWithinBounds(point, "point") && ok;
+    return ok;
+}
+
+// Bakes image the way texbake does, through a KTX file and back. The format it picks, the header and
+// every level's size and bytes must survive, and level 0 must decode within minPSNR dB of the source
+bool BakeRoundTrip(const ImageRGBA &image, unsigned int expectedFormat, double minPSNR, const std::string &path)
+{
+    unsigned int format = image.isOpaque() ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC3;
+    const char *name = expectedFormat == TEXTURE_FORMAT_BC1 ? "BC1" : "BC3";
+    if(format != expectedFormat)
+    {
+        std::cout << "ERROR::BENCH::BAKE_FORMAT " << name << " image got the other format" << std::endl;
+        return false;
+    }
+
+    std::vector<ImageRGBA> mips = BuildMipChain(image);
+    std::vector<std::vector<unsigned char> > levels(mips.size());
+    for (unsigned int i = 0; i < mips.size(); i++)
+    {
+        levels[i] = CompressImage(mips[i], format);
+    }
+
+    unsigned int baseFormat = format == TEXTURE_FORMAT_BC1 ? 0x1907 : 0x1908;
+    if(!WriteKtx(path, format, baseFormat, image.width, image.height, levels))
+    {
+        return false;
+    }
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::remove(path.c_str());
+
+    KtxFile ktx;
+    if(!ReadKtx(file.data(), file.size(), ktx) || ktx.internalFormat != format || ktx.baseInternalFormat != baseFormat ||
+       ktx.levels.size() != mips.size())
+    {
+        std::cout << "ERROR::BENCH::BAKE_KTX " << name << " header did not read back" << std::endl;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < mips.size(); i++)
+    {
+        const KtxLevel &level = ktx.levels[i];
+        if(level.width != mips[i].width || level.height != mips[i].height ||
+           level.size != CompressedSize(format, level.width, level.height) || level.size != levels[i].size() ||
+           std::memcmp(level.data, levels[i].data(), level.size) != 0)
+        {
+            std::cout << "ERROR::BENCH::BAKE_LEVEL " << name << " level " << i << ": " << level.width << "x" << level.height
+                      << " " << level.size << " bytes, expected " << mips[i].width << "x" << mips[i].height
+                      << " " << levels[i].size() << " bytes" << std::endl;
+            return false;
+        }
+    }
+
+    ImageRGBA decoded = DecompressImage(ktx.levels[0].data, format, image.width, image.height);
+    double psnr = ComputePSNR(image, decoded, format == TEXTURE_FORMAT_BC1 ? 3 : 4);
+    if(!(psnr >= minPSNR))
+    {
+        std::cout << "ERROR::BENCH::BAKE_PSNR " << name << " " << psnr << " dB, at least " << minPSNR << " expected" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Smooth synthetic images with odd sizes, one opaque for BC1 and one with an alpha ramp for BC3
+bool BakedTexturesRoundTrip(const std::string &scratchPath)
+{
+    const int WIDTH = 100, HEIGHT = 60;
+    // Both measure about 38 dB
+    const double MIN_PSNR = 32.0;
+    ImageRGBA rgb(WIDTH, HEIGHT), rgba(WIDTH, HEIGHT);
+    for (int y = 0; y < HEIGHT; y++)
+    {
+        for (int x = 0; x < WIDTH; x++)
+        {
+            unsigned char color[4] = {
+                (unsigned char)(x * 255 / (WIDTH - 1)),
+                (unsigned char)(y * 255 / (HEIGHT - 1)),
+                (unsigned char)(128.0f + 100.0f * std::sin(x * 0.2f) * std::cos(y * 0.15f)),
+                255
+            };
+            std::memcpy(rgb.at(x, y), color, 4);
+            color[3] = (unsigned char)std::min(255.0f, std::sqrt(float((x - WIDTH / 2) * (x - WIDTH / 2) + (y - HEIGHT / 2) * (y - HEIGHT / 2))) * 4.0f);
+            std::memcpy(rgba.at(x, y), color, 4);
+        }
+    }
+
+    bool ok = BakeRoundTrip(rgb, TEXTURE_FORMAT_BC1, MIN_PSNR, scratchPath + ".bc1.ktx");
+    ok = BakeRoundTrip(rgba, TEXTURE_FORMAT_BC3, MIN_PSNR, scratchPath + ".bc3.ktx") && ok;
+    return ok;
+}
+
+// Corners of every triangle, each rotated to start at its smallest corner so the winding is kept,
+// with positions and texture coordinates rounded to compare welded and unwelded vertices
+std::vector<std::vector<float> > TriangleSet(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices)
+{
+    const float ROUNDING = 1000.0f;
+    std::vector<std::vector<float> > triangles;
+    for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+    {
+        std::vector<float> corners[3];
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            const Vertex &vertex = vertices[indices[i + k]];
+            float values[5] = { vertex.Position.x, vertex.Position.y, vertex.Position.z, vertex.TexCoords.x, vertex.TexCoords.y };
+            for (unsigned int j = 0; j < 5; j++)
+            {
+                corners[k].push_back(std::floor(values[j] * ROUNDING + 0.5f));
+            }
+        }
+
+        unsigned int first = std::min_element(corners, corners + 3) - corners;
+        std::vector<float> triangle;
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            triangle.insert(triangle.end(), corners[(first + k) % 3].begin(), corners[(first + k) % 3].end());
+        }
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+// A grid as an unindexed triangle soup in random order, every other copy of a shared vertex nudged by
+// less than the weld tolerance. Optimizing must weld it, keep every triangle and its winding, and give
+// the same buffers on a second run
+bool OptimizeKeepsTriangles()
+{
+    std::vector<Vertex> grid;
+    std::vector<unsigned int> gridIndices;
+    AddQuadGrid(grid, gridIndices, glm::vec3(-8.0f, 0.0f, -8.0f), glm::vec3(8.0f, 0.0f, 8.0f), 32, false);
+
+    std::mt19937 random(10);
+    std::vector<unsigned int> order(gridIndices.size() / 3);
+    for (unsigned int i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    for (unsigned int i = 0; i < order.size(); i++)
+    {
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            Vertex vertex = grid[gridIndices[order[i] * 3 + k]];
+            if(vertices.size() % 2)
+            {
+                vertex.Position += glm::vec3(16.0f * WELD_RELATIVE_EPSILON * 0.25f);
+            }
+            indices.push_back(vertices.size());
+            vertices.push_back(vertex);
+        }
+    }
+
+    std::vector<Vertex> firstVertices = vertices, secondVertices = vertices;
+    std::vector<unsigned int> firstIndices = indices, secondIndices = indices;
+    OptimizeMesh(firstVertices, firstIndices);
+    OptimizeMesh(secondVertices, secondIndices);
+
+    if(firstVertices.size() != grid.size())
+    {
+        std::cout << "ERROR::BENCH::OPTIMIZE_WELD " << firstVertices.size() << " vertices, expected " << grid.size() << std::endl;
+        return false;
+    }
+    if(TriangleSet(firstVertices, firstIndices) != TriangleSet(vertices, indices))
+    {
+        std::cout << "ERROR::BENCH::OPTIMIZE_TRIANGLES the optimized mesh has different triangles" << std::endl;
+        return false;
+    }
+    if(firstIndices != secondIndices || firstVertices.size() != secondVertices.size() ||
+       std::memcmp(firstVertices.data(), secondVertices.data(), firstVertices.size() * sizeof(Vertex)) != 0)
+    {
+        std::cout << "ERROR::BENCH::OPTIMIZE_NONDETERMINISTIC two runs gave different buffers" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Simplifies a bumpy grid. Every level has to halve the triangles of the one before, as GenerateLods aims
+// to, and no vertex of the full mesh may lie further from a level's surface than the error it stores
+bool LodsWithinError()
+{
+    const unsigned int CELLS = 32;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    AddQuadGrid(vertices, indices, glm::vec3(-8.0f, 0.0f, -8.0f), glm::vec3(8.0f, 0.0f, 8.0f), CELLS, false);
+    for (unsigned int i = 0; i < vertices.size(); i++)
+    {
+        glm::vec3 &position = vertices[i].Position;
+        position.y = std::sin(position.x * 0.4f) * std::cos(position.z * 0.3f) * 1.5f;
+    }
+
+    Bounds bounds = ComputeBounds(vertices);
+    std::vector<unsigned int> lodIndices;
+    std::vector<MeshLod> lods;
+    GenerateLods(vertices, indices, bounds, lodIndices, lods);
+    if(lods.size() != MAX_LOD_LEVELS)
+    {
+        std::cout << "ERROR::BENCH::LOD_LEVELS " << lods.size() << " levels, expected " << MAX_LOD_LEVELS << std::endl;
+        return false;
+    }
+
+    unsigned int triangles = indices.size() / 3;
+    for (unsigned int level = 1; level < lods.size(); level++)
+    {
+        const MeshLod &lod = lods[level];
+        unsigned int target = triangles >> level;
+        if(lod.indexCount / 3 > target)
+        {
+            std::cout << "ERROR::BENCH::LOD_REDUCTION level " << level << ": " << lod.indexCount / 3
+                      << " triangles, target " << target << std::endl;
+            return false;
+        }
+
+        const unsigned int *levelIndices = &lodIndices[lod.firstIndex - indices.size()];
+        float measured = 0.0f;
+        for (unsigned int v = 0; v < vertices.size(); v++)
+        {
+            float nearest = 1e30f;
+            for (unsigned int i = 0; i < lod.indexCount; i += 3)
+            {
+                nearest = std::min(nearest, PointTriangleDistance(vertices[v].Position, vertices[levelIndices[i]].Position,
+                                                                  vertices[levelIndices[i + 1]].Position, vertices[levelIndices[i + 2]].Position));
+            }
+            measured = std::max(measured, nearest);
+        }
+
+        if(measured > lod.error)
+        {
+            std::cout << "ERROR::BENCH::LOD_ERROR level " << level << ": surface moved " << measured
+                      << ", stored error " << lod.error << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Culls random boxes from random views and compares every box with a plain scalar plane test. Boxes
+// within rounding of a plane may go either way
+bool CullMatchesScalar(unsigned int boxCount)
+{
+    std::mt19937 random(boxCount);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<Bounds> bounds(boxCount);
+    for (unsigned int i = 0; i < boxCount; i++)
+    {
+        glm::vec3 center((unit(random) - 0.5f) * 200.0f, (unit(random) - 0.5f) * 40.0f, (unit(random) - 0.5f) * 200.0f);
+        glm::vec3 extent(0.1f + unit(random) * 4.0f, 0.1f + unit(random) * 4.0f, 0.1f + unit(random) * 4.0f);
+        bounds[i].center = center;
+        bounds[i].min = center - extent;
+        bounds[i].max = center + extent;
+        bounds[i].radius = glm::length(extent);
+    }
+
+    FrustumCuller culler;
+    culler.build(bounds);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    std::vector<unsigned char> visible;
+    for (unsigned int view = 0; view < 16; view++)
+    {
+        glm::vec3 eye((unit(random) - 0.5f) * 100.0f, (unit(random) - 0.5f) * 20.0f, (unit(random) - 0.5f) * 100.0f);
+        float yaw = unit(random) * 6.2831853f;
+        glm::vec3 direction(std::sin(yaw), (unit(random) - 0.5f) * 0.5f, std::cos(yaw));
+        Frustum frustum = ExtractFrustum(projection * glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f)));
+
+        unsigned int visibleCount = culler.cull(frustum, visible);
+        unsigned int marked = 0;
+        for (unsigned int i = 0; i < boxCount; i++)
+        {
+            glm::vec3 center = (bounds[i].min + bounds[i].max) * 0.5f;
+            glm::vec3 extent = (bounds[i].max - bounds[i].min) * 0.5f;
+            float closest = 1e30f;
+            for (int p = 0; p < 6; p++)
+            {
+                glm::vec4 plane = frustum.planes[p];
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                closest = std::min(closest, distance + reach);
+            }
+
+            bool expected = closest >= 0.0f;
+            marked += visible[i] ? 1 : 0;
+            if(std::fabs(closest) > 1e-3f && expected != (visible[i] != 0))
+            {
+                std::cout << "ERROR::BENCH::CULL_MISMATCH " << boxCount << " boxes, view " << view << ", box " << i
+                          << (expected ? " culled" : " kept") << std::endl;
+                return false;
+            }
+        }
+
+        if(visibleCount != marked)
+        {
+            std::cout << "ERROR::BENCH::CULL_COUNT " << boxCount << " boxes, view " << view << ": returned "
+                      << visibleCount << ", marked " << marked << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rebuilds every cluster's light list without LightClusters' own planes: the cluster's corners come from
+// the inverse projection and the slice mapping the shaders use, its six planes from those corners. Lights
+// within rounding of a plane may go either way
+bool MatchesReference(const LightClusters &clusters, const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection)
+{
+    const float EPSILON = 1e-3f;
+    const std::vector<unsigned int> &grid = clusters.getGrid();
+    const std::vector<unsigned int> &indices = clusters.getIndices();
+
+    std::vector<glm::vec3> positions(lights.size());
+    for (unsigned int i = 0; i < lights.size(); i++)
+    {
+        positions[i] = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+    }
+
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    glm::vec2 sliceScale = clusters.getSliceScale();
+    for (unsigned int z = 0; z < LightClusters::SIZE_Z; z++)
+    {
+        // Inverse of slice = log(depth) * x + y
+        float nearDepth = std::exp((z - sliceScale.y) / sliceScale.x);
+        float farDepth = std::exp((z + 1 - sliceScale.y) / sliceScale.x);
+        for (unsigned int y = 0; y < LightClusters::SIZE_Y; y++)
+        {
+            for (unsigned int x = 0; x < LightClusters::SIZE_X; x++)
+            {
+                // Rays through the tile's corners, scaled to a view depth of 1. Bit 0 picks the right edge, bit 1 the top
+                glm::vec3 rays[4];
+                glm::vec3 centroid(0.0f);
+                for (unsigned int c = 0; c < 4; c++)
+                {
+                    float ndcX = -1.0f + 2.0f * (x + (c & 1)) / LightClusters::SIZE_X;
+                    float ndcY = -1.0f + 2.0f * (y + (c >> 1)) / LightClusters::SIZE_Y;
+                    glm::vec4 corner = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+                    glm::vec3 point = glm::vec3(corner) / corner.w;
+                    rays[c] = point / -point.z;
+                    centroid += rays[c] * (nearDepth + farDepth) * 0.125f;
+                }
+
+                // Left, right, bottom and top through the eye, normals pointing into the cluster
+                const unsigned int EDGES[4][2] = { { 0, 2 }, { 1, 3 }, { 0, 1 }, { 2, 3 } };
+                glm::vec3 normals[4];
+                for (unsigned int e = 0; e < 4; e++)
+                {
+                    normals[e] = glm::normalize(glm::cross(rays[EDGES[e][0]], rays[EDGES[e][1]]));
+                    if(glm::dot(normals[e], centroid) < 0.0f)
+                    {
+                        normals[e] = -normals[e];
+                    }
+                }
+
+                unsigned int cluster = LightClusters::clusterIndex(x, y, z);
+                unsigned int next = grid[cluster * 2];
+                unsigned int end = next + grid[cluster * 2 + 1];
+                for (unsigned int i = 0; i < lights.size(); i++)
+                {
+                    const glm::vec3 &p = positions[i];
+                    float distances[6] = {
+                        glm::dot(normals[0], p), glm::dot(normals[1], p), glm::dot(normals[2], p), glm::dot(normals[3], p),
+                        -p.z - nearDepth, farDepth + p.z
+                    };
+
+                    bool expected = true, borderline = false;
+                    for (unsigned int k = 0; k < 6; k++)
+                    {
+                        expected = expected && distances[k] >= -lights[i].radius;
+                        borderline = borderline || std::fabs(distances[k] + lights[i].radius) < EPSILON;
+                    }
+
+                    // Cluster lists are in ascending order
+                    bool listed = next < end && indices[next] == i;
+                    next += listed ? 1 : 0;
+                    if(listed != expected && !borderline)
+                    {
+                        std::cout << "ERROR::BENCH::LIGHT_CLUSTER_MISMATCH " << x << " " << y << " " << z << ": light " << i
+                                  << (listed ? " listed" : " missing") << std::endl;
+                        return false;
+                    }
+                }
+                if(next != end)
+                {
+                    std::cout << "ERROR::BENCH::LIGHT_CLUSTER_ORDER " << x << " " << y << " " << z << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string modelPath = "models/multi.dae";
+    unsigned int iterations = 10;
+    const char *jsonPath = NULL;
+    const char *baselinePath = NULL;
+    double threshold = 10.0;
+    for (int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+        {
+            modelPath = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            iterations = std::max(1ul, std::strtoul(argv[++i], NULL, 10));
+        }
+        else if(std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baselinePath = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+        {
+            threshold = std::atof(argv[++i]);
+        }
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--model PATH] [--iterations N] [--json FILE] [--baseline FILE] [--threshold PERCENT]" << std::endl;
+            return 1;
+        }
+    }
+
+    // The scene the conversion stages work on stays loaded for the whole run
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(modelPath, MODEL_IMPORT_FLAGS);
+    if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    {
+        std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+        return 1;
+    }
+
+    std::vector<SceneNode> nodes;
+    std::vector<const aiMesh*> meshList;
+    std::vector<unsigned int> meshNodes;
+    CollectNodes(scene, nodes, meshList, meshNodes);
+    std::cout << modelPath << ": " << meshList.size() << " meshes, " << iterations << " iterations" << std::endl;
+
+    Bench bench(iterations);
+
+    // Checks that fail the run on wrong results, the stages below add their own
+    bool correct = CompactVerticesRoundTrip();
+
+    bench.run("import", [&]() {
+        Assimp::Importer import;
+        import.ReadFile(modelPath, MODEL_IMPORT_FLAGS);
+    });
+
+    bench.run("materials", [&]() {
+        std::vector<Material> materials;
+        std::vector<unsigned int> materialMap;
+        ExtractMaterials(scene, materials, materialMap);
+    });
+
+    std::vector<MeshData> raw(meshList.size());
+    bench.run("vertices", [&]() {
+        for (unsigned int i = 0; i < raw.size(); i++)
+        {
+            std::vector<Vertex>().swap(raw[i].vertices);
+        }
+    }, [&]() {
+        for (unsigned int i = 0; i < meshList.size(); i++)
+        {
+            ExtractVertices(meshList[i], raw[i].vertices);
+        }
+    });
+
+    bench.run("indices", [&]() {
+        for (unsigned int i = 0; i < raw.size(); i++)
+        {
+            std::vector<unsigned int>().swap(raw[i].indices);
+        }
+    }, [&]() {
+        for (unsigned int i = 0; i < meshList.size(); i++)
+        {
+            ExtractIndices(meshList[i], raw[i].indices);
+        }
+    });
+
+    correct = OptimizeKeepsTriangles() && correct;
+
+    // Optimization and simplification work on fresh copies of the raw meshes every iteration
+    std::vector<MeshData> work;
+    bench.run("optimize", [&]() { work = raw; }, [&]() {
+        for (unsigned int i = 0; i < work.size(); i++)
+        {
+            work[i].optimization = OptimizeMesh(work[i].vertices, work[i].indices);
+        }
+    });
+
+    std::vector<MeshData> optimized = work;
+    for (unsigned int i = 0; i < optimized.size(); i++)
+    {
+        optimized[i].bounds = ComputeBounds(optimized[i].vertices);
+    }
+
+    bench.run("bounds", [&]() {
+        for (unsigned int i = 0; i < optimized.size(); i++)
+        {
+            optimized[i].bounds = ComputeBounds(optimized[i].vertices);
+        }
+    });
+
+    correct = LodsWithinError() && correct;
+    bench.run("lod", [&]() {
+        for (unsigned int i = 0; i < optimized.size(); i++)
+        {
+            GenerateLods(optimized[i].vertices, optimized[i].indices, optimized[i].bounds, optimized[i].lodIndices, optimized[i].lods);
+        }
+    });
+
+    bench.run("convert", [&]() {
+        for (unsigned int i = 0; i < meshList.size(); i++)
+        {
+            ConvertMesh(meshList[i]);
+        }
+    });
+
+    bench.run("convert_parallel", [&]() {
+        ModelData model;
+        ConvertScene(scene, model);
+    });
+
+    // Cache round trip through a scratch file
+    ModelData model;
+    ConvertScene(scene, model);
+    std::string cachePath = modelPath + ".bench.cache";
+    bench.run("cache_write", [&]() {
+        ModelCache::write(cachePath, 1, MODEL_IMPORT_FLAGS, model);
+    });
+
+    bench.run("cache_read", [&]() {
+        ModelCache cache;
+        ModelData loaded;
+        if(cache.open(cachePath, 1, MODEL_IMPORT_FLAGS))
+        {
+            cache.read(loaded);
+        }
+    });
+    std::remove(cachePath.c_str());
+
+    correct = BakedTexturesRoundTrip(modelPath + ".bench") && correct;
+
+    // Opening the model as a loose file versus finding it in a pack, and importing it straight from the pack
+    const unsigned int OPEN_REPEATS = 1000;
+    std::string packPath = modelPath + ".bench.pack";
+    AssetPack pack;
+    if(AssetPack::write(packPath, std::vector<std::string>(1, modelPath)) && pack.open(packPath))
+    {
+        bench.run("open_loose", [&]() {
+            for (unsigned int i = 0; i < OPEN_REPEATS; i++)
+            {
+                MappedFile file(modelPath);
+            }
+        });
+
+        bench.run("open_packed", [&]() {
+            const unsigned char *data;
+            size_t size;
+            for (unsigned int i = 0; i < OPEN_REPEATS; i++)
+            {
+                pack.find(modelPath, data, size);
+            }
+        });
+
+        bench.run("import_memory", [&]() {
+            const unsigned char *data;
+            size_t size;
+            ModelData loaded;
+            if(pack.find(modelPath, data, size))
+            {
+                ImportModel(data, size, modelPath, loaded);
+            }
+        });
+    }
+    std::remove(packPath.c_str());
+
+    // Per-frame work, repeated enough to be measurable
+    const unsigned int CAMERA_UPDATES = 100000;
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+    glm::mat4 viewProjection;
+    bench.run("camera", [&]() {
+        glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), 800.0f / 600.0f, 0.1f, 100.0f);
+        for (unsigned int i = 0; i < CAMERA_UPDATES; i++)
+        {
+            camera.ProcessMouseMovement(0.5f, (i & 1) ? 0.25f : -0.25f);
+            viewProjection = projection * camera.getViewMatrix();
+        }
+    });
+
+    // A grid of boxes around the camera, about half of them in view
+    const int CULL_GRID = 32;
+    std::vector<Bounds> boxes;
+    for (int x = 0; x < CULL_GRID; x++)
+    {
+        for (int z = 0; z < CULL_GRID; z++)
+        {
+            Bounds box;
+            box.center = glm::vec3((x - CULL_GRID / 2) * 3.0f, 0.0f, (z - CULL_GRID / 2) * 3.0f);
+            box.min = box.center - glm::vec3(1.0f);
+            box.max = box.center + glm::vec3(1.0f);
+            box.radius = glm::length(glm::vec3(1.0f));
+            boxes.push_back(box);
+        }
+    }
+
+    // Below BVH_THRESHOLD the boxes are tested in one flat run, above it through the hierarchy
+    correct = CullMatchesScalar(FrustumCuller::BVH_THRESHOLD / 2) && correct;
+    correct = CullMatchesScalar(FrustumCuller::BVH_THRESHOLD * 16) && correct;
+
+    const unsigned int CULL_FRAMES = 1000;
+    FrustumCuller culler;
+    std::vector<unsigned char> visible;
+    bench.run("frustum_cull", [&]() {
+        culler.build(boxes);
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+        for (unsigned int i = 0; i < CULL_FRAMES; i++)
+        {
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(std::sin(i * 0.01f), 5.0f, std::cos(i * 0.01f)), glm::vec3(0.0f, 1.0f, 0.0f));
+            culler.cull(ExtractFrustum(projection * view), visible);
+        }
+    });
+
+    // Complete 4-ary node trees, breadth first by construction, animated every iteration.
+    // The second size is ten times the first, its times should be too
+    const unsigned int TRANSFORM_NODES = 10000;
+    const unsigned int TRANSFORM_FRAMES = 10;
+    for (unsigned int scale = 1; scale <= 10; scale *= 10)
+    {
+        TransformGraph graph;
+        unsigned int nodeCount = TRANSFORM_NODES * scale;
+        for (unsigned int i = 0; i < nodeCount; i++)
+        {
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+            graph.addNode(i == 0 ? TransformGraph::NO_NODE : (i - 1) / 4, local);
+        }
+        graph.update();
+
+        std::string suffix = scale == 1 ? "" : "_x10";
+        bench.run("transform_all" + suffix, [&]() {
+            for (unsigned int frame = 0; frame < TRANSFORM_FRAMES; frame++)
+            {
+                glm::mat4 local = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+                for (unsigned int i = 0; i < nodeCount; i++)
+                {
+                    graph.setLocal(i, local);
+                }
+                graph.update();
+            }
+        });
+
+        // Every eighth node of the deepest levels, so only small subtrees are dirty
+        bench.run("transform_partial" + suffix, [&]() {
+            for (unsigned int frame = 0; frame < TRANSFORM_FRAMES; frame++)
+            {
+                glm::mat4 local = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+                for (unsigned int i = nodeCount / 2; i < nodeCount; i += 8)
+                {
+                    graph.setLocal(i, local);
+                }
+                graph.update();
+            }
+        });
+    }
+
+    // Random lights around the view of a fixed camera, checked against a reference assignment once per count
+    // before timing. 10k lights bin on the thread pool, 1k on the calling thread
+    const unsigned int LIGHT_FRAMES = 10;
+    bool lightsMatch = true;
+    for (unsigned int lightCount = 1000; lightCount <= 10000; lightCount *= 10)
+    {
+        std::mt19937 random(lightCount);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<PointLight> lights(lightCount);
+        for (unsigned int i = 0; i < lightCount; i++)
+        {
+            glm::vec3 position((unit(random) - 0.5f) * 80.0f, (unit(random) - 0.5f) * 30.0f, 10.0f - unit(random) * 120.0f);
+            lights[i] = PointLight(position, 0.5f + unit(random) * 2.5f, glm::vec3(1.0f));
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        LightClusters clusters;
+        clusters.build(lights, view, projection, 0.1f, 100.0f);
+        if(!MatchesReference(clusters, lights, view, projection))
+        {
+            lightsMatch = false;
+        }
+
+        std::string name = lightCount == 1000 ? "light_binning_1k" : "light_binning_10k";
+        bench.run(name, [&]() {
+            for (unsigned int frame = 0; frame < LIGHT_FRAMES; frame++)
+            {
+                clusters.build(lights, view, projection, 0.1f, 100.0f);
+            }
+        });
+    }
+
+    // A camera at the origin looking down -z through a wall at z = -10 with a ground plane below that passes
+    // behind the camera, so both clipping and plain triangles are rasterized. Boxes float above the ground:
+    // one whose corners all project inside the wall is hidden, one with a corner clearly beside the wall or
+    // in front of it must never be reported hidden. Boxes near the wall's edges may go either way
+    const float WALL_DISTANCE = 10.0f, WALL_HALF_WIDTH = 3.0f, WALL_HALF_HEIGHT = 2.0f, MARGIN = 0.2f;
+    std::vector<Vertex> occluderVertices;
+    std::vector<unsigned int> occluderIndices;
+    AddQuadGrid(occluderVertices, occluderIndices, glm::vec3(-WALL_HALF_WIDTH, -WALL_HALF_HEIGHT, -WALL_DISTANCE),
+                glm::vec3(WALL_HALF_WIDTH, WALL_HALF_HEIGHT, -WALL_DISTANCE), 4, true);
+    AddQuadGrid(occluderVertices, occluderIndices, glm::vec3(-40.0f, -2.0f, 5.0f), glm::vec3(40.0f, -2.0f, -60.0f), 16, false);
+
+    std::vector<Bounds> occludees;
+    for (float z = -5.0f; z > -60.0f; z -= 1.5f)
+    {
+        for (float x = -21.0f; x <= 21.0f; x += 1.5f)
+        {
+            Bounds box;
+            box.center = glm::vec3(x, -1.0f, z);
+            box.min = box.center - glm::vec3(0.5f);
+            box.max = box.center + glm::vec3(0.5f);
+            box.radius = glm::length(glm::vec3(0.5f));
+            occludees.push_back(box);
+        }
+    }
+
+    glm::mat4 occlusionViewProjection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f)
+                                      * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    OcclusionCuller occlusion;
+    occlusion.addOccluder(occluderVertices, occluderIndices, glm::mat4(1.0f));
+    occlusion.render(occlusionViewProjection);
+
+    bool occlusionCorrect = true;
+    unsigned int expectedHidden = 0, hidden = 0;
+    for (unsigned int i = 0; i < occludees.size(); i++)
+    {
+        bool inside = true, outside = false;
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec3 corner((c & 1) ? occludees[i].max.x : occludees[i].min.x, (c & 2) ? occludees[i].max.y : occludees[i].min.y, (c & 4) ? occludees[i].max.z : occludees[i].min.z);
+            if(corner.z > -WALL_DISTANCE - MARGIN)
+            {
+                inside = false;
+                outside = outside || corner.z > -WALL_DISTANCE;
+                continue;
+            }
+
+            // Where the ray to the corner crosses the wall's plane
+            glm::vec3 hit = corner * (WALL_DISTANCE / -corner.z);
+            inside = inside && std::fabs(hit.x) < WALL_HALF_WIDTH - MARGIN && std::fabs(hit.y) < WALL_HALF_HEIGHT - MARGIN;
+            outside = outside || std::fabs(hit.x) > WALL_HALF_WIDTH + MARGIN || std::fabs(hit.y) > WALL_HALF_HEIGHT + MARGIN;
+        }
+
+        bool visible = occlusion.isVisible(occludees[i]);
+        if(outside && !visible)
+        {
+            std::cout << "ERROR::BENCH::OCCLUSION_FALSE_HIDDEN box " << i << std::endl;
+            occlusionCorrect = false;
+        }
+        expectedHidden += inside ? 1 : 0;
+        hidden += (inside && !visible) ? 1 : 0;
+    }
+    std::cout << "Occlusion: " << hidden << " of " << expectedHidden << " boxes behind the wall hidden" << std::endl;
+    // Coarse levels only blur the wall's edges, most boxes well behind it must still be caught
+    if(hidden * 2 < expectedHidden)
+    {
+        std::cout << "ERROR::BENCH::OCCLUSION_TOO_CONSERVATIVE" << std::endl;
+        occlusionCorrect = false;
+    }
+
+    // Behind the wall but for a third of a texel past its right edge, within the texel the edge crosses.
+    // Small enough to be tested on the full resolution level
+    float texelSlope = 2.0f / OcclusionCuller::WIDTH * std::tan(glm::radians(22.5f)) * 800.0f / 600.0f;
+    Bounds edgeBox;
+    edgeBox.min = glm::vec3((WALL_HALF_WIDTH / WALL_DISTANCE - texelSlope) * 15.0f, -0.02f, -15.1f);
+    edgeBox.max = glm::vec3((WALL_HALF_WIDTH / WALL_DISTANCE + 0.35f * texelSlope) * 15.0f, 0.02f, -15.0f);
+    edgeBox.center = (edgeBox.min + edgeBox.max) * 0.5f;
+    edgeBox.radius = glm::length(edgeBox.max - edgeBox.center);
+    if(!occlusion.isVisible(edgeBox))
+    {
+        std::cout << "ERROR::BENCH::OCCLUSION_EDGE box past the wall's edge hidden" << std::endl;
+        occlusionCorrect = false;
+    }
+
+    std::vector<unsigned char> occludeeVisible(occludees.size());
+    bench.run("occlusion_raster", [&]() {
+        occlusion.render(occlusionViewProjection);
+    });
+    bench.run("occlusion_test", [&]() {
+        std::fill(occludeeVisible.begin(), occludeeVisible.end(), 1);
+    }, [&]() {
+        occlusion.cull(occludees, occludeeVisible);
+    });
+
+    int result = correct && lightsMatch && occlusionCorrect ? 0 : 1;
+    if(jsonPath && !bench.writeJson(jsonPath, modelPath))
+    {
+        result = 1;
+    }
+    if(baselinePath && bench.compare(baselinePath, threshold) != 0)
+    {
+        result = 1;
+    }
+
+    return result;
+}
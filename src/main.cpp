@@ -1,17 +1,40 @@
-// g++ -g main.cpp ../include/glad/glad.c shader.cpp -I../include -I./src -L../lib -Wall -lglfw3 -lGL -lX11 -lassimp -lpthread -ldl -Wl,-rpath,'$ORIGIN' -o ../run/main
+// g++ -g main.cpp ../include/glad/glad.c shader.cpp -I../include -I./src -L../lib -Wall -lglfw3 -lGL -lEGL -lX11 -lassimp -lpthread -ldl -Wl,-rpath,'$ORIGIN' -o ../run/main
 
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 #include "utils/shader.h"
+#include "utils/shader_variants.h"
 #include "utils/camera.h"
 #include "utils/model.h"
+#include "utils/gl_stats.h"
+#include "utils/uniform_buffer.h"
+#include "utils/frustum_culling.h"
+#include "utils/lod.h"
+#include "utils/texture_loader.h"
+#include "utils/texture_cache.h"
+#include "utils/headless.h"
+#include "utils/profiler.h"
+#include "utils/instance_buffer.h"
+#include "utils/asset_pack.h"
+#include "utils/program_cache.h"
+#include "utils/light_clusters.h"
+#include "utils/light_buffer.h"
+#include "utils/occlusion_culling.h"
+#include "utils/triple_buffer.h"
+#include "utils/dynamic_buffer.h"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
-#include "glm/gtc/type_ptr.hpp"
 
 #include "shaders/shader_source.h"
 
@@ -35,147 +58,515 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// Window events arrive on the main thread, the render thread picks them up from the next frame packet
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+bool profileRequested = false;
+
 // Light position
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 
-int main() 
+// Headless runs advance time by a fixed step so every run renders the same frames
+const float HEADLESS_TIMESTEP = 1.0f / 60.0f;
+
+// Bytes of per-frame data one frame can allocate from the dynamic buffer
+const size_t DYNAMIC_FRAME_BYTES = 64 * 1024;
+
+// Profiling: frames captured when P is pressed, and where traces go
+const unsigned int PROFILE_KEY_FRAMES = 120;
+const char *tracePath = "trace.json";
+
+// Everything the render thread needs for one frame. The update thread fills it and never touches it again
+// once published, the render thread only reads it
+struct FramePacket {
+    unsigned int frameIndex;
+    float time;
+    // Tells the render thread to stop instead of drawing
+    bool quit;
+    bool captureProfile;
+    int framebufferWidth;
+    int framebufferHeight;
+    FrameUniforms uniforms;
+    glm::mat4 view;
+    std::vector<MeshDraw> draws;
+    // Node transforms of the instanced copies, see Model::getNodeWorlds
+    std::vector<glm::mat4> nodeWorlds;
+    std::vector<PointLight> lights;
+    LightClusters clusters;
+    CullStats cullStats;
+};
+
+int main(int argc, char **argv) 
 {
-    // GLFW: initialize and configure
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    
+    // --stats prints the GL call counters once per second
+    // --depth-prepass lays down depth before shading
+    // --headless N renders N frames offscreen without a window and reports their times
+    // --frame-times FILE writes the headless frame times as JSON
+    // --screenshot FILE writes the last headless frame as PPM
+    // --profile N captures the first N frames as a Chrome trace, P captures more at any time
+    // --trace FILE is where captures go, trace.json by default
+    // --instances N draws N tinted copies of the model in a grid with instanced draws
+    // --lights N adds N colored point lights circling the model, shaded through clustered lighting
+    // --occlusion skips meshes hidden behind the model's largest meshes, found with a software depth buffer
+    // --no-program-cache always compiles shaders from source
+    // --pack FILE reads models and textures from an asset pack written by assetpack, loose files fill the gaps
+    bool printStats = false;
+    bool depthPrepass = false;
+    unsigned int headlessFrames = 0;
+    const char *frameTimesPath = NULL;
+    const char *screenshotPath = NULL;
+    unsigned int profileFrames = 0;
+    unsigned int instanceCount = 0;
+    unsigned int pointLightCount = 0;
+    bool occlusionCulling = false;
+    const char *packPath = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--stats") == 0)
+        {
+            printStats = true;
+        }
+        else if(std::strcmp(argv[i], "--depth-prepass") == 0)
+        {
+            depthPrepass = true;
+        }
+        else if(std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+        {
+            headlessFrames = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if(std::strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc)
+        {
+            frameTimesPath = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc)
+        {
+            screenshotPath = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profileFrames = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if(std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+        {
+            instanceCount = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if(std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+        {
+            pointLightCount = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if(std::strcmp(argv[i], "--occlusion") == 0)
+        {
+            occlusionCulling = true;
+        }
+        else if(std::strcmp(argv[i], "--no-program-cache") == 0)
+        {
+            ProgramCache::global().setEnabled(false);
+        }
+        else if(std::strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+        {
+            packPath = argv[++i];
+        }
+    }
+    bool headless = headlessFrames > 0;
+
+    GLFWwindow *window = NULL;
+    HeadlessContext headlessContext;
+    OffscreenTarget offscreen;
+    if(headless)
+    {
+        if(!headlessContext.create(SCR_WIDTH, SCR_HEIGHT) || !offscreen.create(SCR_WIDTH, SCR_HEIGHT))
+        {
+            std::cout << "Failed to create headless context" << std::endl;
+            return -1;
+        }
+    }
+    else
+    {
+        // GLFW: initialize and configure
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-    // GLFW: window creation
-    // Window object that will hold all data
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "OpenGL 3.3", NULL, NULL);
-    if(window == NULL)
-    {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        // GLFW: window creation
+        // Window object that will hold all data
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "OpenGL 3.3", NULL, NULL);
+        if(window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        // HiDPI framebuffers are larger than the window from the start, without a resize
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        // glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+        // GLAD: load all OpenGL function pointers
+        // Initialize GLAD before use any OpenGL function
+        if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    // glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
 
-    // GLAD: load all OpenGL function pointers
-    // Initialize GLAD before use any OpenGL function
-    if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    glEnable(GL_DEPTH_TEST);
+
+    // Each mesh is drawn with the variant its material needs, compiled in the background on first use
+    ShaderVariants ourShaders(Source::vert_shader_source, Source::frag_shader_source);
+    ourShaders.setSetup([](Shader &shader) {
+        shader.bindUniformBlock("FrameBlock", FRAME_UBO_BINDING, UniformBuffer<FrameUniforms>::size());
+        shader.bindUniformBlock("MaterialBlock", MATERIAL_UBO_BINDING, sizeof(Material));
+        LightBuffer::setSamplers(shader);
+    });
+    if(pointLightCount > 0)
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        ourShaders.setGlobalFeatures(SHADER_CLUSTERED_LIGHTS);
     }
 
-    glEnable(GL_DEPTH_TEST);
+    Shader depthShader(Source::depth_vert_shader_source, Source::depth_frag_shader_source);
+    depthShader.bindUniformBlock("FrameBlock", FRAME_UBO_BINDING, UniformBuffer<FrameUniforms>::size());
+
+    // Per-frame uniforms go in one buffer update, only the model matrix stays a plain uniform
+    UniformBuffer<FrameUniforms> frameUniforms(FRAME_UBO_BINDING);
+    // The per-frame copies live in fenced regions of one dynamic buffer, so an update never overwrites a block draws still read
+    DynamicBuffer dynamicBuffer(DYNAMIC_FRAME_BYTES);
+    std::cout << "Dynamic buffer: " << (dynamicBuffer.isPersistent() ? "persistently mapped" : "unsynchronized map fallback") << std::endl;
+    float lastStatsTime = 0.0f;
 
-    Shader ourShader(Source::vert_shader_source, Source::frag_shader_source);
+    // Draws are sorted and submitted by the queue
+    RenderQueue renderQueue;
+    if(depthPrepass)
+    {
+        renderQueue.setDepthPrepass(&depthShader);
+    }
 
     // ------------------------------------------------------------------------
     // ------------------------------------------------------------------------
     // ------------------------------------------------------------------------
 
-    // std::ifstream file{"ground.dae"};
-    // file.seekg(0, file.end);
-    // long length = file.tellg();
-    // file.seekg(0, file.beg);
+    // One mapping serves every asset the pack holds, with no per-file open or copy
+    if(packPath && !AssetPack::global().open(packPath))
+    {
+        return -1;
+    }
+
+    Model ourModel("multi.dae", VertexFormat::FULL, true);
+    ourModel.requestShaders(ourShaders, instanceCount > 0);
+
+    // Copies laid out on a square grid in the XZ plane, each with its own tint
+    std::vector<InstanceData> instances(instanceCount);
+    unsigned int gridSide = (unsigned int)std::ceil(std::sqrt((float)instanceCount));
+    for (unsigned int i = 0; i < instanceCount; i++)
+    {
+        float x = (float)(i % gridSide) - (gridSide - 1) * 0.5f;
+        float z = (float)(i / gridSide) - (gridSide - 1) * 0.5f;
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, -z) * 3.0f);
+
+        float hue = (float)i / instanceCount * 6.2831853f;
+        glm::vec4 tint(0.75f + 0.25f * std::sin(hue), 0.75f + 0.25f * std::sin(hue + 2.0944f), 0.75f + 0.25f * std::sin(hue + 4.1888f), 1.0f);
+        instances[i] = InstanceData(transform, tint);
+    }
 
-    // char *buffer = new char[length];
+    // Point lights on a few rings around the model, binned into clusters every frame
+    LightBuffer lightBuffer;
 
-    // file.read(buffer, length);
-    // file.close();
+    // Occluders rasterized on a worker while the frame's other CPU work goes on
+    OcclusionCuller occlusion;
 
-    // Model ourModel(buffer, length);
+    // Measured frames start with every texture resident and every shader variant built, so runs don't
+    // depend on decode or compile speed
+    FrameTimes frameTimes;
+    if(headless)
+    {
+        while(!TextureLoader::global().idle() || ourShaders.pending() > 0)
+        {
+            TextureLoader::global().update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
 
-    // delete[] buffer;
+    ProgramCache::global().getStats().print();
+    Profiler::global().capture(profileFrames, tracePath);
 
-    Model ourModel("multi.dae"); 
+    // From here on the main thread updates (input, camera, lights, culling) and a render thread owning the GL
+    // context submits. Frame packets pass between them through a triple buffer, so the next frame is prepared
+    // while the current one is drawn
+    TripleBuffer<FramePacket> packets;
+    if(headless)
+    {
+        headlessContext.release();
+    }
+    else
+    {
+        glfwMakeContextCurrent(NULL);
+    }
 
-    // Render loop
-    while(!glfwWindowShouldClose(window))
+    std::thread renderThread([&]() {
+        if(headless)
+        {
+            headlessContext.makeCurrent();
+        }
+        else
+        {
+            glfwMakeContextCurrent(window);
+        }
+
+        int viewportWidth = SCR_WIDTH;
+        int viewportHeight = SCR_HEIGHT;
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        while(true)
+        {
+            packets.waitForPublish();
+            packets.acquire();
+            const FramePacket &packet = packets.read();
+            if(packet.quit)
+            {
+                break;
+            }
+
+            Profiler::global().beginFrame();
+            if(packet.captureProfile)
+            {
+                Profiler::global().capture(PROFILE_KEY_FRAMES, tracePath);
+            }
+
+            if(printStats && packet.time - lastStatsTime >= 1.0f)
+            {
+                GLStats::frame().print();
+                renderQueue.printStats();
+                packet.cullStats.print();
+                TextureLoaderStats::frame().print();
+                TextureCache::global().getStats().print();
+                dynamicBuffer.getStats().print(dynamicBuffer.getFrameSize());
+                dynamicBuffer.getStats().reset();
+                lastStatsTime = packet.time;
+            }
+            GLStats::frame().reset();
+            TextureLoaderStats::frame().reset();
+
+            // Streams in the textures decoded since the last frame, within a byte budget
+            TextureLoader::global().update();
+
+            if(packet.framebufferWidth != viewportWidth || packet.framebufferHeight != viewportHeight)
+            {
+                viewportWidth = packet.framebufferWidth;
+                viewportHeight = packet.framebufferHeight;
+                glViewport(0, 0, viewportWidth, viewportHeight);
+            }
+
+            dynamicBuffer.beginFrame();
+
+            // Rendering commands
+            glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            if(!packet.lights.empty())
+            {
+                lightBuffer.update(packet.lights, packet.clusters);
+                lightBuffer.bind();
+            }
+            frameUniforms.update(packet.uniforms, dynamicBuffer);
+
+            renderQueue.begin(packet.view, 100.0f);
+            ourModel.Draw(ourShaders, renderQueue, packet.draws);
+            {
+                ProfileScope scope("RenderQueue::flush", true);
+                renderQueue.flush();
+            }
+
+            // Every copy in one draw per mesh
+            ourModel.DrawInstanced(ourShaders, instances, packet.nodeWorlds);
+            dynamicBuffer.endFrame();
+
+            if(headless)
+            {
+                // Waiting for the GPU makes the sample cover the whole frame, not just its submission. Samples run
+                // from one finished frame to the next, which is what bounds the rate with the update overlapping
+                glFinish();
+                std::chrono::steady_clock::time_point frameEnd = std::chrono::steady_clock::now();
+                std::chrono::duration<double, std::milli> elapsed = frameEnd - frameStart;
+                frameTimes.add(elapsed.count());
+                frameStart = frameEnd;
+            }
+            else
+            {
+                ProfileScope scope("Swap");
+                glfwSwapBuffers(window);
+            }
+
+            Profiler::global().endFrame();
+        }
+
+        if(headless)
+        {
+            headlessContext.release();
+        }
+        else
+        {
+            glfwMakeContextCurrent(NULL);
+        }
+    });
+
+    // Update loop
+    unsigned int frameIndex = 0;
+    for (; headless ? frameIndex < headlessFrames : !glfwWindowShouldClose(window); frameIndex++)
     {
-        float currentFrame = glfwGetTime();
+        float currentFrame = headless ? frameIndex * HEADLESS_TIMESTEP : glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        CullStats::frame().reset();
 
         // Inputs
-        processInput(window);
-
-        // Rendering commands
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glUseProgram(ourShader.ID);
+        if(!headless)
+        {
+            glfwPollEvents();
+            processInput(window);
+        }
+
+        FramePacket &packet = packets.write();
+        packet.frameIndex = frameIndex;
+        packet.time = currentFrame;
+        packet.quit = false;
+        packet.captureProfile = profileRequested;
+        profileRequested = false;
+        packet.framebufferWidth = framebufferWidth;
+        packet.framebufferHeight = framebufferHeight;
 
         glm::vec3 lightColor;
-        lightColor.x = sin(glfwGetTime() * 2.0f);
-        lightColor.y = sin(glfwGetTime() * 0.7f);
-        lightColor.z = sin(glfwGetTime() * 1.3f);
+        lightColor.x = sin(currentFrame * 2.0f);
+        lightColor.y = sin(currentFrame * 0.7f);
+        lightColor.z = sin(currentFrame * 1.3f);
 
         glm::vec3 diffuseColor = lightColor * glm::vec3(0.5f);
         glm::vec3 ambientColor = lightColor * glm::vec3(0.2f);
 
-        // Set uniforms
-        unsigned int lightPosLoc = glGetUniformLocation(ourShader.ID, "lightPos");
-        unsigned int viewPosLoc = glGetUniformLocation(ourShader.ID, "viewPos");
-        glUniform3fv(lightPosLoc, 1, &lightPos[0]);
-        glUniform3fv(viewPosLoc, 1, &camera.position[0]);
-
-        unsigned int light_ambient = glGetUniformLocation(ourShader.ID, "light.ambient");
-        unsigned int light_diffuse = glGetUniformLocation(ourShader.ID, "light.diffuse");
-        unsigned int light_specular = glGetUniformLocation(ourShader.ID, "light.specular");
-        glUniform3fv(light_ambient, 1, &ambientColor[0]);
-        glUniform3fv(light_diffuse, 1, &diffuseColor[0]);
-        glUniform3f(light_specular, 1.0f, 1.0f, 1.0f);
-
-        // unsigned int material_ambient = glGetUniformLocation(ourShader.ID, "material.ambient");
-        // unsigned int material_diffuse = glGetUniformLocation(ourShader.ID, "material.diffuse");
-        // unsigned int material_specular = glGetUniformLocation(ourShader.ID, "material.specular");
-        // unsigned int material_shininess = glGetUniformLocation(ourShader.ID, "material.shininess");
-        // glUniform3f(material_ambient, 1.0f, 0.5f, 0.31f);
-        // glUniform3f(material_diffuse, 1.0f, 0.5f, 0.31f);
-        // glUniform3f(material_specular, 1.0f, 0.5f, 0.31f);
-        // glUniform1f(material_shininess, 32.0f);
-
         // view/projections transformations
         glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = camera.getViewMatrix();
-        unsigned int viewLoc = glGetUniformLocation(ourShader.ID, "view");
-        unsigned int projectionLoc = glGetUniformLocation(ourShader.ID, "projection");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
         model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-        unsigned int modelLoc = glGetUniformLocation(ourShader.ID, "model");
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, &model[0][0]);
 
-        ourModel.Draw(ourShader);
+        bool occlusionThisFrame = occlusionCulling && instances.empty();
+        if(occlusionThisFrame)
+        {
+            ProfileScope scope("OcclusionCuller::renderAsync");
+            occlusion.clearOccluders();
+            ourModel.addOccluders(occlusion, model);
+            occlusion.renderAsync(projection * view);
+        }
+
+        packet.lights.resize(pointLightCount);
+        if(pointLightCount > 0)
+        {
+            ProfileScope scope("LightClusters::build");
+            for (unsigned int i = 0; i < pointLightCount; i++)
+            {
+                float angle = (float)i / pointLightCount * 6.2831853f * 7.0f + currentFrame * 0.5f;
+                float ring = 2.0f + (i % 4) * 1.5f;
+                glm::vec3 position(std::cos(angle) * ring, (float)(i % 3) - 1.0f, std::sin(angle) * ring);
+                glm::vec3 color(0.5f + 0.5f * std::sin(angle), 0.5f + 0.5f * std::sin(angle + 2.0944f), 0.5f + 0.5f * std::sin(angle + 4.1888f));
+                packet.lights[i] = PointLight(position, 1.5f, color * 2.0f);
+            }
+
+            packet.clusters.build(packet.lights, view, projection, 0.1f, 100.0f);
+        }
 
-        // Check and call events and swap the buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // Set uniforms
+        FrameUniforms &frame = packet.uniforms;
+        frame.view = view;
+        frame.projection = projection;
+        frame.viewPos = camera.position;
+        frame.lightPos = lightPos;
+        frame.light.ambient = ambientColor;
+        frame.light.diffuse = diffuseColor;
+        frame.light.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+        glm::vec2 sliceScale = packet.clusters.getSliceScale();
+        // Tiles are picked from gl_FragCoord, so in pixels of the viewport the render thread sets. A minimized
+        // window has a zero sized framebuffer
+        frame.clusterScale = glm::vec4((float)LightClusters::SIZE_X / std::max(1, packet.framebufferWidth), (float)LightClusters::SIZE_Y / std::max(1, packet.framebufferHeight),
+                                       sliceScale.x, sliceScale.y);
+        frame.clusterSize = glm::ivec4(LightClusters::SIZE_X, LightClusters::SIZE_Y, LightClusters::SIZE_Z, pointLightCount);
+        packet.view = view;
+
+        // Meshes outside the view are dropped before they reach the render thread
+        Frustum frustum = ExtractFrustum(projection * view);
+        // Distant meshes switch to simplified index buffers once their error is below a pixel
+        LodSelector lodSelector(camera.position, camera.zoom, (float)SCR_HEIGHT);
+
+        packet.draws.clear();
+        if(instances.empty())
+        {
+            ourModel.cull(model, frustum, &lodSelector, occlusionThisFrame ? &occlusion : NULL, packet.draws);
+        }
+        else
+        {
+            ourModel.getNodeWorlds(packet.nodeWorlds);
+        }
+        packet.cullStats = CullStats::frame();
+
+        // At most one frame ahead of the render thread: no packet is ever dropped and input is at most a frame old
+        packets.waitForAcquire();
+        packets.publish();
+    }
+
+    // Stops the render thread once it has drawn every frame published before
+    FramePacket &quit = packets.write();
+    quit.frameIndex = frameIndex;
+    quit.quit = true;
+    packets.waitForAcquire();
+    packets.publish();
+    renderThread.join();
+
+    if(headless)
+    {
+        headlessContext.makeCurrent();
+        frameTimes.print();
+        if(frameTimesPath)
+        {
+            frameTimes.write(frameTimesPath);
+        }
+        if(screenshotPath)
+        {
+            offscreen.writePPM(screenshotPath);
+        }
+    }
+    else
+    {
+        glfwMakeContextCurrent(window);
     }
 
     // De-allocate all resources once they have outlived their purpose
-    glDeleteProgram(ourShader.ID);
-    
-    glfwTerminate();
+    ourShaders.clear();
+    glDeleteProgram(depthShader.ID);
+
+    if(!headless)
+    {
+        glfwTerminate();
+    }
     return 0;
 }
 
 // Call this function every time the user resize the window
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
 // Checks if the escape key was pressed and then close the window
@@ -186,6 +577,11 @@ void processInput(GLFWwindow *window)
         glfwSetWindowShouldClose(window, true);
     }
 
+    if(glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+    {
+        profileRequested = true;
+    }
+
     if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
     {
         camera.ProcessKeyboard(CameraMovement::FORWARD, deltaTime);
@@ -3,24 +3,83 @@
 
 namespace Source
 {
+    // Features are #defines injected by ShaderVariants, see ShaderFeature
     const char *vert_shader_source = R"(#version 330 core
     layout(location = 0) in vec3 aPos;
     layout(location = 1) in vec3 aNormal;
     layout(location = 2) in vec2 aTexCoords;
+#ifdef INSTANCED
+    layout(location = 3) in mat4 aInstanceModel;
+    layout(location = 7) in vec4 aInstanceTint;
+
+    out vec4 Tint;
+#endif
 
     out vec3 Normal;
     out vec3 FragPos;
     out vec2 TexCoords;
 
+    // Bit-identical depth with the depth pre-pass
+    invariant gl_Position;
+
+    struct Light {
+       vec3 ambient;
+       vec3 diffuse;
+       vec3 specular;
+    };
+
+    // Per-frame data, one buffer update per frame. Must match FrameUniforms
+    layout(std140) uniform FrameBlock {
+       mat4 view;
+       mat4 projection;
+       vec3 viewPos;
+       vec3 lightPos;
+       Light light;
+       vec4 clusterScale;
+       ivec4 clusterSize;
+    };
+
     uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+
+    // Compact vertices: positions are 16-bit integers relative to the mesh bounds,
+    // normals are octahedral encoded 16-bit integers
+    uniform vec3 positionScale;
+    uniform vec3 positionOffset;
+
+#ifdef COMPACT_VERTEX
+    vec3 octDecode(vec2 e)
+    {
+       vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+       if(n.z < 0.0)
+       {
+          vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+          n.xy = (1.0 - abs(n.yx)) * signs;
+       }
+       return normalize(n);
+    }
+#endif
 
     void main()
     {
-       gl_Position = projection * view * model * vec4(aPos, 1.0);
-       FragPos = vec3(model * vec4(aPos, 1.0));
-       Normal = aNormal;
+       vec3 position = aPos * positionScale + positionOffset;
+#ifdef COMPACT_VERTEX
+       vec3 normal = octDecode(aNormal.xy / 32767.0);
+#else
+       vec3 normal = aNormal;
+#endif
+
+#ifdef INSTANCED
+       // model holds the mesh's node transform and the instance places the whole model
+       mat4 world = aInstanceModel * model;
+       Tint = aInstanceTint;
+#else
+       mat4 world = model;
+#endif
+
+       gl_Position = projection * view * world * vec4(position, 1.0);
+       FragPos = vec3(world * vec4(position, 1.0));
+       // Node and instance transforms may rotate and scale unevenly, normals need the inverse transpose
+       Normal = mat3(transpose(inverse(world))) * normal;
        TexCoords = aTexCoords;
     })";
 
@@ -29,50 +88,151 @@ namespace Source
     in vec3 Normal;
     in vec3 FragPos;
     in vec2 TexCoords;
+#ifdef INSTANCED
+    in vec4 Tint;
+#endif
 
     out vec4 FragColor;
 
-    struct Material {
+    layout(std140) uniform MaterialBlock {
        vec3 ambient;
        vec3 diffuse;
        vec3 specular;
        float shininess;
-    };
+    } material;
 
     struct Light {
-       vec3 position;
        vec3 ambient;
        vec3 diffuse;
        vec3 specular;
     };
 
-    uniform Material material;
-    uniform Light light;
+    // Per-frame data, one buffer update per frame. Must match FrameUniforms
+    layout(std140) uniform FrameBlock {
+       mat4 view;
+       mat4 projection;
+       vec3 viewPos;
+       vec3 lightPos;
+       Light light;
+       vec4 clusterScale;
+       ivec4 clusterSize;
+    };
 
+#ifdef TEXTURED
     uniform sampler2D texture_diffuse1;
-
-    uniform vec3 lightPos;
-    uniform vec3 viewPos;
+#endif
+#ifdef SPECULAR_MAP
+    uniform sampler2D texture_specular1;
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+    // Point lights binned per cluster on the CPU, see LightClusters and LightBuffer
+    uniform samplerBuffer lightData;
+    uniform usamplerBuffer clusterGrid;
+    uniform usamplerBuffer lightIndices;
+#endif
 
     void main()
     {
+       vec3 norm = normalize(Normal);
+#ifdef SPECULAR
+       vec3 viewDir = normalize(viewPos - FragPos);
+       vec3 specularColor = material.specular;
+#ifdef SPECULAR_MAP
+       specularColor *= texture(texture_specular1, TexCoords).rgb;
+#endif
+#endif
+
        // Ambient
        vec3 ambient = light.ambient * material.ambient;
 
        // Diffuse
-       vec3 norm = normalize(Normal);
        vec3 lightDir = normalize(lightPos - FragPos);
        float diff = max(dot(norm, lightDir), 0.0);
        vec3 diffuse = light.diffuse * (diff * material.diffuse);
-    
+       vec3 result = ambient + diffuse;
+
+#ifdef SPECULAR
        // Specular
-       vec3 viewDir = normalize(viewPos - FragPos);
        vec3 reflectDir = reflect(-lightDir, norm);
        float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-       vec3 specular = light.specular * (spec * material.specular);
+       result += light.specular * (spec * specularColor);
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+       // Only the lights of this fragment's cluster: screen tile, then exponential depth slice
+       float depth = -(view * vec4(FragPos, 1.0)).z;
+       ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, log(depth) * clusterScale.z + clusterScale.w);
+       cluster = clamp(cluster, ivec3(0), clusterSize.xyz - 1);
+       uvec2 range = texelFetch(clusterGrid, cluster.x + clusterSize.x * (cluster.y + clusterSize.y * cluster.z)).xy;
+
+       for (uint i = 0u; i < range.y; i++)
+       {
+          int index = int(texelFetch(lightIndices, int(range.x + i)).r);
+          vec4 positionRadius = texelFetch(lightData, index * 2);
+          vec3 color = texelFetch(lightData, index * 2 + 1).rgb;
+
+          // Inverse square, windowed so it reaches zero at the radius the light was binned with
+          vec3 toLight = positionRadius.xyz - FragPos;
+          float distance = length(toLight);
+          float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+          float attenuation = window * window / (distance * distance + 1.0);
+          vec3 pointDir = toLight / max(distance, 0.0001);
+
+          result += color * (attenuation * max(dot(norm, pointDir), 0.0)) * material.diffuse;
+#ifdef SPECULAR
+          float pointSpec = pow(max(dot(viewDir, reflect(-pointDir, norm)), 0.0), material.shininess);
+          result += color * (attenuation * pointSpec) * specularColor;
+#endif
+       }
+#endif
+
+       FragColor = vec4(result, 1.0);
+#ifdef TEXTURED
+       FragColor *= texture(texture_diffuse1, TexCoords);
+#endif
+#ifdef INSTANCED
+       FragColor *= Tint;
+#endif
+    })";
+
+    // Depth-only pre-pass: same transform as vert_shader_source, no shading
+    const char *depth_vert_shader_source = R"(#version 330 core
+    layout(location = 0) in vec3 aPos;
 
-       vec3 result = ambient + diffuse + specular;
-       FragColor = texture(texture_diffuse1, TexCoords) * vec4(result, 1.0);
+    invariant gl_Position;
+
+    struct Light {
+       vec3 ambient;
+       vec3 diffuse;
+       vec3 specular;
+    };
+
+    layout(std140) uniform FrameBlock {
+       mat4 view;
+       mat4 projection;
+       vec3 viewPos;
+       vec3 lightPos;
+       Light light;
+       vec4 clusterScale;
+       ivec4 clusterSize;
+    };
+
+    uniform mat4 model;
+    uniform vec3 positionScale;
+    uniform vec3 positionOffset;
+
+    void main()
+    {
+       vec3 position = aPos * positionScale + positionOffset;
+       // Exactly the expression of the non-instanced main shader, or invariance doesn't hold
+       gl_Position = projection * view * model * vec4(position, 1.0);
+    })";
+
+    const char *depth_frag_shader_source = R"(#version 330 core
+
+    void main()
+    {
     })";
 }
 
@@ -0,0 +1,91 @@
+// Offline texture baker: compresses images to BC1/BC3 with a full mip chain and writes them
+// next to the source as <image>.ktx, where the runtime loaders pick them up.
+// Usage: texbake <image>...
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+
+#include "utils/ktx.h"
+#include "utils/texture_compression.h"
+#include "utils/thread_pool.h"
+
+// Block rows compressed per task
+const int ROWS_PER_TASK = 16;
+
+bool bake(const std::string &path)
+{
+    int width, height, components;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &components, 4);
+    if(!data)
+    {
+        std::cout << "ERROR::TEXBAKE::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    ImageRGBA image(width, height);
+    std::memcpy(image.pixels.data(), data, image.pixels.size());
+    stbi_image_free(data);
+
+    // Opaque images don't need the extra 8 bytes of alpha per block
+    unsigned int format = image.isOpaque() ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC3;
+    std::vector<ImageRGBA> mips = BuildMipChain(image);
+
+    std::vector<std::vector<unsigned char> > levels(mips.size());
+    size_t totalBytes = 0;
+    for (unsigned int i = 0; i < mips.size(); i++)
+    {
+        const ImageRGBA &mip = mips[i];
+        levels[i].resize(CompressedSize(format, mip.width, mip.height));
+        totalBytes += levels[i].size();
+
+        int blockRows = (mip.height + 3) / 4;
+        int tasks = (blockRows + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+        unsigned char *out = levels[i].data();
+        ThreadPool::global().parallelFor(tasks, [&mip, format, blockRows, out](size_t task) {
+            int firstRow = task * ROWS_PER_TASK;
+            int lastRow = std::min(firstRow + ROWS_PER_TASK, blockRows);
+            CompressBlockRows(mip, format, firstRow, lastRow, out);
+        });
+    }
+
+    ImageRGBA decoded = DecompressImage(levels[0].data(), format, width, height);
+    double psnr = ComputePSNR(image, decoded, format == TEXTURE_FORMAT_BC1 ? 3 : 4);
+
+    // GL_RGB / GL_RGBA
+    unsigned int baseFormat = format == TEXTURE_FORMAT_BC1 ? 0x1907 : 0x1908;
+    std::string bakedPath = BakedTexturePath(path);
+    if(!WriteKtx(bakedPath, format, baseFormat, width, height, levels))
+    {
+        return false;
+    }
+
+    std::cout << bakedPath << ": " << width << "x" << height
+              << (format == TEXTURE_FORMAT_BC1 ? " BC1" : " BC3")
+              << ", " << levels.size() << " levels, "
+              << size_t(width) * height * 4 * 4 / 3 << " -> " << totalBytes << " bytes"
+              << ", PSNR " << psnr << " dB" << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <image>..." << std::endl;
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i++)
+    {
+        ok = bake(argv[i]) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
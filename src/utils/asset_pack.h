@@ -0,0 +1,389 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "hash.h"
+#include "mapped_file.h"
+
+// Forward slashes, no empty or "." segments, ".." folded into its parent where possible
+inline std::string NormalizePath(const std::string &path)
+{
+    std::string unified(path);
+    for (unsigned int i = 0; i < unified.size(); i++)
+    {
+        if(unified[i] == '\\')
+        {
+            unified[i] = '/';
+        }
+    }
+
+    bool absolute = !unified.empty() && unified[0] == '/';
+    std::vector<std::string> segments;
+    size_t start = 0;
+    while(start <= unified.size())
+    {
+        size_t end = unified.find('/', start);
+        if(end == std::string::npos)
+        {
+            end = unified.size();
+        }
+
+        std::string segment = unified.substr(start, end - start);
+        if(segment == "..")
+        {
+            if(!segments.empty() && segments.back() != "..")
+            {
+                segments.pop_back();
+            }
+            else if(!absolute)
+            {
+                segments.push_back(segment);
+            }
+        }
+        else if(!segment.empty() && segment != ".")
+        {
+            segments.push_back(segment);
+        }
+
+        start = end + 1;
+    }
+
+    std::string normalized = absolute ? "/" : "";
+    for (unsigned int i = 0; i < segments.size(); i++)
+    {
+        normalized += (i > 0 ? "/" : "") + segments[i];
+    }
+    return normalized;
+}
+
+// Many asset files concatenated into one, so startup maps a single file instead of opening hundreds.
+//
+// File layout (offsets are from the start of the file):
+//   PackHeader
+//   PackSlot[slotCount]    Open addressing hash table keyed by the normalized path, linear probing
+//   Name table             Normalized paths, not null terminated
+//   File data              Each file 16 byte aligned, so mapped data keeps the alignment of its contents
+struct PackHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t fileCount;
+    std::uint32_t slotCount;            // Power of two
+    std::uint64_t nameTableOffset;
+    std::uint64_t nameTableSize;
+};
+
+struct PackSlot {
+    std::uint64_t hash;
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint32_t nameOffset;
+    std::uint32_t nameLength;           // 0 marks an empty slot
+};
+
+class AssetPack
+{
+public:
+    static const std::uint32_t VERSION = 1;
+
+    // The pack every AssetFile looks in first
+    static AssetPack &global()
+    {
+        static AssetPack pack;
+        return pack;
+    }
+
+    bool open(const std::string &packPath)
+    {
+        if(!this->file.open(packPath))
+        {
+            std::cout << "ERROR::ASSET_PACK::OPEN_FAILED " << packPath << std::endl;
+            return false;
+        }
+
+        if(!this->validate())
+        {
+            std::cout << "ERROR::ASSET_PACK::INVALID " << packPath << std::endl;
+            this->file.close();
+            return false;
+        }
+
+        std::cout << "Asset pack " << packPath << ": " << this->header()->fileCount << " files" << std::endl;
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return this->file.isOpen();
+    }
+
+    // Points data and size at the packed file. Safe from any thread once the pack is open
+    bool find(const std::string &path, const unsigned char *&data, size_t &size) const
+    {
+        if(!this->isOpen())
+        {
+            return false;
+        }
+
+        std::string name = NormalizePath(path);
+        std::uint64_t hash = hashBytes(name.data(), name.size());
+        const PackHeader *h = this->header();
+        const char *names = reinterpret_cast<const char*>(this->file.data + h->nameTableOffset);
+
+        std::uint32_t mask = h->slotCount - 1;
+        for (std::uint32_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const PackSlot &slot = this->slots()[i];
+            if(slot.nameLength == 0)
+            {
+                return false;
+            }
+
+            if(slot.hash == hash && slot.nameLength == name.size() && std::memcmp(names + slot.nameOffset, name.data(), name.size()) == 0)
+            {
+                data = this->file.data + slot.offset;
+                size = slot.size;
+                return true;
+            }
+        }
+    }
+
+    // Packs files under their normalized paths. Writes to a temporary file first so a crash never leaves a torn pack
+    static bool write(const std::string &packPath, const std::vector<std::string> &paths)
+    {
+        std::vector<std::string> names;
+        std::vector<std::string> sources;
+        std::vector<std::uint64_t> sizes;
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            std::string name = NormalizePath(paths[i]);
+            if(std::find(names.begin(), names.end(), name) != names.end())
+            {
+                continue;
+            }
+
+            MappedFile source(paths[i]);
+            if(!source.isOpen())
+            {
+                std::cout << "ERROR::ASSET_PACK::NO_FILE " << paths[i] << std::endl;
+                return false;
+            }
+            names.push_back(name);
+            sources.push_back(paths[i]);
+            sizes.push_back(source.size);
+        }
+
+        // At most half full, so probes stay short
+        std::uint32_t slotCount = 1;
+        while(slotCount < names.size() * 2)
+        {
+            slotCount *= 2;
+        }
+
+        PackHeader header;
+        std::memcpy(header.magic, "AMPK", 4);
+        header.version = VERSION;
+        header.fileCount = names.size();
+        header.slotCount = slotCount;
+        header.nameTableOffset = sizeof(PackHeader) + std::uint64_t(slotCount) * sizeof(PackSlot);
+
+        std::vector<PackSlot> slots(slotCount);
+        std::memset(&slots[0], 0, slots.size() * sizeof(PackSlot));
+        std::string nameTable;
+        std::vector<std::uint32_t> slotOf(names.size());
+        for (unsigned int i = 0; i < names.size(); i++)
+        {
+            PackSlot slot;
+            slot.hash = hashBytes(names[i].data(), names[i].size());
+            slot.size = sizes[i];
+            slot.nameOffset = nameTable.size();
+            slot.nameLength = names[i].size();
+            slot.offset = 0;
+            nameTable += names[i];
+
+            std::uint32_t index = slot.hash & (slotCount - 1);
+            while(slots[index].nameLength != 0)
+            {
+                index = (index + 1) & (slotCount - 1);
+            }
+            slots[index] = slot;
+            slotOf[i] = index;
+        }
+        header.nameTableSize = nameTable.size();
+
+        std::uint64_t offset = align(header.nameTableOffset + header.nameTableSize);
+        for (unsigned int i = 0; i < names.size(); i++)
+        {
+            slots[slotOf[i]].offset = offset;
+            offset = align(offset + sizes[i]);
+        }
+
+        std::string tmpPath = packPath + ".tmp";
+        std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(&slots[0]), slots.size() * sizeof(PackSlot));
+        out.write(nameTable.data(), nameTable.size());
+
+        // Files are streamed from their own mappings, never held in memory together
+        std::uint64_t written = header.nameTableOffset + header.nameTableSize;
+        const char padding[16] = { 0 };
+        for (unsigned int i = 0; i < names.size(); i++)
+        {
+            std::uint64_t target = slots[slotOf[i]].offset;
+            out.write(padding, target - written);
+
+            MappedFile source(sources[i]);
+            if(!source.isOpen() || source.size != sizes[i])
+            {
+                std::cout << "ERROR::ASSET_PACK::CHANGED " << sources[i] << std::endl;
+                out.close();
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(source.data), source.size);
+            written = target + sizes[i];
+        }
+        out.close();
+
+        if(!out || std::rename(tmpPath.c_str(), packPath.c_str()) != 0)
+        {
+            std::cout << "ERROR::ASSET_PACK::WRITE_FAILED " << packPath << std::endl;
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    MappedFile file;
+
+    static std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + 15) & ~std::uint64_t(15);
+    }
+
+    const PackHeader *header() const
+    {
+        return reinterpret_cast<const PackHeader*>(this->file.data);
+    }
+
+    const PackSlot *slots() const
+    {
+        return reinterpret_cast<const PackSlot*>(this->file.data + sizeof(PackHeader));
+    }
+
+    // Checks that every table and file stays inside the pack, and that probing always ends
+    bool validate() const
+    {
+        if(this->file.size < sizeof(PackHeader))
+        {
+            return false;
+        }
+
+        const PackHeader *h = this->header();
+        if(std::memcmp(h->magic, "AMPK", 4) != 0 || h->version != VERSION || h->slotCount == 0 ||
+           (h->slotCount & (h->slotCount - 1)) != 0 || h->fileCount >= h->slotCount)
+        {
+            return false;
+        }
+
+        std::uint64_t tables = sizeof(PackHeader) + std::uint64_t(h->slotCount) * sizeof(PackSlot);
+        if(h->nameTableOffset != tables || tables + h->nameTableSize > this->file.size)
+        {
+            return false;
+        }
+
+        std::uint64_t used = 0;
+        for (unsigned int i = 0; i < h->slotCount; i++)
+        {
+            const PackSlot &slot = this->slots()[i];
+            if(slot.nameLength == 0)
+            {
+                continue;
+            }
+
+            used++;
+            if(std::uint64_t(slot.nameOffset) + slot.nameLength > h->nameTableSize ||
+               slot.offset > this->file.size || slot.size > this->file.size - slot.offset)
+            {
+                return false;
+            }
+        }
+
+        // find() stops at the first empty slot, so there has to be one. fileCount < slotCount makes sure
+        return used == h->fileCount;
+    }
+};
+
+// Read-only view of an asset: inside the global pack when it holds the path, otherwise the loose file mapped
+// on its own. Either way data stays valid for the lifetime of the AssetFile and nothing is copied
+class AssetFile
+{
+public:
+    AssetFile()
+        : data(NULL), size(0)
+    {
+    }
+
+    explicit AssetFile(const std::string &path)
+        : data(NULL), size(0)
+    {
+        this->open(path);
+    }
+
+    bool open(const std::string &path)
+    {
+        this->close();
+
+        if(AssetPack::global().find(path, this->data, this->size))
+        {
+            return true;
+        }
+
+        if(!this->loose.open(path))
+        {
+            return false;
+        }
+        this->data = this->loose.data;
+        this->size = this->loose.size;
+        return true;
+    }
+
+    void close()
+    {
+        this->loose.close();
+        this->data = NULL;
+        this->size = 0;
+    }
+
+    bool isOpen() const
+    {
+        return this->data != NULL;
+    }
+
+    // The data lives in the pack rather than in a file of its own
+    bool isPacked() const
+    {
+        return this->isOpen() && !this->loose.isOpen();
+    }
+
+    const unsigned char *data;
+    size_t size;
+
+private:
+    MappedFile loose;
+
+    AssetFile(const AssetFile&);
+    AssetFile &operator=(const AssetFile&);
+};
+
+#endif // ASSET_PACK_H
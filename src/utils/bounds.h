@@ -0,0 +1,88 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// Axis aligned box plus the sphere around it
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 center;
+    float radius;
+};
+
+template<typename V>
+Bounds ComputeBounds(const std::vector<V> &vertices)
+{
+    Bounds bounds;
+    bounds.min = glm::vec3(0.0f);
+    bounds.max = glm::vec3(0.0f);
+    bounds.center = glm::vec3(0.0f);
+    bounds.radius = 0.0f;
+
+    if(vertices.empty())
+    {
+        return bounds;
+    }
+
+    bounds.min = vertices[0].Position;
+    bounds.max = vertices[0].Position;
+    for (unsigned int i = 1; i < vertices.size(); i++)
+    {
+        bounds.min = glm::min(bounds.min, vertices[i].Position);
+        bounds.max = glm::max(bounds.max, vertices[i].Position);
+    }
+
+    // Sphere centered on the box, tight around the actual vertices
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (unsigned int i = 0; i < vertices.size(); i++)
+    {
+        glm::vec3 d = vertices[i].Position - bounds.center;
+        radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+    }
+    bounds.radius = std::sqrt(radiusSquared);
+
+    return bounds;
+}
+
+// Largest factor the matrix stretches a length by, along one of its axes
+inline float MaxAxisScale(const glm::mat4 &m)
+{
+    float scale = 0.0f;
+    for (int j = 0; j < 3; j++)
+    {
+        scale = std::max(scale, glm::length(glm::vec3(m[j])));
+    }
+    return scale;
+}
+
+// Bounds of the transformed box (Arvo). The sphere scales with the largest axis
+inline Bounds TransformBounds(const Bounds &bounds, const glm::mat4 &m)
+{
+    glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+    glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+
+    glm::vec3 newCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+    glm::vec3 newExtent(0.0f);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            newExtent[i] += std::fabs(m[j][i]) * extent[j];
+        }
+    }
+
+    Bounds result;
+    result.min = newCenter - newExtent;
+    result.max = newCenter + newExtent;
+    result.center = glm::vec3(m * glm::vec4(bounds.center, 1.0f));
+    result.radius = bounds.radius * MaxAxisScale(m);
+    return result;
+}
+
+#endif // BOUNDS_H
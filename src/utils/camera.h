@@ -94,7 +94,7 @@ public:
     }
 
     // Mouse input
-    void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
+    void ProcessMouseMovement(float xoffset, float yoffset, bool constrainPitch = true)
     {
         xoffset *= mouseSensitivity;
         yoffset *= mouseSensitivity;
@@ -0,0 +1,229 @@
+#ifndef DYNAMIC_BUFFER_H
+#define DYNAMIC_BUFFER_H
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+
+#include "glad/glad.h"
+
+#include "gl_stats.h"
+#include "profiler.h"
+
+// Whether a buffer can stay mapped while the GPU reads it. Needs glad generated with GL_ARB_buffer_storage,
+// which core 4.4 folded in
+inline bool SupportsBufferStorage()
+{
+#ifdef GL_ARB_buffer_storage
+    static int supported = -1;
+    if(supported < 0)
+    {
+        supported = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if(name && std::strcmp(name, "GL_ARB_buffer_storage") == 0)
+            {
+                supported = 1;
+            }
+        }
+    }
+    return supported == 1;
+#else
+    return false;
+#endif
+}
+
+// Where an allocation landed: write to data, then point GL at buffer and offset
+struct DynamicAllocation {
+    void *data;
+    unsigned int buffer;
+    size_t offset;
+    size_t size;
+};
+
+// How well a DynamicBuffer is sized, over the frames since the last reset
+struct DynamicBufferStats {
+    unsigned int stalls;        // Frames that waited for the GPU to release their region
+    unsigned int overflows;     // Allocations that didn't fit in their frame's region
+    size_t peakBytes;           // Most bytes a single frame used
+
+    DynamicBufferStats()
+    {
+        this->reset();
+    }
+
+    void reset()
+    {
+        this->stalls = 0;
+        this->overflows = 0;
+        this->peakBytes = 0;
+    }
+
+    void print(size_t frameSize) const
+    {
+        std::cout << "Dynamic buffer: peak " << this->peakBytes << " of " << frameSize << " bytes/frame, stalls "
+                  << this->stalls << ", overflows " << this->overflows << std::endl;
+    }
+};
+
+// Bump allocator for data written once per frame and read by the GPU during that frame. One buffer is split
+// into FRAME_COUNT regions used in turn, and a fence after each frame's commands guards its region, so the
+// CPU only waits when it laps the GPU. With GL_ARB_buffer_storage the buffer stays persistently mapped and
+// writes land directly; otherwise they go to a copy in memory that flush() hands over through an
+// unsynchronized, range invalidating map, safe for the same reason. Either way nothing is reallocated
+class DynamicBuffer
+{
+public:
+    static const unsigned int FRAME_COUNT = 3;
+
+    // frameSize is the most bytes one frame can allocate
+    explicit DynamicBuffer(size_t frameSize)
+        : frameSize(frameSize), frame(FRAME_COUNT - 1), mapped(NULL), persistent(false)
+    {
+        for (unsigned int i = 0; i < FRAME_COUNT; i++)
+        {
+            this->fences[i] = 0;
+        }
+        this->head = this->frameStart = this->flushed = this->frame * frameSize;
+
+        size_t total = frameSize * FRAME_COUNT;
+        glGenBuffers(1, &this->buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, this->buffer);
+
+        bool immutable = false;
+#ifdef GL_ARB_buffer_storage
+        if(SupportsBufferStorage())
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+            immutable = true;
+            this->mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags));
+            this->persistent = this->mapped != NULL;
+        }
+#endif
+        if(!immutable)
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW);
+        }
+        if(!this->persistent)
+        {
+            this->staging.resize(total);
+            this->mapped = this->staging.data();
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // Moves on to the next region, waiting only if the GPU still reads what was written there FRAME_COUNT frames ago
+    void beginFrame()
+    {
+        this->frame = (this->frame + 1) % FRAME_COUNT;
+        this->head = this->frameStart = this->flushed = this->frame * this->frameSize;
+
+        GLsync &fence = this->fences[this->frame];
+        if(!fence)
+        {
+            return;
+        }
+
+        if(glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            ProfileScope scope("DynamicBuffer::stall");
+            this->stats.stalls++;
+            while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            {
+            }
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    // size bytes in this frame's region, offset a multiple of alignment. data is NULL when the region is full
+    DynamicAllocation allocate(size_t size, size_t alignment = 16)
+    {
+        DynamicAllocation allocation = { NULL, this->buffer, 0, size };
+
+        size_t offset = (this->head + alignment - 1) / alignment * alignment;
+        if(offset + size > this->frameStart + this->frameSize)
+        {
+            if(this->stats.overflows++ == 0)
+            {
+                std::cout << "ERROR::DYNAMIC_BUFFER::FRAME_FULL " << size << " bytes requested, "
+                          << this->frameStart + this->frameSize - this->head << " left" << std::endl;
+            }
+            return allocation;
+        }
+
+        this->head = offset + size;
+        this->stats.peakBytes = std::max(this->stats.peakBytes, this->head - this->frameStart);
+        allocation.data = this->mapped + offset;
+        allocation.offset = offset;
+        return allocation;
+    }
+
+    // Makes everything allocated so far visible to GL; call before drawing with it. Free while persistently mapped
+    void flush()
+    {
+        if(this->persistent || this->head == this->flushed)
+        {
+            return;
+        }
+
+        GLStats::frame().bufferUpdates++;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, this->buffer);
+        void *target = glMapBufferRange(GL_COPY_WRITE_BUFFER, this->flushed, this->head - this->flushed,
+                                        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if(target)
+        {
+            std::memcpy(target, this->mapped + this->flushed, this->head - this->flushed);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        this->flushed = this->head;
+    }
+
+    // After the last command reading this frame's region
+    void endFrame()
+    {
+        this->flush();
+        this->fences[this->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    bool isPersistent() const
+    {
+        return this->persistent;
+    }
+
+    size_t getFrameSize() const
+    {
+        return this->frameSize;
+    }
+
+    DynamicBufferStats &getStats()
+    {
+        return this->stats;
+    }
+
+private:
+    unsigned int buffer;
+    size_t frameSize;
+    unsigned int frame;
+    // Bytes [frameStart, head) of the buffer are allocated this frame, [flushed, head) not yet handed to GL
+    size_t frameStart;
+    size_t head;
+    size_t flushed;
+    GLsync fences[FRAME_COUNT];
+    unsigned char *mapped;
+    std::vector<unsigned char> staging;
+    bool persistent;
+    DynamicBufferStats stats;
+
+    DynamicBuffer(const DynamicBuffer&);
+    DynamicBuffer &operator=(const DynamicBuffer&);
+};
+
+#endif // DYNAMIC_BUFFER_H
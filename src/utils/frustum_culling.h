@@ -0,0 +1,368 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE 1
+#endif
+
+#include "glm/glm.hpp"
+
+#include "bounds.h"
+
+// Six planes (xyz normal pointing inside, w distance). A point p is inside a plane when dot(xyz, p) + w >= 0
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann plane extraction from a GL style (clip z in [-w, w]) view-projection matrix
+inline Frustum ExtractFrustum(const glm::mat4 &viewProjection)
+{
+    const glm::mat4 &m = viewProjection;
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];  // Left
+    frustum.planes[1] = rows[3] - rows[0];  // Right
+    frustum.planes[2] = rows[3] + rows[1];  // Bottom
+    frustum.planes[3] = rows[3] - rows[1];  // Top
+    frustum.planes[4] = rows[3] + rows[2];  // Near
+    frustum.planes[5] = rows[3] - rows[2];  // Far
+
+    for (int i = 0; i < 6; i++)
+    {
+        float length = glm::length(glm::vec3(frustum.planes[i]));
+        if(length > 0.0f)
+        {
+            frustum.planes[i] /= length;
+        }
+    }
+
+    return frustum;
+}
+
+enum class CullResult
+{
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE
+};
+
+// Box given as center and half extent
+inline CullResult TestBox(const Frustum &frustum, const glm::vec3 &center, const glm::vec3 &extent)
+{
+    CullResult result = CullResult::INSIDE;
+    for (int i = 0; i < 6; i++)
+    {
+        const glm::vec4 &plane = frustum.planes[i];
+        float d = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+        float r = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+
+        if(d + r < 0.0f)
+        {
+            return CullResult::OUTSIDE;
+        }
+        if(d - r < 0.0f)
+        {
+            result = CullResult::INTERSECTING;
+        }
+    }
+    return result;
+}
+
+// Visible and culled counts of the frame being recorded
+struct CullStats {
+    unsigned int visible;
+    unsigned int culled;
+    // Inside the frustum but hidden behind occluders
+    unsigned int occluded;
+
+    CullStats()
+    {
+        this->reset();
+    }
+
+    void reset()
+    {
+        this->visible = 0;
+        this->culled = 0;
+        this->occluded = 0;
+    }
+
+    void print() const
+    {
+        std::cout << "Culling: visible " << this->visible << ", culled " << this->culled << ", occluded " << this->occluded << std::endl;
+    }
+
+    static CullStats &frame()
+    {
+        static CullStats stats;
+        return stats;
+    }
+};
+
+// Frustum culling of many boxes. Bounds are kept as structure of arrays and tested four at a time;
+// above BVH_THRESHOLD boxes a bounding volume hierarchy skips whole groups that are fully in or out.
+// Pure CPU, needs no GL context
+class FrustumCuller
+{
+public:
+    static const unsigned int BVH_THRESHOLD = 64;
+    static const unsigned int LEAF_SIZE = 8;
+
+    FrustumCuller()
+        : count(0)
+    {
+    }
+
+    void build(const std::vector<Bounds> &bounds)
+    {
+        this->count = bounds.size();
+        this->nodes.clear();
+
+        std::vector<unsigned int> order(this->count);
+        for (unsigned int i = 0; i < this->count; i++)
+        {
+            order[i] = i;
+        }
+
+        if(this->count > 0)
+        {
+            unsigned int leafSize = this->count >= BVH_THRESHOLD ? LEAF_SIZE : this->count;
+            this->buildNode(bounds, order, 0, this->count, leafSize);
+        }
+
+        // Padding lets the SIMD loop read past the last box
+        unsigned int padded = this->count + 3;
+        this->centerX.assign(padded, 0.0f);
+        this->centerY.assign(padded, 0.0f);
+        this->centerZ.assign(padded, 0.0f);
+        this->extentX.assign(padded, 0.0f);
+        this->extentY.assign(padded, 0.0f);
+        this->extentZ.assign(padded, 0.0f);
+        this->itemIndex = order;
+
+        for (unsigned int i = 0; i < this->count; i++)
+        {
+            const Bounds &b = bounds[order[i]];
+            glm::vec3 center = (b.min + b.max) * 0.5f;
+            glm::vec3 extent = (b.max - b.min) * 0.5f;
+            this->centerX[i] = center.x;
+            this->centerY[i] = center.y;
+            this->centerZ[i] = center.z;
+            this->extentX[i] = extent.x;
+            this->extentY[i] = extent.y;
+            this->extentZ[i] = extent.z;
+        }
+    }
+
+    unsigned int size() const
+    {
+        return this->count;
+    }
+
+    // visible[i] is set to 1 for every box i inside or touching the frustum. Returns the visible count
+    unsigned int cull(const Frustum &frustum, std::vector<unsigned char> &visible) const
+    {
+        visible.assign(this->count, 0);
+        if(this->nodes.empty())
+        {
+            return 0;
+        }
+
+        unsigned int visibleCount = 0;
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while(top > 0)
+        {
+            const Node &node = this->nodes[stack[--top]];
+
+            CullResult result = CullResult::INTERSECTING;
+            // A single root leaf is tested box by box straight away
+            if(node.left >= 0 || this->nodes.size() > 1)
+            {
+                result = TestBox(frustum, node.center, node.extent);
+            }
+
+            if(result == CullResult::OUTSIDE)
+            {
+                continue;
+            }
+
+            if(result == CullResult::INSIDE)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                {
+                    visible[this->itemIndex[i]] = 1;
+                }
+                visibleCount += node.count;
+                continue;
+            }
+
+            if(node.left < 0)
+            {
+                visibleCount += this->testRange(frustum, node.first, node.count, visible);
+            }
+            else
+            {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+
+        return visibleCount;
+    }
+
+private:
+    struct Node {
+        glm::vec3 center;
+        glm::vec3 extent;
+        unsigned int first;
+        unsigned int count;
+        int left;   // -1 for leaves
+        int right;
+    };
+
+    unsigned int count;
+    std::vector<Node> nodes;
+    // Boxes in BVH leaf order
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    // Slot in the arrays above to caller index
+    std::vector<unsigned int> itemIndex;
+
+    // Median split along the longest axis of the box centers
+    int buildNode(const std::vector<Bounds> &bounds, std::vector<unsigned int> &order, unsigned int first, unsigned int n, unsigned int leafSize)
+    {
+        glm::vec3 minimum = bounds[order[first]].min;
+        glm::vec3 maximum = bounds[order[first]].max;
+        glm::vec3 centerMin = (minimum + maximum) * 0.5f;
+        glm::vec3 centerMax = centerMin;
+        for (unsigned int i = first + 1; i < first + n; i++)
+        {
+            const Bounds &b = bounds[order[i]];
+            minimum = glm::min(minimum, b.min);
+            maximum = glm::max(maximum, b.max);
+            glm::vec3 c = (b.min + b.max) * 0.5f;
+            centerMin = glm::min(centerMin, c);
+            centerMax = glm::max(centerMax, c);
+        }
+
+        int index = this->nodes.size();
+        Node node;
+        node.center = (minimum + maximum) * 0.5f;
+        node.extent = (maximum - minimum) * 0.5f;
+        node.first = first;
+        node.count = n;
+        node.left = -1;
+        node.right = -1;
+        this->nodes.push_back(node);
+
+        if(n <= leafSize)
+        {
+            return index;
+        }
+
+        glm::vec3 spread = centerMax - centerMin;
+        int axis = 0;
+        if(spread.y > spread[axis])
+        {
+            axis = 1;
+        }
+        if(spread.z > spread[axis])
+        {
+            axis = 2;
+        }
+
+        unsigned int half = n / 2;
+        std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + n,
+            [&bounds, axis](unsigned int a, unsigned int b) {
+                return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis];
+            });
+
+        int left = this->buildNode(bounds, order, first, half, leafSize);
+        int right = this->buildNode(bounds, order, first + half, n - half, leafSize);
+        this->nodes[index].left = left;
+        this->nodes[index].right = right;
+        return index;
+    }
+
+    // Tests slots [first, first + n). Returns how many are visible
+    unsigned int testRange(const Frustum &frustum, unsigned int first, unsigned int n, std::vector<unsigned char> &visible) const
+    {
+        unsigned int visibleCount = 0;
+        unsigned int end = first + n;
+        unsigned int i = first;
+
+#ifdef FRUSTUM_CULLING_SSE
+        __m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++)
+        {
+            const glm::vec4 &plane = frustum.planes[p];
+            px[p] = _mm_set1_ps(plane.x);
+            py[p] = _mm_set1_ps(plane.y);
+            pz[p] = _mm_set1_ps(plane.z);
+            pw[p] = _mm_set1_ps(plane.w);
+            ax[p] = _mm_set1_ps(std::fabs(plane.x));
+            ay[p] = _mm_set1_ps(std::fabs(plane.y));
+            az[p] = _mm_set1_ps(std::fabs(plane.z));
+        }
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; i < end; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&this->centerX[i]);
+            __m128 cy = _mm_loadu_ps(&this->centerY[i]);
+            __m128 cz = _mm_loadu_ps(&this->centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&this->extentX[i]);
+            __m128 ey = _mm_loadu_ps(&this->extentY[i]);
+            __m128 ez = _mm_loadu_ps(&this->extentZ[i]);
+
+            // Outside as soon as the box lies fully behind one plane
+            __m128 outside = zero;
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, px[p]), _mm_mul_ps(cy, py[p])), _mm_add_ps(_mm_mul_ps(cz, pz[p]), pw[p]));
+                __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ax[p]), _mm_mul_ps(ey, ay[p])), _mm_mul_ps(ez, az[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+            }
+
+            int mask = _mm_movemask_ps(outside);
+            for (unsigned int k = 0; k < 4 && i + k < end; k++)
+            {
+                if(!(mask & (1 << k)))
+                {
+                    visible[this->itemIndex[i + k]] = 1;
+                    visibleCount++;
+                }
+            }
+        }
+#else
+        for (; i < end; i++)
+        {
+            glm::vec3 center(this->centerX[i], this->centerY[i], this->centerZ[i]);
+            glm::vec3 extent(this->extentX[i], this->extentY[i], this->extentZ[i]);
+            if(TestBox(frustum, center, extent) != CullResult::OUTSIDE)
+            {
+                visible[this->itemIndex[i]] = 1;
+                visibleCount++;
+            }
+        }
+#endif
+
+        return visibleCount;
+    }
+};
+
+#endif // FRUSTUM_CULLING_H
@@ -0,0 +1,48 @@
+#ifndef GL_STATS_H
+#define GL_STATS_H
+
+#include <iostream>
+
+// Per-frame counters of the GL calls issued by the render path
+struct GLStats {
+    unsigned int uniformLookups;    // Uniform locations resolved by name
+    unsigned int uniformUploads;    // glUniform*
+    unsigned int bufferUpdates;     // glBufferSubData / glBufferData on dynamic buffers
+    unsigned int bufferBinds;       // glBindBufferBase / glBindBufferRange
+    unsigned int textureBinds;      // glBindTexture
+    unsigned int drawCalls;         // glDraw*
+
+    GLStats()
+    {
+        this->reset();
+    }
+
+    void reset()
+    {
+        this->uniformLookups = 0;
+        this->uniformUploads = 0;
+        this->bufferUpdates = 0;
+        this->bufferBinds = 0;
+        this->textureBinds = 0;
+        this->drawCalls = 0;
+    }
+
+    void print() const
+    {
+        std::cout << "GL calls/frame: lookups " << this->uniformLookups
+                  << ", uniforms " << this->uniformUploads
+                  << ", buffer updates " << this->bufferUpdates
+                  << ", buffer binds " << this->bufferBinds
+                  << ", texture binds " << this->textureBinds
+                  << ", draws " << this->drawCalls << std::endl;
+    }
+
+    // Counters of the frame being recorded
+    static GLStats &frame()
+    {
+        static GLStats stats;
+        return stats;
+    }
+};
+
+#endif // GL_STATS_H
@@ -0,0 +1,19 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a hash
+inline std::uint64_t hashBytes(const void *bytes, size_t length, std::uint64_t hash = 14695981039346656037ULL)
+{
+    const unsigned char *p = static_cast<const unsigned char*>(bytes);
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif // HASH_H
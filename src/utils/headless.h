@@ -0,0 +1,299 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "glad/glad.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Whether a space separated EGL extension string names the extension
+inline bool HasEGLExtension(const char *extensions, const char *name)
+{
+    if(extensions == NULL)
+    {
+        return false;
+    }
+
+    size_t length = std::strlen(name);
+    for (const char *p = std::strstr(extensions, name); p != NULL; p = std::strstr(p + length, name))
+    {
+        if((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// OpenGL 3.3 core context without a window, for benchmark and CI runs. Prefers Mesa's surfaceless
+// platform, which needs neither a display server nor a GPU (llvmpipe), and falls back to the default
+// display with a pbuffer. Rendering goes to an OffscreenTarget either way
+class HeadlessContext
+{
+public:
+    HeadlessContext()
+        : display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT)
+    {
+    }
+
+    ~HeadlessContext()
+    {
+        if(this->display == EGL_NO_DISPLAY)
+        {
+            return;
+        }
+
+        eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(this->context != EGL_NO_CONTEXT)
+        {
+            eglDestroyContext(this->display, this->context);
+        }
+        if(this->surface != EGL_NO_SURFACE)
+        {
+            eglDestroySurface(this->display, this->surface);
+        }
+        eglTerminate(this->display);
+    }
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext &operator=(const HeadlessContext&) = delete;
+
+    // Creates the context, makes it current and loads the GL functions through glad
+    bool create(int width, int height)
+    {
+        const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if(getPlatformDisplay && HasEGLExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+        {
+            this->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+        if(this->display == EGL_NO_DISPLAY)
+        {
+            this->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+
+        EGLint major, minor;
+        if(this->display == EGL_NO_DISPLAY || !eglInitialize(this->display, &major, &minor))
+        {
+            std::cout << "ERROR::HEADLESS::NO_EGL_DISPLAY" << std::endl;
+            this->display = EGL_NO_DISPLAY;
+            return false;
+        }
+
+        // Without surfaceless contexts a pbuffer stands in for the window
+        bool surfaceless = HasEGLExtension(eglQueryString(this->display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if(!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(this->display, configAttribs, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << "ERROR::HEADLESS::NO_EGL_CONFIG" << std::endl;
+            return false;
+        }
+
+        if(!surfaceless)
+        {
+            const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+            this->surface = eglCreatePbufferSurface(this->display, config, surfaceAttribs);
+            if(this->surface == EGL_NO_SURFACE)
+            {
+                std::cout << "ERROR::HEADLESS::PBUFFER_FAILED" << std::endl;
+                return false;
+            }
+        }
+
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        this->context = eglCreateContext(this->display, config, EGL_NO_CONTEXT, contextAttribs);
+        if(this->context == EGL_NO_CONTEXT || !eglMakeCurrent(this->display, this->surface, this->surface, this->context))
+        {
+            std::cout << "ERROR::HEADLESS::CONTEXT_FAILED" << std::endl;
+            return false;
+        }
+
+        if(!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+        {
+            std::cout << "ERROR::HEADLESS::GLAD_FAILED" << std::endl;
+            return false;
+        }
+
+        std::cout << "Headless EGL " << major << "." << minor << (surfaceless ? " surfaceless" : " pbuffer")
+                  << ": " << glGetString(GL_RENDERER) << std::endl;
+        return true;
+    }
+
+    // Moves the context between threads: release on the one giving it up, then makeCurrent on the other
+    bool makeCurrent()
+    {
+        return eglMakeCurrent(this->display, this->surface, this->surface, this->context) == EGL_TRUE;
+    }
+
+    void release()
+    {
+        eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+
+private:
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+};
+
+// Color and depth renderbuffers to draw into when there is no window
+struct OffscreenTarget {
+    unsigned int FBO;
+    unsigned int color;
+    unsigned int depth;
+    int width;
+    int height;
+
+    OffscreenTarget()
+        : FBO(0), color(0), depth(0), width(0), height(0)
+    {
+    }
+
+    bool create(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+
+        glGenRenderbuffers(1, &this->color);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        glGenRenderbuffers(1, &this->depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+        glGenFramebuffers(1, &this->FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->depth);
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::OFFSCREEN_TARGET::INCOMPLETE_FRAMEBUFFER" << std::endl;
+            return false;
+        }
+
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    // Binary PPM, flipped so the first row is the top of the image
+    bool writePPM(const std::string &path) const
+    {
+        std::vector<unsigned char> pixels(size_t(this->width) * this->height * 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->FBO);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, this->width, this->height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        out << "P6\n" << this->width << " " << this->height << "\n255\n";
+        size_t rowSize = size_t(this->width) * 3;
+        for (int y = this->height - 1; y >= 0; y--)
+        {
+            out.write(reinterpret_cast<const char*>(&pixels[y * rowSize]), rowSize);
+        }
+
+        if(!out)
+        {
+            std::cout << "ERROR::OFFSCREEN_TARGET::WRITE_FAILED " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Frame times of a benchmark run, in milliseconds
+struct FrameTimes {
+    std::vector<double> samples;
+
+    void add(double milliseconds)
+    {
+        this->samples.push_back(milliseconds);
+    }
+
+    // Nearest rank percentile, p in [0, 100]
+    double percentile(double p) const
+    {
+        if(this->samples.empty())
+        {
+            return 0.0;
+        }
+
+        std::vector<double> sorted(this->samples);
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = size_t(p / 100.0 * sorted.size() + 0.5);
+        return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+    }
+
+    double average() const
+    {
+        double sum = 0.0;
+        for (unsigned int i = 0; i < this->samples.size(); i++)
+        {
+            sum += this->samples[i];
+        }
+        return this->samples.empty() ? 0.0 : sum / this->samples.size();
+    }
+
+    void print() const
+    {
+        std::cout << "Frame times over " << this->samples.size() << " frames: min " << this->percentile(0.0)
+                  << " ms, avg " << this->average()
+                  << " ms, p95 " << this->percentile(95.0)
+                  << " ms, p99 " << this->percentile(99.0)
+                  << " ms, max " << this->percentile(100.0) << " ms" << std::endl;
+    }
+
+    // Summary as flat JSON so CI can compare runs, followed by every sample
+    bool write(const std::string &path) const
+    {
+        std::ofstream out(path.c_str(), std::ios::trunc);
+        out << "{\n"
+            << "    \"frames\": " << this->samples.size() << ",\n"
+            << "    \"min_ms\": " << this->percentile(0.0) << ",\n"
+            << "    \"avg_ms\": " << this->average() << ",\n"
+            << "    \"p95_ms\": " << this->percentile(95.0) << ",\n"
+            << "    \"p99_ms\": " << this->percentile(99.0) << ",\n"
+            << "    \"max_ms\": " << this->percentile(100.0) << ",\n"
+            << "    \"samples_ms\": [";
+        for (unsigned int i = 0; i < this->samples.size(); i++)
+        {
+            out << (i > 0 ? ", " : "") << this->samples[i];
+        }
+        out << "]\n}\n";
+
+        if(!out)
+        {
+            std::cout << "ERROR::FRAME_TIMES::WRITE_FAILED " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif // HEADLESS_H
@@ -0,0 +1,91 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "gl_stats.h"
+
+// First vertex attribute of the per-instance data; Vertex and CompactVertex use 0 to 2
+const unsigned int INSTANCE_ATTRIBUTE = 3;
+
+// Per-instance input of the vertex shader: aInstanceModel at locations 3 to 6, aInstanceTint at 7
+struct InstanceData {
+    glm::mat4 model;
+    glm::vec4 tint;
+
+    InstanceData()
+        : model(1.0f), tint(1.0f)
+    {
+    }
+
+    InstanceData(const glm::mat4 &model, const glm::vec4 &tint = glm::vec4(1.0f))
+        : model(model), tint(tint)
+    {
+    }
+};
+
+// Stream of InstanceData, rewritten every time it is drawn. The buffer name never changes,
+// so attaching it to a VAO once is enough
+class InstanceBuffer
+{
+public:
+    InstanceBuffer()
+        : VBO(0), capacity(0)
+    {
+    }
+
+    // Creates the buffer on first use
+    unsigned int getVBO()
+    {
+        if(this->VBO == 0)
+        {
+            glGenBuffers(1, &this->VBO);
+        }
+        return this->VBO;
+    }
+
+    // Adds the instance attributes to the currently bound VAO
+    void attach()
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, this->getVBO());
+
+        // A mat4 attribute takes one location per column
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + i);
+            glVertexAttribPointer(INSTANCE_ATTRIBUTE + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  (void*)(offsetof(InstanceData, model) + i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(INSTANCE_ATTRIBUTE + i, 1);
+        }
+
+        glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + 4);
+        glVertexAttribPointer(INSTANCE_ATTRIBUTE + 4, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, tint));
+        glVertexAttribDivisor(INSTANCE_ATTRIBUTE + 4, 1);
+    }
+
+    void update(const InstanceData *instances, unsigned int count)
+    {
+        GLStats::frame().bufferUpdates++;
+        glBindBuffer(GL_ARRAY_BUFFER, this->getVBO());
+
+        // Orphaning hands the driver a fresh block instead of waiting on draws still reading the old one
+        size_t bytes = count * sizeof(InstanceData);
+        if(bytes > this->capacity)
+        {
+            this->capacity = bytes;
+        }
+        glBufferData(GL_ARRAY_BUFFER, this->capacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+private:
+    unsigned int VBO;
+    size_t capacity;
+};
+
+#endif // INSTANCE_BUFFER_H
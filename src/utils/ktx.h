@@ -0,0 +1,147 @@
+#ifndef KTX_H
+#define KTX_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// KTX 1.1 container (https://registry.khronos.org/KTX/specs/1.0/ktxspec.v1.html), restricted to what
+// the texture baker writes: one 2D image with a full mip chain, little endian, no key/value data
+struct KtxHeader {
+    unsigned char identifier[12];
+    std::uint32_t endianness;
+    std::uint32_t glType;
+    std::uint32_t glTypeSize;
+    std::uint32_t glFormat;
+    std::uint32_t glInternalFormat;
+    std::uint32_t glBaseInternalFormat;
+    std::uint32_t pixelWidth;
+    std::uint32_t pixelHeight;
+    std::uint32_t pixelDepth;
+    std::uint32_t numberOfArrayElements;
+    std::uint32_t numberOfFaces;
+    std::uint32_t numberOfMipmapLevels;
+    std::uint32_t bytesOfKeyValueData;
+};
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// One mip level; data points into the buffer the file was read from
+struct KtxLevel {
+    int width;
+    int height;
+    const unsigned char *data;
+    std::uint32_t size;
+};
+
+struct KtxFile {
+    unsigned int internalFormat;
+    unsigned int baseInternalFormat;
+    std::vector<KtxLevel> levels;
+};
+
+// Parses a compressed texture from memory. Fails on anything outside the subset above
+inline bool ReadKtx(const unsigned char *data, size_t size, KtxFile &file)
+{
+    if(size < sizeof(KtxHeader))
+    {
+        return false;
+    }
+
+    KtxHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if(std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != 0x04030201 ||
+       header.glType != 0 || header.glFormat != 0 || header.pixelDepth > 1 || header.numberOfArrayElements > 0 ||
+       header.numberOfFaces != 1 || header.numberOfMipmapLevels == 0 || header.pixelWidth == 0 || header.pixelHeight == 0)
+    {
+        return false;
+    }
+
+    file.internalFormat = header.glInternalFormat;
+    file.baseInternalFormat = header.glBaseInternalFormat;
+    file.levels.clear();
+
+    std::uint64_t offset = sizeof(KtxHeader) + std::uint64_t(header.bytesOfKeyValueData);
+    for (unsigned int i = 0; i < header.numberOfMipmapLevels; i++)
+    {
+        if(offset + 4 > size)
+        {
+            return false;
+        }
+
+        KtxLevel level;
+        std::memcpy(&level.size, data + offset, 4);
+        offset += 4;
+        if(offset + level.size > size)
+        {
+            return false;
+        }
+
+        level.width = header.pixelWidth >> i > 0 ? header.pixelWidth >> i : 1;
+        level.height = header.pixelHeight >> i > 0 ? header.pixelHeight >> i : 1;
+        level.data = data + offset;
+        file.levels.push_back(level);
+
+        // Image data is padded to 4 bytes
+        offset = (offset + level.size + 3) & ~std::uint64_t(3);
+    }
+
+    return true;
+}
+
+// levels[i] holds mip level i of a width x height compressed image
+inline bool WriteKtx(const std::string &path, unsigned int internalFormat, unsigned int baseInternalFormat, int width, int height,
+                     const std::vector<std::vector<unsigned char> > &levels)
+{
+    KtxHeader header;
+    std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = 0x04030201;
+    header.glType = 0;
+    header.glTypeSize = 1;
+    header.glFormat = 0;
+    header.glInternalFormat = internalFormat;
+    header.glBaseInternalFormat = baseInternalFormat;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = levels.size();
+    header.bytesOfKeyValueData = 0;
+
+    // Same write-then-rename as the model cache, so a reader never sees a torn file
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const char padding[3] = { 0, 0, 0 };
+    for (unsigned int i = 0; i < levels.size(); i++)
+    {
+        std::uint32_t size = levels[i].size();
+        out.write(reinterpret_cast<const char*>(&size), 4);
+        out.write(reinterpret_cast<const char*>(levels[i].data()), size);
+        out.write(padding, (4 - size % 4) % 4);
+    }
+    out.close();
+
+    if(!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "ERROR::KTX::WRITE_FAILED " << path << std::endl;
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Where the baker puts the compressed version of an image
+inline std::string BakedTexturePath(const std::string &path)
+{
+    return path + ".ktx";
+}
+
+#endif // KTX_H
@@ -0,0 +1,120 @@
+#ifndef LIGHT_BUFFER_H
+#define LIGHT_BUFFER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "glad/glad.h"
+
+#include "gl_stats.h"
+#include "shader.h"
+#include "light_clusters.h"
+
+// Texture units of the clustered light data, above the ones BindTextures hands out to materials
+const unsigned int LIGHT_TEXTURE_UNIT = 13;         // lightData, two texels per PointLight
+const unsigned int CLUSTER_TEXTURE_UNIT = 14;       // clusterGrid, offset and count per cluster
+const unsigned int LIGHT_INDEX_TEXTURE_UNIT = 15;   // lightIndices
+
+// The lights and their cluster assignment in buffer textures, the largest buffers GL 3.3 lets
+// a fragment shader index. Rewritten every frame
+class LightBuffer
+{
+public:
+    LightBuffer()
+    {
+        this->lights.format = GL_RGBA32F;
+        this->grid.format = GL_RG32UI;
+        this->indices.format = GL_R32UI;
+    }
+
+    void update(const std::vector<PointLight> &lights, const LightClusters &clusters)
+    {
+        this->lights.upload(lights.data(), lights.size() * sizeof(PointLight));
+        this->grid.upload(clusters.getGrid().data(), clusters.getGrid().size() * sizeof(unsigned int));
+        this->indices.upload(clusters.getIndices().data(), clusters.getIndices().size() * sizeof(unsigned int));
+    }
+
+    // Materials only use the units below LIGHT_TEXTURE_UNIT, so this stays bound across draws
+    void bind() const
+    {
+        this->lights.bind(LIGHT_TEXTURE_UNIT);
+        this->grid.bind(CLUSTER_TEXTURE_UNIT);
+        this->indices.bind(LIGHT_INDEX_TEXTURE_UNIT);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Points the samplers of a program at the units above. Programs without them ignore it
+    static void setSamplers(Shader &shader)
+    {
+        shader.useProgram();
+        shader.setUniformInt("lightData", LIGHT_TEXTURE_UNIT);
+        shader.setUniformInt("clusterGrid", CLUSTER_TEXTURE_UNIT);
+        shader.setUniformInt("lightIndices", LIGHT_INDEX_TEXTURE_UNIT);
+    }
+
+private:
+    struct TextureBuffer {
+        unsigned int buffer;
+        unsigned int texture;
+        GLenum format;
+        size_t capacity;
+
+        TextureBuffer()
+            : buffer(0), texture(0), format(0), capacity(0)
+        {
+        }
+
+        void upload(const void *data, size_t bytes)
+        {
+            // The buffer only exists once bound, so it is bound before the texture refers to it
+            bool created = this->buffer == 0;
+            if(created)
+            {
+                glGenBuffers(1, &this->buffer);
+            }
+            GLStats::frame().bufferUpdates++;
+            glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+            if(created)
+            {
+                glGenTextures(1, &this->texture);
+                glBindTexture(GL_TEXTURE_BUFFER, this->texture);
+                glTexBuffer(GL_TEXTURE_BUFFER, this->format, this->buffer);
+                glBindTexture(GL_TEXTURE_BUFFER, 0);
+            }
+
+            // Never empty, a buffer texture without storage is incomplete
+            if(bytes > this->capacity)
+            {
+                this->capacity = bytes;
+            }
+            if(this->capacity == 0)
+            {
+                this->capacity = sizeof(PointLight);
+            }
+            // Last frame's fragments may still sample the old lists. New storage for the same buffer object lets the
+            // driver swap memory underneath, and the texture stays attached since glTexBuffer names the object
+            glBufferData(GL_TEXTURE_BUFFER, this->capacity, NULL, GL_STREAM_DRAW);
+            if(bytes > 0)
+            {
+                glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+
+        void bind(unsigned int unit) const
+        {
+            GLStats::frame().textureBinds++;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_BUFFER, this->texture);
+        }
+    };
+
+    TextureBuffer lights;
+    TextureBuffer grid;
+    TextureBuffer indices;
+
+    LightBuffer(const LightBuffer&);
+    LightBuffer &operator=(const LightBuffer&);
+};
+
+#endif // LIGHT_BUFFER_H
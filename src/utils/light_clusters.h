@@ -0,0 +1,336 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHT_CLUSTERS_SSE 1
+#endif
+
+#include "glm/glm.hpp"
+
+#include "thread_pool.h"
+
+// Point light as the shaders read it: two RGBA32F texels
+struct PointLight {
+    glm::vec3 position;
+    float radius;               // No contribution beyond this distance
+    glm::vec3 color;
+    float pad;
+
+    PointLight()
+        : position(0.0f), radius(1.0f), color(1.0f), pad(0.0f)
+    {
+    }
+
+    PointLight(const glm::vec3 &position, float radius, const glm::vec3 &color)
+        : position(position), radius(radius), color(color), pad(0.0f)
+    {
+    }
+};
+
+// Clustered light assignment. The view frustum is split into SIZE_X x SIZE_Y screen tiles and SIZE_Z depth
+// slices spaced exponentially between the near and far planes; every cluster gets the lights whose sphere
+// touches it, so a fragment only loops over the lights of its own cluster.
+//
+// A cluster is the intersection of two x planes, two y planes and a depth range, so a sphere touches it
+// exactly when it touches its column, its row and its slice. Each light is tested against the SIZE_X + 1
+// and SIZE_Y + 1 tile planes once, four planes at a time, and its clusters are the product of the three
+// ranges. Pure CPU, needs no GL context
+class LightClusters
+{
+public:
+    static const unsigned int SIZE_X = 16;
+    static const unsigned int SIZE_Y = 9;
+    static const unsigned int SIZE_Z = 24;
+    static const unsigned int COUNT = SIZE_X * SIZE_Y * SIZE_Z;
+    // Fewer lights are binned on the calling thread
+    static const unsigned int PARALLEL_THRESHOLD = 1024;
+
+    LightClusters()
+        : nearPlane(0.1f), farPlane(100.0f)
+    {
+        this->grid.assign(COUNT * 2, 0);
+    }
+
+    // lights are in world space. projection must be a symmetric perspective, as glm::perspective builds
+    void build(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        this->setFrustum(projection, nearPlane, farPlane);
+
+        unsigned int count = lights.size();
+        bool parallel = count >= PARALLEL_THRESHOLD;
+
+        // Tile and slice ranges of every light
+        this->columns.resize(count);
+        this->rows.resize(count);
+        this->firstSlice.resize(count);
+        this->lastSlice.resize(count);
+        unsigned int blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        this->forEach(blocks, parallel, [&](size_t block) {
+            unsigned int first = block * BLOCK_SIZE;
+            unsigned int end = std::min(first + BLOCK_SIZE, count);
+            for (unsigned int i = first; i < end; i++)
+            {
+                glm::vec4 p = view * glm::vec4(lights[i].position, 1.0f);
+                this->classify(i, glm::vec3(p), lights[i].radius);
+            }
+        });
+
+        // The lights of every slice, in ascending order
+        for (unsigned int z = 0; z < SIZE_Z; z++)
+        {
+            this->sliceLights[z].clear();
+        }
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if(this->columns[i] == 0 || this->rows[i] == 0)
+            {
+                continue;
+            }
+            for (int z = this->firstSlice[i]; z <= this->lastSlice[i]; z++)
+            {
+                this->sliceLights[z].push_back(i);
+            }
+        }
+
+        // Count, then fill. Each slice only writes its own clusters, so slices run in parallel and every
+        // cluster lists its lights in ascending order
+        this->counts.assign(COUNT, 0);
+        this->forEach(SIZE_Z, parallel, [this](size_t slice) {
+            this->visitSlice(slice, false);
+        });
+
+        unsigned int offset = 0;
+        for (unsigned int i = 0; i < COUNT; i++)
+        {
+            this->grid[i * 2] = offset;
+            this->grid[i * 2 + 1] = 0;
+            offset += this->counts[i];
+        }
+        this->indices.resize(offset);
+
+        this->forEach(SIZE_Z, parallel, [this](size_t slice) {
+            this->visitSlice(slice, true);
+        });
+    }
+
+    static unsigned int clusterIndex(unsigned int x, unsigned int y, unsigned int z)
+    {
+        return x + SIZE_X * (y + SIZE_Y * z);
+    }
+
+    // Per cluster the offset of its first entry in indices and its light count, interleaved for an RG32UI texture
+    const std::vector<unsigned int> &getGrid() const
+    {
+        return this->grid;
+    }
+
+    // Light indices of all clusters back to back
+    const std::vector<unsigned int> &getIndices() const
+    {
+        return this->indices;
+    }
+
+    // Maps a view depth to its slice: slice = log(depth) * x + y
+    glm::vec2 getSliceScale() const
+    {
+        float scale = SIZE_Z / std::log(this->farPlane / this->nearPlane);
+        return glm::vec2(scale, -std::log(this->nearPlane) * scale);
+    }
+
+private:
+    static const unsigned int BLOCK_SIZE = 256;
+
+    // Plane counts rounded up to whole SIMD registers, the padding planes are all zero
+    static const unsigned int PLANES_X = (SIZE_X + 4) & ~3u;
+    static const unsigned int PLANES_Y = (SIZE_Y + 4) & ~3u;
+
+    float nearPlane, farPlane;
+    // Tile planes through the eye, normalized. A point p is right of x plane i when planeXx[i] * p.x + planeXz[i] * p.z >= 0
+    float planeXx[PLANES_X], planeXz[PLANES_X];
+    float planeYy[PLANES_Y], planeYz[PLANES_Y];
+    // View depth where every slice starts, the last entry is the far plane
+    float sliceDepth[SIZE_Z + 1];
+
+    // Bit i set when the light touches tile column (row) i
+    std::vector<std::uint32_t> columns, rows;
+    // Empty when first > last
+    std::vector<int> firstSlice, lastSlice;
+    std::vector<unsigned int> sliceLights[SIZE_Z];
+
+    std::vector<unsigned int> counts;
+    std::vector<unsigned int> grid;
+    std::vector<unsigned int> indices;
+
+    void setFrustum(const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+
+        // Tile boundary a in NDC projects from view space points where projection[0][0] * x + a * z == 0
+        std::fill(this->planeXx, this->planeXx + PLANES_X, 0.0f);
+        std::fill(this->planeXz, this->planeXz + PLANES_X, 0.0f);
+        std::fill(this->planeYy, this->planeYy + PLANES_Y, 0.0f);
+        std::fill(this->planeYz, this->planeYz + PLANES_Y, 0.0f);
+        for (unsigned int i = 0; i <= SIZE_X; i++)
+        {
+            float a = -1.0f + 2.0f * i / SIZE_X;
+            float length = std::sqrt(projection[0][0] * projection[0][0] + a * a);
+            this->planeXx[i] = projection[0][0] / length;
+            this->planeXz[i] = a / length;
+        }
+        for (unsigned int i = 0; i <= SIZE_Y; i++)
+        {
+            float a = -1.0f + 2.0f * i / SIZE_Y;
+            float length = std::sqrt(projection[1][1] * projection[1][1] + a * a);
+            this->planeYy[i] = projection[1][1] / length;
+            this->planeYz[i] = a / length;
+        }
+
+        for (unsigned int i = 0; i <= SIZE_Z; i++)
+        {
+            this->sliceDepth[i] = nearPlane * std::pow(farPlane / nearPlane, (float)i / SIZE_Z);
+        }
+        this->sliceDepth[SIZE_Z] = farPlane;
+    }
+
+    template<typename Body>
+    static void forEach(size_t count, bool parallel, Body body)
+    {
+        if(parallel)
+        {
+            ThreadPool::global().parallelFor(count, body);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            body(i);
+        }
+    }
+
+    // Tile masks and slice range of one light, position in view space
+    void classify(unsigned int light, const glm::vec3 &position, float radius)
+    {
+        // Bit k of low: distance to plane k >= -radius; of high: distance <= radius
+        std::uint32_t lowX = 0, highX = 0, lowY = 0, highY = 0;
+        float nr = -radius;
+
+#ifdef LIGHT_CLUSTERS_SSE
+        __m128 px = _mm_set1_ps(position.x);
+        __m128 py = _mm_set1_ps(position.y);
+        __m128 pz = _mm_set1_ps(position.z);
+        __m128 r = _mm_set1_ps(radius);
+        __m128 rn = _mm_set1_ps(nr);
+
+        for (unsigned int k = 0; k < PLANES_X; k += 4)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&this->planeXx[k]), px), _mm_mul_ps(_mm_loadu_ps(&this->planeXz[k]), pz));
+            lowX |= (std::uint32_t)_mm_movemask_ps(_mm_cmpge_ps(d, rn)) << k;
+            highX |= (std::uint32_t)_mm_movemask_ps(_mm_cmple_ps(d, r)) << k;
+        }
+        for (unsigned int k = 0; k < PLANES_Y; k += 4)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&this->planeYy[k]), py), _mm_mul_ps(_mm_loadu_ps(&this->planeYz[k]), pz));
+            lowY |= (std::uint32_t)_mm_movemask_ps(_mm_cmpge_ps(d, rn)) << k;
+            highY |= (std::uint32_t)_mm_movemask_ps(_mm_cmple_ps(d, r)) << k;
+        }
+#else
+        for (unsigned int k = 0; k < PLANES_X; k++)
+        {
+            float d = this->planeXx[k] * position.x + this->planeXz[k] * position.z;
+            lowX |= (std::uint32_t)(d >= nr) << k;
+            highX |= (std::uint32_t)(d <= radius) << k;
+        }
+        for (unsigned int k = 0; k < PLANES_Y; k++)
+        {
+            float d = this->planeYy[k] * position.y + this->planeYz[k] * position.z;
+            lowY |= (std::uint32_t)(d >= nr) << k;
+            highY |= (std::uint32_t)(d <= radius) << k;
+        }
+#endif
+
+        // Tile k lies between planes k and k + 1, the padding planes fall outside the masks
+        this->columns[light] = lowX & (highX >> 1) & ((1u << SIZE_X) - 1);
+        this->rows[light] = lowY & (highY >> 1) & ((1u << SIZE_Y) - 1);
+
+        // The slice formula gives a first guess, the exact boundaries decide
+        float depth = -position.z;
+        glm::vec2 slice = this->getSliceScale();
+        int first = this->guessSlice(depth - radius, slice);
+        while(first > 0 && depth - radius <= this->sliceDepth[first])
+        {
+            first--;
+        }
+        while(first < (int)SIZE_Z && !(depth - radius <= this->sliceDepth[first + 1]))
+        {
+            first++;
+        }
+
+        int last = this->guessSlice(depth + radius, slice);
+        while(last < (int)SIZE_Z - 1 && depth + radius >= this->sliceDepth[last + 1])
+        {
+            last++;
+        }
+        while(last >= 0 && !(depth + radius >= this->sliceDepth[last]))
+        {
+            last--;
+        }
+
+        this->firstSlice[light] = first;
+        this->lastSlice[light] = last;
+    }
+
+    static int guessSlice(float depth, const glm::vec2 &slice)
+    {
+        if(!(depth > 0.0f))
+        {
+            return 0;
+        }
+        float guess = std::log(depth) * slice.x + slice.y;
+        return guess < 0.0f ? 0 : (guess >= SIZE_Z ? SIZE_Z - 1 : (int)guess);
+    }
+
+    // Counts the lights of every cluster of one slice, or with fill writes their indices
+    void visitSlice(unsigned int slice, bool fill)
+    {
+        const std::vector<unsigned int> &lights = this->sliceLights[slice];
+        for (unsigned int j = 0; j < lights.size(); j++)
+        {
+            unsigned int i = lights[j];
+            for (std::uint32_t rows = this->rows[i]; rows != 0; rows &= rows - 1)
+            {
+                unsigned int y = LowestBit(rows);
+                for (std::uint32_t columns = this->columns[i]; columns != 0; columns &= columns - 1)
+                {
+                    unsigned int cluster = clusterIndex(LowestBit(columns), y, slice);
+                    if(fill)
+                    {
+                        this->indices[this->grid[cluster * 2] + this->grid[cluster * 2 + 1]++] = i;
+                    }
+                    else
+                    {
+                        this->counts[cluster]++;
+                    }
+                }
+            }
+        }
+    }
+
+    static unsigned int LowestBit(std::uint32_t bits)
+    {
+        unsigned int index = 0;
+        while(!(bits & 1))
+        {
+            bits >>= 1;
+            index++;
+        }
+        return index;
+    }
+};
+
+#endif // LIGHT_CLUSTERS_H
@@ -0,0 +1,427 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include "glm/glm.hpp"
+
+#include "bounds.h"
+
+// Levels per mesh, the full detail one included
+const unsigned int MAX_LOD_LEVELS = 4;
+// Meshes with fewer triangles keep their single level
+const unsigned int LOD_MIN_TRIANGLES = 64;
+// A level must drop at least this fraction of the previous level's triangles to be kept
+const float LOD_MIN_REDUCTION = 0.1f;
+// Simplification stops once a collapse would move the surface by this fraction of the mesh radius
+const float LOD_MAX_RELATIVE_ERROR = 0.1f;
+
+// One level of detail inside a mesh's index buffer
+struct MeshLod {
+    std::uint32_t firstIndex;
+    std::uint32_t indexCount;
+    // Object space distance from the original vertices to the simplified surface, at most
+    float error;
+};
+
+// Sum of squared distances to a set of area weighted planes
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double weight;
+
+    Quadric()
+        : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), weight(0)
+    {
+    }
+
+    // Plane a*x + b*y + c*z + d = 0 with a unit normal
+    Quadric(double a, double b, double c, double d, double weight)
+        : a2(a * a * weight), ab(a * b * weight), ac(a * c * weight), ad(a * d * weight),
+          b2(b * b * weight), bc(b * c * weight), bd(b * d * weight),
+          c2(c * c * weight), cd(c * d * weight), d2(d * d * weight), weight(weight)
+    {
+    }
+
+    void add(const Quadric &q)
+    {
+        this->a2 += q.a2; this->ab += q.ab; this->ac += q.ac; this->ad += q.ad;
+        this->b2 += q.b2; this->bc += q.bc; this->bd += q.bd;
+        this->c2 += q.c2; this->cd += q.cd; this->d2 += q.d2;
+        this->weight += q.weight;
+    }
+
+    // Weighted mean squared distance of p to the planes
+    double evaluate(const glm::vec3 &p) const
+    {
+        if(this->weight <= 0.0)
+        {
+            return 0.0;
+        }
+
+        double x = p.x, y = p.y, z = p.z;
+        double sum = this->a2 * x * x + 2.0 * this->ab * x * y + 2.0 * this->ac * x * z + 2.0 * this->ad * x +
+                     this->b2 * y * y + 2.0 * this->bc * y * z + 2.0 * this->bd * y +
+                     this->c2 * z * z + 2.0 * this->cd * z + this->d2;
+        return std::max(sum / this->weight, 0.0);
+    }
+};
+
+inline float PointSegmentDistance(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b)
+{
+    glm::vec3 ab = b - a;
+    float lengthSquared = glm::dot(ab, ab);
+    float t = lengthSquared > 0.0f ? std::min(1.0f, std::max(0.0f, glm::dot(p - a, ab) / lengthSquared)) : 0.0f;
+    return glm::length(p - (a + ab * t));
+}
+
+// Distance to the plane when p projects inside the triangle, to the nearest edge otherwise
+inline float PointTriangleDistance(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    if(glm::dot(normal, normal) > 0.0f &&
+       glm::dot(glm::cross(b - a, p - a), normal) >= 0.0f &&
+       glm::dot(glm::cross(c - b, p - b), normal) >= 0.0f &&
+       glm::dot(glm::cross(a - c, p - c), normal) >= 0.0f)
+    {
+        return std::fabs(glm::dot(p - a, glm::normalize(normal)));
+    }
+    return std::min(PointSegmentDistance(p, a, b), std::min(PointSegmentDistance(p, b, c), PointSegmentDistance(p, c, a)));
+}
+
+// Index-only simplification by quadric error edge collapse (Garland and Heckbert). Vertices are
+// collapsed onto neighbours and never moved, so the result indexes the original vertex buffer.
+// Border vertices, which include UV and normal seams, are locked to keep the mesh closed.
+// Returns an upper bound on how far any vertex of the input lies from the simplified surface
+template<typename V>
+float SimplifyMesh(const std::vector<V> &vertices, const std::vector<unsigned int> &indices, unsigned int targetIndexCount, float maxError, std::vector<unsigned int> &result)
+{
+    // A partial triangle at the end is dropped, every loop below steps over whole triangles
+    result.assign(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+    unsigned int vertexCount = vertices.size();
+
+    std::vector<Quadric> quadrics(vertexCount);
+    std::unordered_map<std::uint64_t, unsigned int> edgeUses;
+    for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const glm::vec3 &p0 = vertices[indices[i]].Position;
+        const glm::vec3 &p1 = vertices[indices[i + 1]].Position;
+        const glm::vec3 &p2 = vertices[indices[i + 2]].Position;
+
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if(length > 0.0f)
+        {
+            normal /= length;
+            Quadric plane(normal.x, normal.y, normal.z, -glm::dot(normal, p0), length * 0.5f);
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                quadrics[indices[i + k]].add(plane);
+            }
+        }
+
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            std::uint64_t a = indices[i + k];
+            std::uint64_t b = indices[i + (k + 1) % 3];
+            edgeUses[a < b ? (a << 32) | b : (b << 32) | a]++;
+        }
+    }
+
+    std::vector<unsigned char> locked(vertexCount, 0);
+    for (std::unordered_map<std::uint64_t, unsigned int>::const_iterator it = edgeUses.begin(); it != edgeUses.end(); ++it)
+    {
+        if(it->second == 1)
+        {
+            locked[it->first >> 32] = 1;
+            locked[it->first & 0xffffffffu] = 1;
+        }
+    }
+
+    struct Collapse {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+
+        bool operator<(const Collapse &other) const
+        {
+            return this->cost < other.cost;
+        }
+    };
+
+    float resultError = 0.0f;
+    double maxCost = double(maxError) * double(maxError);
+    std::vector<unsigned int> collapseTo(vertexCount);
+    // Surviving vertex every input vertex ended up collapsed into
+    std::vector<unsigned int> remap(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        remap[v] = v;
+    }
+    std::vector<unsigned char> touched(vertexCount);
+    std::vector<unsigned int> triangleOffsets(vertexCount + 1);
+    std::vector<unsigned int> vertexTriangles;
+
+    while(result.size() > targetIndexCount)
+    {
+        // Cheaper direction of every edge
+        std::vector<Collapse> collapses;
+        collapses.reserve(result.size());
+        for (unsigned int i = 0; i + 2 < result.size(); i += 3)
+        {
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int a = result[i + k];
+                unsigned int b = result[i + (k + 1) % 3];
+                if(a > b || (locked[a] && locked[b]))
+                {
+                    continue;
+                }
+
+                Quadric q = quadrics[a];
+                q.add(quadrics[b]);
+
+                Collapse collapse;
+                double costAB = locked[a] ? maxCost + 1.0 : q.evaluate(vertices[b].Position);
+                double costBA = locked[b] ? maxCost + 1.0 : q.evaluate(vertices[a].Position);
+                collapse.from = costAB <= costBA ? a : b;
+                collapse.to = costAB <= costBA ? b : a;
+                collapse.cost = std::min(costAB, costBA);
+                if(collapse.cost <= maxCost)
+                {
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        if(collapses.empty())
+        {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end());
+
+        // Triangles around each vertex, for the flip test and for keeping collapses apart
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for (unsigned int i = 0; i < result.size(); i++)
+        {
+            triangleOffsets[result[i] + 1]++;
+        }
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        }
+        vertexTriangles.resize(result.size());
+        std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (unsigned int i = 0; i < result.size(); i++)
+        {
+            vertexTriangles[fill[result[i]]++] = i / 3;
+        }
+
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            collapseTo[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+
+        // Each collapse removes about two triangles; do only as many as the target needs
+        unsigned int needed = (result.size() - targetIndexCount) / 6 + 1;
+        unsigned int performed = 0;
+        for (unsigned int c = 0; c < collapses.size() && performed < needed; c++)
+        {
+            const Collapse &collapse = collapses[c];
+            if(touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            // Reject collapses that would flip a surviving triangle
+            bool flips = false;
+            const glm::vec3 &target = vertices[collapse.to].Position;
+            for (unsigned int t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1] && !flips; t++)
+            {
+                const unsigned int *triangle = &result[vertexTriangles[t] * 3];
+                if(triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                {
+                    continue;
+                }
+
+                glm::vec3 before[3], after[3];
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    before[k] = vertices[triangle[k]].Position;
+                    after[k] = triangle[k] == collapse.from ? target : before[k];
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                flips = glm::dot(normalBefore, normalAfter) <= 0.0f;
+            }
+            if(flips)
+            {
+                continue;
+            }
+
+            collapseTo[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            resultError = std::max(resultError, float(std::sqrt(collapse.cost)));
+            performed++;
+
+            // The neighbourhood of the collapse is settled for this pass
+            for (unsigned int t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1]; t++)
+            {
+                const unsigned int *triangle = &result[vertexTriangles[t] * 3];
+                touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+            }
+        }
+        if(performed == 0)
+        {
+            break;
+        }
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            remap[v] = collapseTo[remap[v]];
+        }
+
+        // Rewrite the triangles and drop the ones that became degenerate
+        unsigned int write = 0;
+        for (unsigned int i = 0; i + 2 < result.size(); i += 3)
+        {
+            unsigned int a = collapseTo[result[i]];
+            unsigned int b = collapseTo[result[i + 1]];
+            unsigned int c = collapseTo[result[i + 2]];
+            if(a != b && b != c && a != c)
+            {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+    }
+
+    // The collapse costs are mean squared distances and can miss the worst vertex. The triangles around
+    // the vertex each one collapsed into are part of the surface, so the nearest of them bounds its distance
+    std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+    for (unsigned int i = 0; i < result.size(); i++)
+    {
+        triangleOffsets[result[i] + 1]++;
+    }
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        triangleOffsets[v + 1] += triangleOffsets[v];
+    }
+    vertexTriangles.resize(result.size());
+    std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for (unsigned int i = 0; i < result.size(); i++)
+    {
+        vertexTriangles[fill[result[i]]++] = i / 3;
+    }
+
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        unsigned int survivor = remap[v];
+        if(survivor == v || triangleOffsets[survivor] == triangleOffsets[survivor + 1])
+        {
+            continue;
+        }
+
+        float nearest = std::numeric_limits<float>::max();
+        for (unsigned int t = triangleOffsets[survivor]; t < triangleOffsets[survivor + 1]; t++)
+        {
+            const unsigned int *triangle = &result[vertexTriangles[t] * 3];
+            nearest = std::min(nearest, PointTriangleDistance(vertices[v].Position, vertices[triangle[0]].Position,
+                                                              vertices[triangle[1]].Position, vertices[triangle[2]].Position));
+        }
+        resultError = std::max(resultError, nearest);
+    }
+
+    return resultError;
+}
+
+// Coarser index buffers of a mesh. lods[0] is the full detail level (the mesh's own indices),
+// the others index into lodIndices with firstIndex counted from the start of the full index list
+template<typename V>
+void GenerateLods(const std::vector<V> &vertices, const std::vector<unsigned int> &indices, const Bounds &bounds,
+                  std::vector<unsigned int> &lodIndices, std::vector<MeshLod> &lods)
+{
+    lodIndices.clear();
+    lods.clear();
+
+    MeshLod full;
+    full.firstIndex = 0;
+    full.indexCount = indices.size();
+    full.error = 0.0f;
+    lods.push_back(full);
+
+    if(indices.size() < LOD_MIN_TRIANGLES * 3)
+    {
+        return;
+    }
+
+    float maxError = bounds.radius * LOD_MAX_RELATIVE_ERROR;
+    for (unsigned int level = 1; level < MAX_LOD_LEVELS; level++)
+    {
+        // Halve the triangle count per level. Every level starts from the full mesh so errors do not stack
+        unsigned int target = (indices.size() / 3 >> level) * 3;
+        std::vector<unsigned int> simplified;
+        float error = SimplifyMesh(vertices, indices, target, maxError, simplified);
+
+        const MeshLod &previous = lods.back();
+        if(simplified.size() > previous.indexCount * (1.0f - LOD_MIN_REDUCTION))
+        {
+            break;
+        }
+
+        MeshLod lod;
+        lod.firstIndex = indices.size() + lodIndices.size();
+        lod.indexCount = simplified.size();
+        lod.error = std::max(error, previous.error);
+        lods.push_back(lod);
+        lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+    }
+}
+
+// Picks levels of detail by how large their error would look on screen
+class LodSelector
+{
+public:
+    // fovY in degrees, as in Camera::zoom. viewportHeight and pixelThreshold in pixels
+    LodSelector(const glm::vec3 &cameraPosition, float fovY, float viewportHeight, float pixelThreshold = 1.0f)
+        : cameraPosition(cameraPosition), pixelThreshold(pixelThreshold)
+    {
+        // Pixels covered by one world unit at distance one
+        this->pixelsPerUnit = viewportHeight / (2.0f * std::tan(glm::radians(fovY) * 0.5f));
+    }
+
+    // Coarsest level whose error, scaled to world units by scale, projects below the threshold.
+    // worldBounds are the mesh bounds already transformed to world space
+    unsigned int select(const std::vector<MeshLod> &lods, const Bounds &worldBounds, float scale) const
+    {
+        float distance = glm::length(worldBounds.center - this->cameraPosition) - worldBounds.radius;
+        if(distance <= 0.0f)
+        {
+            return 0;
+        }
+
+        unsigned int level = 0;
+        for (unsigned int i = 1; i < lods.size(); i++)
+        {
+            float pixels = lods[i].error * scale * this->pixelsPerUnit / distance;
+            if(pixels > this->pixelThreshold)
+            {
+                break;
+            }
+            level = i;
+        }
+        return level;
+    }
+
+private:
+    glm::vec3 cameraPosition;
+    float pixelThreshold;
+    float pixelsPerUnit;
+};
+
+#endif // LOD_H
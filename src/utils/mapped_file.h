@@ -0,0 +1,86 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile()
+        : data(NULL), size(0)
+    {
+    }
+
+    explicit MappedFile(const std::string &path)
+        : data(NULL), size(0)
+    {
+        this->open(path);
+    }
+
+    ~MappedFile()
+    {
+        this->close();
+    }
+
+    bool open(const std::string &path)
+    {
+        this->close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            return false;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+
+        if(ptr == MAP_FAILED)
+        {
+            return false;
+        }
+
+        this->data = static_cast<const unsigned char*>(ptr);
+        this->size = st.st_size;
+        return true;
+    }
+
+    void close()
+    {
+        if(this->data)
+        {
+            munmap(const_cast<unsigned char*>(this->data), this->size);
+        }
+        this->data = NULL;
+        this->size = 0;
+    }
+
+    bool isOpen() const
+    {
+        return this->data != NULL;
+    }
+
+    const unsigned char *data;
+    size_t size;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile &operator=(const MappedFile&);
+};
+
+#endif // MAPPED_FILE_H
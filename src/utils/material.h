@@ -0,0 +1,77 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "mesh_data.h"
+#include "gl_stats.h"
+#include "uniform_buffer.h"
+
+// Deduplicated materials of one model, stored in a single uniform buffer
+class MaterialTable
+{
+public:
+    std::vector<Material> materials;
+
+    MaterialTable()
+        : UBO(0), stride(0)
+    {
+    }
+
+    // Returns the index of an identical material, adding it if it is new
+    unsigned int add(const Material &material)
+    {
+        return AddUniqueMaterial(this->materials, this->lookup, material);
+    }
+
+    // Uploads every material once, each at an offset valid for glBindBufferRange
+    void upload()
+    {
+        if(this->materials.empty())
+        {
+            return;
+        }
+
+        int alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        if(alignment < 1)
+        {
+            alignment = 1;
+        }
+        this->stride = (sizeof(Material) + alignment - 1) / alignment * alignment;
+
+        std::vector<unsigned char> data(this->stride * this->materials.size(), 0);
+        for (unsigned int i = 0; i < this->materials.size(); i++)
+        {
+            std::memcpy(&data[i * this->stride], &this->materials[i], sizeof(Material));
+        }
+
+        if(this->UBO == 0)
+        {
+            glGenBuffers(1, &this->UBO);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferData(GL_UNIFORM_BUFFER, data.size(), &data[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Makes material index visible as MaterialBlock
+    void bind(unsigned int index) const
+    {
+        GLStats::frame().bufferBinds++;
+        glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UBO_BINDING, this->UBO, index * this->stride, sizeof(Material));
+    }
+
+private:
+    unsigned int UBO;
+    unsigned int stride;
+    std::unordered_map<std::uint64_t, unsigned int> lookup;
+};
+
+#endif // MATERIAL_H
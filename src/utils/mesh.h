@@ -3,27 +3,94 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 #include "shader.h"
+#include "gl_stats.h"
+#include "mesh_data.h"
+#include "vertex_format.h"
+#include "bounds.h"
+#include "lod.h"
+#include "mesh_optimizer.h"
 
 #include "glm/glm.hpp"
-#include "glm/gtc/type_ptr.hpp"
-
-struct Vertex {
-    glm::vec3 Position;
-    glm::vec3 Ambient;
-    glm::vec3 Diffuse;
-    glm::vec3 Specular;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-    float Shininess;
-};
 
-struct Texture {
-    unsigned int id;
-    std::string type;
-    std::string path;
-};
+// Sampler uniform of each texture, e.g. texture_diffuse1
+inline std::vector<std::string> SamplerNames(const std::vector<Texture> &textures)
+{
+    unsigned int diffuseNr = 1;
+    unsigned int specularNr = 1;
+
+    std::vector<std::string> names;
+    for(unsigned int i = 0; i < textures.size(); i++)
+    {
+        // Retrieve texture number (the N in diffuse_textureN)
+        std::string number;
+        std::string name = textures[i].type;
+
+        if(name == "texture_diffuse")
+        {
+            number = std::to_string(diffuseNr++);
+        }
+        else if(name == "texture_specular")
+        {
+            number = std::to_string(specularNr++);
+        }
+
+        names.push_back(name + number);
+    }
+
+    return names;
+}
+
+// Binds texture i to unit i and points its sampler at it
+inline void BindTextures(Shader &shader, const std::vector<Texture> &textures, const std::vector<std::string> &samplerNames)
+{
+    for(unsigned int i = 0; i < textures.size(); i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+
+        shader.setUniformInt(samplerNames[i], i);
+        GLStats::frame().textureBinds++;
+        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    }
+    // glActiveTexture(GL_TEXTURE0);
+}
+
+// Attribute layout of the bound vertex buffer
+inline void SetupVertexAttributes(VertexFormat format)
+{
+    if(format == VertexFormat::COMPACT)
+    {
+        // Positions and normals arrive as raw integers, the vertex shader rescales them
+
+        // Vertex position
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_SHORT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Position));
+
+        // Vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Normal));
+
+        // Vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, TexCoords));
+    }
+    else
+    {
+        // Vertex position
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+        // Vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+        // Vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    }
+}
 
 class Mesh {
     public:
@@ -31,69 +98,103 @@ class Mesh {
         std::vector<Vertex> vertices;
         std::vector<unsigned int> indices;
         std::vector<Texture> textures;
-
-        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+        // Index into the owning model's MaterialTable
+        unsigned int materialIndex;
+        // Layout of the uploaded vertex buffer
+        VertexFormat format;
+        // Only meaningful for VertexFormat::COMPACT
+        QuantizationBounds quantization;
+        // Model space bounds, for culling and sorting draws by depth
+        Bounds bounds;
+
+        // Levels of detail; lods[0] draws indices, the others draw ranges of lodIndices
+        std::vector<unsigned int> lodIndices;
+        std::vector<MeshLod> lods;
+
+        // upload == false skips the per-mesh GL buffers, for meshes drawn from a shared MeshBatch. Their names
+        // stay 0 then, so drawing such a mesh on its own binds nothing instead of a random object
+        Mesh(MeshData data, std::vector<Texture> textures, unsigned int materialIndex, VertexFormat format = VertexFormat::FULL, bool upload = true)
+            : VAO(0), VBO(0), EBO(0), indexType(0)
         {
-            this->vertices = vertices;
-            this->indices = indices;
-            this->textures = textures;
-
-            this->setupMesh();
+            this->vertices = std::move(data.vertices);
+            this->indices = std::move(data.indices);
+            this->bounds = data.bounds;
+            this->lodIndices = std::move(data.lodIndices);
+            this->lods = std::move(data.lods);
+            this->textures = std::move(textures);
+            this->materialIndex = materialIndex;
+            this->format = format;
+
+            this->samplerNames = SamplerNames(this->textures);
+            if(upload)
+            {
+                this->setupMesh();
+            }
         }
 
         void Draw(Shader &shader)
         {
-            unsigned int diffuseNr = 1;
-            unsigned int specularNr = 1;
+            BindTextures(shader, this->textures, this->samplerNames);
 
-            for(unsigned int i = 0; i < textures.size(); i++)
+            // Dequantization of the compact positions
+            if(this->format == VertexFormat::COMPACT)
             {
-                glActiveTexture(GL_TEXTURE0 + i);
+                shader.setUniformVec3("positionScale", this->quantization.extent / SNORM16_MAX);
+                shader.setUniformVec3("positionOffset", this->quantization.center);
+            }
 
-                // Retrieve texture number (the N in diffuse_textureN)
-                std::string number;
-                std::string name = textures[i].type;
+            glBindVertexArray(this->VAO);
 
-                if(name == "texture_diffuse")
-                {
-                    number = std::to_string(diffuseNr++);
-                }
-                else if(name == "texture_specular")
-                {
-                    number = std::to_string(specularNr++);
-                }
+            // Draw Mesh
+            GLStats::frame().drawCalls++;
+            glDrawElements(GL_TRIANGLES, indices.size(), this->indexType, 0);
+            glBindVertexArray(0);
+        }
 
-                shader.setUniformInt((name + number).c_str(), i);
-                glBindTexture(GL_TEXTURE_2D, textures[i].id);
-            }
-            // glActiveTexture(GL_TEXTURE0);
+        // count copies in one call, transforms come from the instance attributes
+        void DrawInstanced(Shader &shader, unsigned int count)
+        {
+            BindTextures(shader, this->textures, this->samplerNames);
 
-            glUseProgram(shader.ID);
-            for (unsigned int i = 0; i < vertices.size(); i++)
+            if(this->format == VertexFormat::COMPACT)
             {
-                // Set colors
-                unsigned int material_ambient = glGetUniformLocation(shader.ID, "material.ambient");
-                unsigned int material_diffuse = glGetUniformLocation(shader.ID, "material.diffuse");
-                unsigned int material_specular = glGetUniformLocation(shader.ID, "material.specular");
-                unsigned int material_shininess = glGetUniformLocation(shader.ID, "material.shininess");
-                glUniform3fv(material_ambient, 1, glm::value_ptr(this->vertices.at(i).Ambient));
-                glUniform3fv(material_diffuse, 1, glm::value_ptr(this->vertices.at(i).Diffuse));
-                glUniform3fv(material_specular, 1, glm::value_ptr(this->vertices.at(i).Specular));
-                glUniform1f(material_shininess, this->vertices.at(1).Shininess);
+                shader.setUniformVec3("positionScale", this->quantization.extent / SNORM16_MAX);
+                shader.setUniformVec3("positionOffset", this->quantization.center);
             }
-            // glUseProgram(0);
-            
+
             glBindVertexArray(this->VAO);
 
-            // Draw Mesh
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+            GLStats::frame().drawCalls++;
+            glDrawElementsInstanced(GL_TRIANGLES, indices.size(), this->indexType, 0, count);
             glBindVertexArray(0);
         }
 
+        // Sampler uniform of each texture, e.g. texture_diffuse1
+        std::vector<std::string> samplerNames;
+
+        unsigned int getVAO() const
+        {
+            return this->VAO;
+        }
+
+        unsigned int getIndexType() const
+        {
+            return this->indexType;
+        }
+
+        // Byte offset of a level's first index in this mesh's index buffer
+        const void *getIndexOffset(unsigned int lod) const
+        {
+            unsigned int indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+            return (const void*)(uintptr_t)(this->lods[lod].firstIndex * indexSize);
+        }
+
     private:
         // Render data
         unsigned int VAO, VBO, EBO;
-        
+        // GL_UNSIGNED_SHORT when every index fits, GL_UNSIGNED_INT otherwise
+        unsigned int indexType;
+
         void setupMesh()
         {
             glGenVertexArrays(1, &VAO);
@@ -104,20 +205,39 @@ class Mesh {
             glBindBuffer(GL_ARRAY_BUFFER, VBO);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
-            glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(unsigned int), &this->indices[0], GL_STATIC_DRAW);
+            if(this->format == VertexFormat::COMPACT)
+            {
+                this->quantization = ComputeQuantizationBounds(this->vertices);
 
-            // Vertex position
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+                std::vector<CompactVertex> compact(this->vertices.size());
+                for (unsigned int i = 0; i < this->vertices.size(); i++)
+                {
+                    compact[i] = CompactFromVertex(this->vertices[i], this->quantization);
+                }
+                glBufferData(GL_ARRAY_BUFFER, compact.size() * sizeof(CompactVertex), &compact[0], GL_STATIC_DRAW);
+            }
+            else
+            {
+                glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+            }
+            SetupVertexAttributes(this->format);
 
-            // Vertex normals
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+            // Every level lives in the one index buffer, the full detail one first
+            std::vector<unsigned int> allIndices(this->indices);
+            allIndices.insert(allIndices.end(), this->lodIndices.begin(), this->lodIndices.end());
 
-            // Vertex texture coords
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+            // Halve the index buffer when every index fits in 16 bits
+            if(this->vertices.size() < 65536)
+            {
+                std::vector<unsigned short> shortIndices(allIndices.begin(), allIndices.end());
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), &shortIndices[0], GL_STATIC_DRAW);
+                this->indexType = GL_UNSIGNED_SHORT;
+            }
+            else
+            {
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, allIndices.size() * sizeof(unsigned int), &allIndices[0], GL_STATIC_DRAW);
+                this->indexType = GL_UNSIGNED_INT;
+            }
 
             glBindVertexArray(0);
         }
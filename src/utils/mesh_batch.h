@@ -0,0 +1,317 @@
+#ifndef MESH_BATCH_H
+#define MESH_BATCH_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "shader.h"
+#include "shader_variants.h"
+#include "mesh.h"
+#include "material.h"
+#include "gl_stats.h"
+#include "vertex_format.h"
+
+// Every mesh of a model packed into one vertex buffer, one index buffer and one VAO.
+// Meshes sharing material and textures are drawn with a single glMultiDrawElementsBaseVertex,
+// split only where the world transform of consecutive meshes differs
+class MeshBatch
+{
+public:
+    // Where a mesh lives inside the shared buffers
+    struct Range {
+        unsigned int firstIndex;
+        unsigned int indexCount;
+        int baseVertex;
+    };
+
+    // Meshes drawn with the same state in one submission
+    struct DrawGroup {
+        unsigned int materialIndex;
+        std::vector<Texture> textures;
+        std::vector<std::string> samplerNames;
+        std::vector<GLsizei> counts;
+        std::vector<const void*> offsets;
+        std::vector<GLint> baseVertices;
+        // Mesh of every entry, indexes the transforms passed to Draw
+        std::vector<unsigned int> meshes;
+    };
+
+    std::vector<Range> ranges;
+    std::vector<DrawGroup> groups;
+
+    MeshBatch()
+        : VAO(0), VBO(0), EBO(0), indexType(GL_UNSIGNED_INT), indexSize(sizeof(unsigned int)), format(VertexFormat::FULL)
+    {
+    }
+
+    void build(const std::vector<Mesh> &meshes, VertexFormat format)
+    {
+        this->format = format;
+        this->ranges.resize(meshes.size());
+
+        // Local indices plus a base vertex let 16-bit indices cover any total size
+        unsigned int vertexCount = 0;
+        unsigned int indexCount = 0;
+        bool shortIndices = true;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            this->ranges[i].firstIndex = indexCount;
+            this->ranges[i].indexCount = meshes[i].indices.size();
+            this->ranges[i].baseVertex = vertexCount;
+
+            // Coarser levels follow each mesh's full index list
+            vertexCount += meshes[i].vertices.size();
+            indexCount += meshes[i].indices.size() + meshes[i].lodIndices.size();
+            shortIndices = shortIndices && meshes[i].vertices.size() < 65536;
+        }
+        this->indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        this->indexSize = shortIndices ? sizeof(unsigned short) : sizeof(unsigned int);
+
+        std::vector<Vertex> vertices;
+        vertices.reserve(vertexCount);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            vertices.insert(vertices.end(), meshes[i].vertices.begin(), meshes[i].vertices.end());
+        }
+
+        glGenVertexArrays(1, &this->VAO);
+        glGenBuffers(1, &this->VBO);
+        glGenBuffers(1, &this->EBO);
+
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+
+        if(format == VertexFormat::COMPACT)
+        {
+            // One quantization grid for the whole model, so the batch needs no per-mesh uniforms
+            this->quantization = ComputeQuantizationBounds(vertices);
+
+            std::vector<CompactVertex> compact(vertices.size());
+            for (unsigned int i = 0; i < vertices.size(); i++)
+            {
+                compact[i] = CompactFromVertex(vertices[i], this->quantization);
+            }
+            glBufferData(GL_ARRAY_BUFFER, compact.size() * sizeof(CompactVertex), compact.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+        }
+        SetupVertexAttributes(format);
+
+        if(shortIndices)
+        {
+            std::vector<unsigned short> indices;
+            indices.reserve(indexCount);
+            for (unsigned int i = 0; i < meshes.size(); i++)
+            {
+                indices.insert(indices.end(), meshes[i].indices.begin(), meshes[i].indices.end());
+                indices.insert(indices.end(), meshes[i].lodIndices.begin(), meshes[i].lodIndices.end());
+            }
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            std::vector<unsigned int> indices;
+            indices.reserve(indexCount);
+            for (unsigned int i = 0; i < meshes.size(); i++)
+            {
+                indices.insert(indices.end(), meshes[i].indices.begin(), meshes[i].indices.end());
+                indices.insert(indices.end(), meshes[i].lodIndices.begin(), meshes[i].lodIndices.end());
+            }
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        }
+
+        glBindVertexArray(0);
+
+        this->buildGroups(meshes);
+    }
+
+    // transforms holds the model matrix of every mesh. Each group is drawn with the variant its
+    // material needs plus features; groups whose variant is still compiling are skipped
+    void Draw(ShaderVariants &shaders, unsigned int features, const MaterialTable &materials, const std::vector<glm::mat4> &transforms)
+    {
+        glBindVertexArray(this->VAO);
+
+        // Groups are sorted by material, so each material is bound once
+        Shader *bound = NULL;
+        Uniform<glm::mat4> modelUniform;
+        unsigned int boundMaterial = ~0u;
+        for (unsigned int i = 0; i < this->groups.size(); i++)
+        {
+            const DrawGroup &group = this->groups[i];
+            Shader *shader = shaders.get(MaterialFeatures(group.textures, materials.materials[group.materialIndex]) | features);
+            if(!shader)
+            {
+                continue;
+            }
+            if(shader != bound)
+            {
+                bound = shader;
+                modelUniform = this->useShader(*shader);
+            }
+
+            if(group.materialIndex != boundMaterial)
+            {
+                boundMaterial = group.materialIndex;
+                materials.bind(boundMaterial);
+            }
+            BindTextures(*shader, group.textures, group.samplerNames);
+
+            // One multi-draw per run of meshes sharing a transform, usually the whole group
+            for (unsigned int first = 0; first < group.meshes.size();)
+            {
+                const glm::mat4 &transform = transforms[group.meshes[first]];
+                unsigned int last = first + 1;
+                while(last < group.meshes.size() && transforms[group.meshes[last]] == transform)
+                {
+                    last++;
+                }
+
+                shader->set(modelUniform, transform);
+                GLStats::frame().drawCalls++;
+                glMultiDrawElementsBaseVertex(GL_TRIANGLES, &group.counts[first], this->indexType, &group.offsets[first],
+                                              last - first, const_cast<GLint*>(&group.baseVertices[first]));
+                first = last;
+            }
+        }
+
+        glBindVertexArray(0);
+    }
+
+    // Same as Draw with count copies of every mesh. GL 3.3 has no instanced multi-draw,
+    // so each mesh of a group is its own call
+    void DrawInstanced(ShaderVariants &shaders, unsigned int features, const MaterialTable &materials, const std::vector<glm::mat4> &transforms, unsigned int count)
+    {
+        glBindVertexArray(this->VAO);
+
+        Shader *bound = NULL;
+        Uniform<glm::mat4> modelUniform;
+        unsigned int boundMaterial = ~0u;
+        for (unsigned int i = 0; i < this->groups.size(); i++)
+        {
+            const DrawGroup &group = this->groups[i];
+            Shader *shader = shaders.get(MaterialFeatures(group.textures, materials.materials[group.materialIndex]) | features);
+            if(!shader)
+            {
+                continue;
+            }
+            if(shader != bound)
+            {
+                bound = shader;
+                modelUniform = this->useShader(*shader);
+            }
+
+            if(group.materialIndex != boundMaterial)
+            {
+                boundMaterial = group.materialIndex;
+                materials.bind(boundMaterial);
+            }
+            BindTextures(*shader, group.textures, group.samplerNames);
+
+            for (unsigned int j = 0; j < group.counts.size(); j++)
+            {
+                shader->set(modelUniform, transforms[group.meshes[j]]);
+                GLStats::frame().drawCalls++;
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, group.counts[j], this->indexType, const_cast<void*>(group.offsets[j]),
+                                                  count, group.baseVertices[j]);
+            }
+        }
+
+        glBindVertexArray(0);
+    }
+
+    unsigned int getVAO() const
+    {
+        return this->VAO;
+    }
+
+    unsigned int getIndexType() const
+    {
+        return this->indexType;
+    }
+
+    // Byte offset of a mesh's first index, as glDrawElements expects it.
+    // firstIndex is relative to the mesh, e.g. MeshLod::firstIndex
+    const void *getIndexOffset(unsigned int mesh, unsigned int firstIndex = 0) const
+    {
+        return (const void*)(uintptr_t)((this->ranges[mesh].firstIndex + firstIndex) * this->indexSize);
+    }
+
+    const QuantizationBounds &getQuantization() const
+    {
+        return this->quantization;
+    }
+
+private:
+    unsigned int VAO, VBO, EBO;
+    unsigned int indexType;
+    unsigned int indexSize;
+    VertexFormat format;
+    QuantizationBounds quantization;
+
+    // Activates a variant and sets the dequantization, the identity for full vertices. Returns its model uniform
+    Uniform<glm::mat4> useShader(Shader &shader)
+    {
+        shader.useProgram();
+        bool compact = this->format == VertexFormat::COMPACT;
+        shader.set(shader.getUniform<glm::vec3>("positionScale"), compact ? this->quantization.extent / SNORM16_MAX : glm::vec3(1.0f));
+        shader.set(shader.getUniform<glm::vec3>("positionOffset"), compact ? this->quantization.center : glm::vec3(0.0f));
+        return shader.getUniform<glm::mat4>("model");
+    }
+
+    // One group per distinct (material, textures) pair, in material order
+    void buildGroups(const std::vector<Mesh> &meshes)
+    {
+        std::map<std::pair<unsigned int, std::vector<unsigned int> >, unsigned int> lookup;
+
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if(this->ranges[i].indexCount == 0)
+            {
+                continue;
+            }
+
+            std::vector<unsigned int> textureIds;
+            for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+            {
+                textureIds.push_back(meshes[i].textures[j].id);
+            }
+
+            std::pair<unsigned int, std::vector<unsigned int> > key(meshes[i].materialIndex, textureIds);
+            std::map<std::pair<unsigned int, std::vector<unsigned int> >, unsigned int>::iterator it = lookup.find(key);
+            if(it == lookup.end())
+            {
+                DrawGroup group;
+                group.materialIndex = meshes[i].materialIndex;
+                group.textures = meshes[i].textures;
+                group.samplerNames = meshes[i].samplerNames;
+
+                it = lookup.insert(std::make_pair(key, (unsigned int)this->groups.size())).first;
+                this->groups.push_back(group);
+            }
+
+            DrawGroup &group = this->groups[it->second];
+            group.counts.push_back(this->ranges[i].indexCount);
+            group.offsets.push_back(this->getIndexOffset(i));
+            group.baseVertices.push_back(this->ranges[i].baseVertex);
+            group.meshes.push_back(i);
+        }
+
+        // std::map orders keys by material first, rebuild the groups in that order
+        std::vector<DrawGroup> sorted;
+        sorted.reserve(this->groups.size());
+        for (std::map<std::pair<unsigned int, std::vector<unsigned int> >, unsigned int>::iterator it = lookup.begin(); it != lookup.end(); ++it)
+        {
+            sorted.push_back(this->groups[it->second]);
+        }
+        this->groups.swap(sorted);
+    }
+};
+
+#endif // MESH_BATCH_H
@@ -0,0 +1,78 @@
+#ifndef MESH_DATA_H
+#define MESH_DATA_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+
+#include "glm/glm.hpp"
+
+#include "hash.h"
+#include "bounds.h"
+#include "lod.h"
+#include "mesh_optimizer.h"
+
+// CPU side mesh and material data. Nothing here includes GL, so the loader, the cache and the
+// benchmarks can use it without a context; mesh.h and material.h add the GL side
+
+// Material colors live in the model's MaterialTable, not on every vertex
+struct Vertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+// CPU side result of converting one aiMesh, ready to be uploaded
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    Bounds bounds;
+    // Simplified index buffers of the coarser levels, see GenerateLods
+    std::vector<unsigned int> lodIndices;
+    std::vector<MeshLod> lods;
+    // Filled by OptimizeMesh during the import
+    MeshOptimizationStats optimization;
+};
+
+struct Texture {
+    unsigned int id;
+    std::string type;
+    std::string path;
+};
+
+// Matches the std140 layout of MaterialBlock in the fragment shader
+struct Material {
+    Material()
+        : ambient(0.0f), pad0(0.0f), diffuse(0.0f), pad1(0.0f), specular(0.0f), shininess(0.0f)
+    {
+    }
+
+    glm::vec3 ambient;
+    float pad0;
+    glm::vec3 diffuse;
+    float pad1;
+    glm::vec3 specular;
+    float shininess;
+};
+
+// Index of an identical material in materials, appending material if there is none. lookup maps
+// content hashes to indices and has to be kept with the vector
+inline unsigned int AddUniqueMaterial(std::vector<Material> &materials, std::unordered_map<std::uint64_t, unsigned int> &lookup, const Material &material)
+{
+    std::uint64_t key = hashBytes(&material, sizeof(Material));
+
+    std::unordered_map<std::uint64_t, unsigned int>::iterator it = lookup.find(key);
+    if(it != lookup.end() && std::memcmp(&materials[it->second], &material, sizeof(Material)) == 0)
+    {
+        return it->second;
+    }
+
+    unsigned int index = materials.size();
+    materials.push_back(material);
+    lookup[key] = index;
+    return index;
+}
+
+#endif // MESH_DATA_H
@@ -0,0 +1,482 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include "glm/glm.hpp"
+
+#include "hash.h"
+
+// FIFO size assumed by the cache ordering and by the statistics
+const unsigned int VERTEX_CACHE_SIZE = 16;
+// Welding tolerance relative to the largest extent of the mesh
+const float WELD_RELATIVE_EPSILON = 1e-5f;
+// Welded vertices must also agree on normal and texture coordinates within these
+const float WELD_NORMAL_EPSILON = 1e-3f;
+const float WELD_TEXCOORD_EPSILON = 1e-5f;
+// Overdraw ordering is dropped when it makes the ACMR worse than this factor of the cache order
+const float OVERDRAW_ACMR_THRESHOLD = 1.05f;
+
+// Post-transform cache efficiency of an index buffer under a FIFO cache
+struct VertexCacheStats {
+    // Average cache miss ratio: vertex transforms per triangle, 0.5 at best
+    float acmr;
+    // Average transform to vertex ratio: vertex transforms per referenced vertex, 1.0 at best
+    float atvr;
+};
+
+// What the optimizer did to one mesh
+struct MeshOptimizationStats {
+    unsigned int verticesBefore;
+    unsigned int verticesAfter;
+    VertexCacheStats before;
+    VertexCacheStats after;
+
+    void print(unsigned int mesh) const
+    {
+        std::cout << "Mesh " << mesh << ": vertices " << this->verticesBefore << " -> " << this->verticesAfter
+                  << ", ACMR " << this->before.acmr << " -> " << this->after.acmr
+                  << ", ATVR " << this->before.atvr << " -> " << this->after.atvr << std::endl;
+    }
+};
+
+inline VertexCacheStats AnalyzeVertexCache(const std::vector<unsigned int> &indices, unsigned int vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    VertexCacheStats stats;
+    stats.acmr = 0.0f;
+    stats.atvr = 0.0f;
+    if(indices.empty())
+    {
+        return stats;
+    }
+    if(indices.size() % 3 != 0)
+    {
+        std::cout << "ERROR::MESH_OPTIMIZER::NOT_TRIANGLES " << indices.size() << " indices" << std::endl;
+        return stats;
+    }
+
+    // A vertex is in the cache when it was pushed within the last cacheSize pushes
+    std::vector<unsigned int> pushedAt(vertexCount, 0);
+    std::vector<unsigned char> referenced(vertexCount, 0);
+    unsigned int transforms = 0;
+    unsigned int unique = 0;
+
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+        unsigned int v = indices[i];
+        if(!referenced[v])
+        {
+            referenced[v] = 1;
+            unique++;
+        }
+
+        if(pushedAt[v] == 0 || transforms + 1 - pushedAt[v] > cacheSize)
+        {
+            transforms++;
+            pushedAt[v] = transforms;
+        }
+    }
+
+    stats.acmr = float(transforms) / float(indices.size() / 3);
+    stats.atvr = float(transforms) / float(unique);
+    return stats;
+}
+
+// Grid cell of the epsilon weld, 21 bits per axis
+inline std::uint64_t CellKey(std::int64_t x, std::int64_t y, std::int64_t z)
+{
+    const std::uint64_t mask = (std::uint64_t(1) << 21) - 1;
+    return (std::uint64_t(x) & mask) | ((std::uint64_t(y) & mask) << 21) | ((std::uint64_t(z) & mask) << 42);
+}
+
+template<typename V>
+bool NearlyEqual(const V &a, const V &b, float epsilon)
+{
+    glm::vec3 dp = glm::abs(a.Position - b.Position);
+    glm::vec3 dn = glm::abs(a.Normal - b.Normal);
+    glm::vec2 dt = glm::abs(a.TexCoords - b.TexCoords);
+    return dp.x <= epsilon && dp.y <= epsilon && dp.z <= epsilon &&
+           dn.x <= WELD_NORMAL_EPSILON && dn.y <= WELD_NORMAL_EPSILON && dn.z <= WELD_NORMAL_EPSILON &&
+           dt.x <= WELD_TEXCOORD_EPSILON && dt.y <= WELD_TEXCOORD_EPSILON;
+}
+
+// Merges vertices that are equal, or within epsilon when epsilon > 0, and rewrites the indices.
+// The first vertex of every group is kept, so the result does not depend on hash order.
+// Returns the new vertex count
+template<typename V>
+unsigned int WeldVertices(std::vector<V> &vertices, std::vector<unsigned int> &indices, float epsilon = 0.0f)
+{
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<V> welded;
+    welded.reserve(vertices.size());
+
+    if(epsilon <= 0.0f)
+    {
+        // Bitwise equal vertices
+        std::unordered_map<std::uint64_t, std::vector<unsigned int> > buckets;
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            std::vector<unsigned int> &bucket = buckets[hashBytes(&vertices[i], sizeof(V))];
+
+            unsigned int match = ~0u;
+            for (unsigned int j = 0; j < bucket.size() && match == ~0u; j++)
+            {
+                if(std::memcmp(&welded[bucket[j]], &vertices[i], sizeof(V)) == 0)
+                {
+                    match = bucket[j];
+                }
+            }
+
+            if(match == ~0u)
+            {
+                match = welded.size();
+                bucket.push_back(match);
+                welded.push_back(vertices[i]);
+            }
+            remap[i] = match;
+        }
+    }
+    else
+    {
+        // Positions are bucketed on an epsilon grid; a match can sit in any neighbouring cell
+        std::unordered_map<std::uint64_t, std::vector<unsigned int> > cells;
+        float inverse = 1.0f / epsilon;
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            const V &vertex = vertices[i];
+            std::int64_t cx = (std::int64_t)std::floor(vertex.Position.x * inverse);
+            std::int64_t cy = (std::int64_t)std::floor(vertex.Position.y * inverse);
+            std::int64_t cz = (std::int64_t)std::floor(vertex.Position.z * inverse);
+
+            // Lowest index among the matches keeps the result independent of the scan order of cells
+            unsigned int match = ~0u;
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dz = -1; dz <= 1; dz++)
+                    {
+                        std::unordered_map<std::uint64_t, std::vector<unsigned int> >::const_iterator it = cells.find(CellKey(cx + dx, cy + dy, cz + dz));
+                        if(it == cells.end())
+                        {
+                            continue;
+                        }
+
+                        for (unsigned int j = 0; j < it->second.size(); j++)
+                        {
+                            unsigned int candidate = it->second[j];
+                            if(candidate < match && NearlyEqual(welded[candidate], vertex, epsilon))
+                            {
+                                match = candidate;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if(match == ~0u)
+            {
+                match = welded.size();
+                cells[CellKey(cx, cy, cz)].push_back(match);
+                welded.push_back(vertex);
+            }
+            remap[i] = match;
+        }
+    }
+
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+        indices[i] = remap[indices[i]];
+    }
+    vertices.swap(welded);
+
+    return vertices.size();
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): reorders triangles for a FIFO post-transform cache in
+// linear time. clusters receives the first index of every run that started at a dead end; those
+// are the points where triangles can be reordered without hurting the cache much
+inline void OptimizeVertexCache(std::vector<unsigned int> &indices, unsigned int vertexCount, std::vector<unsigned int> *clusters = NULL, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    unsigned int triangleCount = indices.size() / 3;
+    if(clusters)
+    {
+        clusters->clear();
+    }
+    if(triangleCount == 0)
+    {
+        return;
+    }
+    if(indices.size() % 3 != 0)
+    {
+        std::cout << "ERROR::MESH_OPTIMIZER::NOT_TRIANGLES " << indices.size() << " indices" << std::endl;
+        return;
+    }
+
+    // Triangles around each vertex
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+        offsets[indices[i] + 1]++;
+    }
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+        adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    // Live triangle count and cache time stamp of every vertex
+    std::vector<unsigned int> live(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        live[v] = offsets[v + 1] - offsets[v];
+    }
+    std::vector<unsigned int> timestamp(vertexCount, 0);
+    std::vector<unsigned char> emitted(triangleCount, 0);
+    std::vector<unsigned int> deadEnd;
+    std::vector<unsigned int> candidates;
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+
+    unsigned int time = cacheSize + 1;
+    unsigned int cursor = 0;
+    int fanning = 0;
+    bool newCluster = true;
+
+    while(fanning >= 0)
+    {
+        if(newCluster && clusters && (clusters->empty() || clusters->back() != result.size()))
+        {
+            clusters->push_back(result.size());
+        }
+
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+        {
+            unsigned int t = adjacency[a];
+            if(emitted[t])
+            {
+                continue;
+            }
+            emitted[t] = 1;
+
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+
+                if(time - timestamp[v] > cacheSize)
+                {
+                    timestamp[v] = time++;
+                }
+            }
+        }
+
+        // Next fanning vertex: the one that stays longest in the cache and still has triangles
+        fanning = -1;
+        int best = -1;
+        for (unsigned int c = 0; c < candidates.size(); c++)
+        {
+            unsigned int v = candidates[c];
+            if(live[v] == 0)
+            {
+                continue;
+            }
+
+            int priority = 0;
+            if(time - timestamp[v] + 2 * live[v] <= cacheSize)
+            {
+                priority = time - timestamp[v];
+            }
+            if(priority > best)
+            {
+                best = priority;
+                fanning = v;
+            }
+        }
+
+        newCluster = fanning < 0;
+        if(fanning < 0)
+        {
+            // Dead end: back up through recently used vertices, then scan for any live one
+            while(!deadEnd.empty() && fanning < 0)
+            {
+                unsigned int v = deadEnd.back();
+                deadEnd.pop_back();
+                if(live[v] > 0)
+                {
+                    fanning = v;
+                }
+            }
+            while(cursor < vertexCount && fanning < 0)
+            {
+                if(live[cursor] > 0)
+                {
+                    fanning = cursor;
+                }
+                cursor++;
+            }
+        }
+    }
+
+    indices.swap(result);
+}
+
+// Orders the clusters of a cache optimized index buffer so outward facing ones on the hull are
+// drawn first and hide the rest (Sander et al.). Keeps the cache order when the ACMR would rise
+// above OVERDRAW_ACMR_THRESHOLD times the current one
+template<typename V>
+void OptimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<V> &vertices, const std::vector<unsigned int> &clusters, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    if(clusters.size() < 2)
+    {
+        return;
+    }
+    if(indices.size() % 3 != 0)
+    {
+        std::cout << "ERROR::MESH_OPTIMIZER::NOT_TRIANGLES " << indices.size() << " indices" << std::endl;
+        return;
+    }
+
+    // Area weighted centroid of the whole mesh
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> centroids(clusters.size(), glm::vec3(0.0f));
+    std::vector<glm::vec3> normals(clusters.size(), glm::vec3(0.0f));
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : indices.size();
+        float clusterArea = 0.0f;
+        for (unsigned int i = clusters[c]; i < end; i += 3)
+        {
+            const glm::vec3 &p0 = vertices[indices[i]].Position;
+            const glm::vec3 &p1 = vertices[indices[i + 1]].Position;
+            const glm::vec3 &p2 = vertices[indices[i + 2]].Position;
+
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+
+            centroids[c] += center * area;
+            normals[c] += normal;
+            clusterArea += area;
+        }
+
+        meshCentroid += centroids[c];
+        meshArea += clusterArea;
+        if(clusterArea > 0.0f)
+        {
+            centroids[c] /= clusterArea;
+        }
+    }
+    if(meshArea <= 0.0f)
+    {
+        return;
+    }
+    meshCentroid /= meshArea;
+
+    // Clusters that face away from the center, and lie far from it, are drawn first
+    std::vector<std::pair<float, unsigned int> > order(clusters.size());
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        float length = glm::length(normals[c]);
+        glm::vec3 normal = length > 0.0f ? normals[c] / length : glm::vec3(0.0f);
+        order[c] = std::make_pair(-glm::dot(centroids[c] - meshCentroid, normal), c);
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (unsigned int o = 0; o < order.size(); o++)
+    {
+        unsigned int c = order[o].second;
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : indices.size();
+        result.insert(result.end(), indices.begin() + clusters[c], indices.begin() + end);
+    }
+
+    float before = AnalyzeVertexCache(indices, vertices.size(), cacheSize).acmr;
+    float after = AnalyzeVertexCache(result, vertices.size(), cacheSize).acmr;
+    if(after <= before * OVERDRAW_ACMR_THRESHOLD)
+    {
+        indices.swap(result);
+    }
+}
+
+// Stores vertices in the order the indices first use them, dropping unused ones. Returns the new vertex count
+template<typename V>
+unsigned int OptimizeVertexFetch(std::vector<V> &vertices, std::vector<unsigned int> &indices)
+{
+    std::vector<unsigned int> remap(vertices.size(), ~0u);
+    std::vector<V> result;
+    result.reserve(vertices.size());
+
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+        unsigned int &target = remap[indices[i]];
+        if(target == ~0u)
+        {
+            target = result.size();
+            result.push_back(vertices[indices[i]]);
+        }
+        indices[i] = target;
+    }
+    vertices.swap(result);
+
+    return vertices.size();
+}
+
+// Weld, cache order, overdraw order and fetch remap, in that order. Deterministic for a given input
+template<typename V>
+MeshOptimizationStats OptimizeMesh(std::vector<V> &vertices, std::vector<unsigned int> &indices)
+{
+    MeshOptimizationStats stats;
+    stats.verticesBefore = vertices.size();
+    stats.before = AnalyzeVertexCache(indices, vertices.size());
+
+    if(!vertices.empty())
+    {
+        glm::vec3 minimum = vertices[0].Position;
+        glm::vec3 maximum = vertices[0].Position;
+        for (unsigned int i = 1; i < vertices.size(); i++)
+        {
+            minimum = glm::min(minimum, vertices[i].Position);
+            maximum = glm::max(maximum, vertices[i].Position);
+        }
+        glm::vec3 size = maximum - minimum;
+        float epsilon = std::max(size.x, std::max(size.y, size.z)) * WELD_RELATIVE_EPSILON;
+
+        // The exact pass is cheap and shrinks the input of the epsilon pass
+        WeldVertices(vertices, indices);
+        if(epsilon > 0.0f)
+        {
+            WeldVertices(vertices, indices, epsilon);
+        }
+    }
+
+    std::vector<unsigned int> clusters;
+    OptimizeVertexCache(indices, vertices.size(), &clusters);
+    OptimizeOverdraw(indices, vertices, clusters);
+    OptimizeVertexFetch(vertices, indices);
+
+    stats.verticesAfter = vertices.size();
+    stats.after = AnalyzeVertexCache(indices, vertices.size());
+    return stats;
+}
+
+#endif // MESH_OPTIMIZER_H
@@ -1,275 +1,612 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <map>
 #include <vector>
-
-#include "assimp/Importer.hpp"
-#include "assimp/scene.h"
-#include "assimp/postprocess.h"
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
 
 #include "shader.h"
+#include "shader_variants.h"
 #include "mesh.h"
+#include "material.h"
+#include "mesh_batch.h"
+#include "render_queue.h"
+#include "bounds.h"
+#include "frustum_culling.h"
+#include "occlusion_culling.h"
+#include "lod.h"
+#include "hash.h"
+#include "asset_pack.h"
+#include "model_cache.h"
+#include "model_loader.h"
+#include "texture_cache.h"
+#include "profiler.h"
+#include "instance_buffer.h"
+#include "transform_graph.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 
-unsigned int TextureFromFile(const char *path);
+// One mesh of a draw list: which mesh, at which level of detail and where
+struct MeshDraw {
+    unsigned int mesh;
+    unsigned int lod;
+    glm::mat4 model;
+};
 
 class Model
 {
     public:
-        // Model(char *buffer, size_t buf_lenght)
-        Model(std::string path)
+        // path is looked up in the global AssetPack first, then on disk.
+        // batched == true packs every mesh into shared buffers drawn with multi-draw calls
+        Model(std::string path, VertexFormat format = VertexFormat::FULL, bool batched = false)
+            : format(format), batched(batched), worldVersion(0), worldValid(false), cullerValid(false), instancesAttached(false)
         {
             this->loadModel(path);
+
+            if(this->batched)
+            {
+                this->batch.build(this->meshes, this->format);
+            }
+            this->assignStateIds();
         }
 
-        void Draw(Shader &shader)
+        ~Model()
         {
-            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            for (unsigned int i = 0; i < this->acquiredTextures.size(); i++)
             {
-                this->meshes[i].Draw(shader);
+                TextureCache::global().release(this->acquiredTextures[i]);
             }
         }
-    
-    private:
-        // Model data
-        std::vector<Mesh> meshes;
-        // std::string directory;
-        std::vector<Texture> textures_loaded;
 
-        // void loadModel(char *buffer, size_t buf_lenght)
-        void loadModel(std::string path)
+        // Owns texture references, so it must not be copied
+        Model(const Model&) = delete;
+        Model &operator=(const Model&) = delete;
+
+        // Node hierarchy of the file. Every mesh is drawn with model times the world transform of its node
+        const TransformGraph &getGraph() const
         {
-            Assimp::Importer import;
-            // const aiScene *scene = import.ReadFileFromMemory(buffer, buf_lenght, aiProcess_Triangulate | aiProcess_FlipUVs);
-            const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+            return this->graph;
+        }
+
+        // Moves a node and everything below it, picked up by the next draw
+        void setNodeTransform(unsigned int node, const glm::mat4 &local)
+        {
+            this->graph.setLocal(node, local);
+        }
 
-            if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+        // Starts compiling every shader variant the meshes need, so the first frames find them ready
+        void requestShaders(ShaderVariants &shaders, bool instanced = false)
+        {
+            for (unsigned int i = 0; i < this->meshFeatures.size(); i++)
             {
-                std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
-                return;
+                shaders.request(this->meshFeatures[i]);
+                if(instanced)
+                {
+                    shaders.request(this->meshFeatures[i] | SHADER_INSTANCED);
+                }
             }
+        }
+
+        // Queues one item per mesh; the queue picks the order and merges what it can.
+        // Every mesh uses the variant of shaders its material needs and is skipped while that still compiles
+        void Draw(ShaderVariants &shaders, RenderQueue &queue, const glm::mat4 &model = glm::mat4(1.0f))
+        {
+            ProfileScope scope("Model::Draw");
+            this->updateWorld(model);
 
-            // this->directory = path.substr(0, path.find_last_of('/'));
-            // std::cout << this->directory << std::endl;
+            this->draws.clear();
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                if(!this->meshes[i].indices.empty())
+                {
+                    MeshDraw draw = { i, 0, this->meshWorlds[i] };
+                    this->draws.push_back(draw);
+                }
+            }
+            this->queueMeshes(shaders, queue, this->draws);
+        }
 
-            processNode(scene->mRootNode, scene);
+        // Same, but meshes whose world bounds lie outside the frustum are never queued.
+        // With a selector every mesh is drawn at the level of detail it picks. With an occlusion
+        // culler, meshes hidden behind its occluders are dropped too; it is waited on if still rendering
+        void Draw(ShaderVariants &shaders, RenderQueue &queue, const glm::mat4 &model, const Frustum &frustum, const LodSelector *lodSelector = NULL,
+                  OcclusionCuller *occlusion = NULL)
+        {
+            ProfileScope scope("Model::Draw");
+            this->cull(model, frustum, lodSelector, occlusion, this->draws);
+            this->queueMeshes(shaders, queue, this->draws);
         }
 
-        void processNode(aiNode *node, const aiScene *scene)
+        // The culling half of the overload above: fills draws with the meshes that survive, each at its level
+        // of detail. Makes no GL calls, so it can run on another thread than the one drawing the list
+        void cull(const glm::mat4 &model, const Frustum &frustum, const LodSelector *lodSelector, OcclusionCuller *occlusion, std::vector<MeshDraw> &draws)
         {
-            // Process all the node's meshes (if any)
-            for (unsigned int i = 0; i < node->mNumMeshes; i++)
+            ProfileScope scope("Model::cull");
+            this->updateWorld(model);
+            if(!this->cullerValid)
             {
-                aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-                this->meshes.push_back(processMesh(mesh, scene));
+                this->culler.build(this->worldBounds);
+                this->cullerValid = true;
             }
 
-            // Then do the same for each of its children
-            for (unsigned int i = 0; i < node->mNumChildren; i++)
+            unsigned int visibleCount = this->culler.cull(frustum, this->visible);
+            CullStats::frame().culled += this->meshes.size() - visibleCount;
+            if(occlusion)
             {
-                processNode(node->mChildren[i], scene);
+                occlusion->wait();
+                unsigned int occluded = occlusion->cull(this->worldBounds, this->visible);
+                CullStats::frame().occluded += occluded;
+                visibleCount -= occluded;
+            }
+            CullStats::frame().visible += visibleCount;
+
+            draws.clear();
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                const Mesh &mesh = this->meshes[i];
+                if(mesh.indices.empty() || !this->visible[i])
+                {
+                    continue;
+                }
+
+                MeshDraw draw = { i, lodSelector ? lodSelector->select(mesh.lods, this->worldBounds[i], this->worldScales[i]) : 0, this->meshWorlds[i] };
+                draws.push_back(draw);
             }
         }
 
-        Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+        // Queues a list cull built. Reads only what loading set up, never the world state cull updates,
+        // so the next list can be built while this one is drawn. The instanced draws aren't like that unless
+        // they are given node transforms from getNodeWorlds
+        void Draw(ShaderVariants &shaders, RenderQueue &queue, const std::vector<MeshDraw> &draws)
         {
-            std::vector<Vertex> vertices;
-            std::vector<unsigned int> indices;
-            std::vector<Texture> textures;
-            
-            for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-            {
-                aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-                Vertex vertex;
+            ProfileScope scope("Model::Draw");
+            this->queueMeshes(shaders, queue, draws);
+        }
 
-                // Process vertex positions, colors, normals and texture coordinates
-                glm::vec3 vector;
+        void Draw(ShaderVariants &shaders, const glm::mat4 &model = glm::mat4(1.0f))
+        {
+            ProfileScope scope("Model::Draw", true);
+            this->updateWorld(model);
 
-                // Position
-                vector.x = mesh->mVertices[i].x;
-                vector.y = mesh->mVertices[i].y;
-                vector.z = mesh->mVertices[i].z;
-                vertex.Position = vector;
+            if(this->batched)
+            {
+                this->batch.Draw(shaders, this->vertexFeatures(), this->materials, this->meshWorlds);
+                return;
+            }
 
-                // Ambient color
-                aiColor3D ambient;
-                if(AI_SUCCESS != material->Get(AI_MATKEY_COLOR_AMBIENT, ambient))
-                {
-                    std::cout << "Error loading ambient color" << std::endl;
-                }
-                vector.x = ambient.r;
-                vector.y = ambient.g;
-                vector.z = ambient.b;
-                vertex.Ambient = vector;
-
-                // Diffuse color
-                aiColor3D diffuse;
-                if(AI_SUCCESS != material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse))
+            // Only rebind the program and the material block when they actually change
+            Shader *bound = NULL;
+            Uniform<glm::mat4> modelUniform;
+            unsigned int boundMaterial = ~0u;
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                Shader *shader = shaders.get(this->meshFeatures[i]);
+                if(!shader)
                 {
-                    std::cout << "Error loading diffuse color" << std::endl;
+                    continue;
                 }
-                vector.x = diffuse.r;
-                vector.y = diffuse.g;
-                vector.z = diffuse.b;
-                vertex.Diffuse = vector;
-
-                // Specular color
-                aiColor3D specular;
-                if(AI_SUCCESS != material->Get(AI_MATKEY_COLOR_SPECULAR, specular))
+                if(shader != bound)
                 {
-                    std::cout << "Error loading specular color" << std::endl;
+                    bound = shader;
+                    modelUniform = this->useShader(*shader);
                 }
-                vector.x = specular.r;
-                vector.y = specular.g;
-                vector.z = specular.b;
-                vertex.Specular = vector;
-
-                // Shininess
-                float shininess = 0.0f;
-                if(AI_SUCCESS != material->Get(AI_MATKEY_SHININESS, shininess))
+
+                if(this->meshes[i].materialIndex != boundMaterial)
                 {
-                    std::cout << "Error loading shininess" << std::endl;
+                    boundMaterial = this->meshes[i].materialIndex;
+                    this->materials.bind(boundMaterial);
                 }
-                vertex.Shininess = shininess;
+                shader->set(modelUniform, this->meshWorlds[i]);
+                this->meshes[i].Draw(*shader);
+            }
+        }
+
+        // World transform of every mesh's node without the model matrix, as DrawInstanced wants them. Updates
+        // the hierarchy but makes no GL calls, so the update thread can fill these for the render thread
+        void getNodeWorlds(std::vector<glm::mat4> &nodeWorlds)
+        {
+            this->graph.update();
+            nodeWorlds.resize(this->meshes.size());
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                nodeWorlds[i] = this->graph.getWorld(this->meshNodes[i]);
+            }
+        }
+
+        // One draw per mesh for all copies instead of one per mesh and copy. Bypasses the render queue.
+        // Each copy is the whole hierarchy placed by its instance transform
+        void DrawInstanced(ShaderVariants &shaders, const InstanceData *instances, unsigned int count)
+        {
+            this->getNodeWorlds(this->nodeWorlds);
+            this->DrawInstanced(shaders, instances, count, this->nodeWorlds);
+        }
+
+        // Same with node transforms from getNodeWorlds, which the shader applies the instance transform on top
+        // of. Reads nothing cull or getNodeWorlds update, so those can run for the next frame meanwhile
+        void DrawInstanced(ShaderVariants &shaders, const InstanceData *instances, unsigned int count, const std::vector<glm::mat4> &nodeWorlds)
+        {
+            if(count == 0)
+            {
+                return;
+            }
+
+            ProfileScope scope("Model::DrawInstanced", true);
+            this->attachInstances();
+            this->instances.update(instances, count);
+
+            if(this->batched)
+            {
+                this->batch.DrawInstanced(shaders, this->vertexFeatures() | SHADER_INSTANCED, this->materials, nodeWorlds, count);
+                return;
+            }
 
-                // Normals
-                if(mesh->HasNormals())
+            Shader *bound = NULL;
+            Uniform<glm::mat4> modelUniform;
+            unsigned int boundMaterial = ~0u;
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                if(this->meshes[i].indices.empty())
                 {
-                    vector.x = mesh->mNormals[i].x;
-                    vector.y = mesh->mNormals[i].y;
-                    vector.z = mesh->mNormals[i].z;
-                    vertex.Normal = vector;
+                    continue;
                 }
 
-                // Process material
-                // Does the mesh contain texture coordinates?
-                if(mesh->mTextureCoords[0])
+                Shader *shader = shaders.get(this->meshFeatures[i] | SHADER_INSTANCED);
+                if(!shader)
                 {
-                    glm::vec2 vec;
-                    vec.x = mesh->mTextureCoords[0][i].x;
-                    vec.y = mesh->mTextureCoords[0][i].y;
-                    vertex.TexCoords = vec;
+                    continue;
                 }
-                else
+                if(shader != bound)
                 {
-                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                    bound = shader;
+                    modelUniform = this->useShader(*shader);
                 }
 
-                vertices.push_back(vertex);
+                if(this->meshes[i].materialIndex != boundMaterial)
+                {
+                    boundMaterial = this->meshes[i].materialIndex;
+                    this->materials.bind(boundMaterial);
+                }
+                shader->set(modelUniform, nodeWorlds[i]);
+                this->meshes[i].DrawInstanced(*shader, count);
             }
+        }
+
+        void DrawInstanced(ShaderVariants &shaders, const std::vector<InstanceData> &instances)
+        {
+            this->DrawInstanced(shaders, instances.data(), instances.size());
+        }
+
+        void DrawInstanced(ShaderVariants &shaders, const std::vector<InstanceData> &instances, const std::vector<glm::mat4> &nodeWorlds)
+        {
+            this->DrawInstanced(shaders, instances.data(), instances.size(), nodeWorlds);
+        }
 
-            // Process indices
-            for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        // Hands the largest meshes, by world bounding radius, to an occlusion culler as occluders.
+        // Their vertices must stay loaded until it has rendered
+        void addOccluders(OcclusionCuller &occlusion, const glm::mat4 &model, unsigned int maxOccluders = 8)
+        {
+            this->updateWorld(model);
+
+            std::vector<std::pair<float, unsigned int> > sizes;
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
             {
-                aiFace face = mesh->mFaces[i];
-                for (unsigned int j = 0; j < face.mNumIndices; j++)
+                if(!this->meshes[i].indices.empty())
                 {
-                    indices.push_back(face.mIndices[j]);
+                    sizes.push_back(std::make_pair(this->worldBounds[i].radius, i));
                 }
             }
 
-            // Process material
-            if(mesh->mMaterialIndex >= 0)
+            unsigned int count = std::min<unsigned int>(maxOccluders, sizes.size());
+            std::partial_sort(sizes.begin(), sizes.begin() + count, sizes.end(), std::greater<std::pair<float, unsigned int> >());
+            for (unsigned int i = 0; i < count; i++)
             {
-                aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-                
-                // Diffuse
-                std::vector<Texture> diffuseMaps = this->loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-                textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-
-                // Specular
-                std::vector<Texture> specularMaps = this->loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-                textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+                const Mesh &mesh = this->meshes[sizes[i].second];
+                occlusion.addOccluder(mesh.vertices, mesh.indices, this->meshWorlds[sizes[i].second]);
             }
-            
-            return Mesh(vertices, indices, textures);
         }
 
-        std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
+    private:
+        // Model data
+        std::vector<Mesh> meshes;
+        // std::string directory;
+        // One entry per TextureCache::acquire
+        std::vector<unsigned int> acquiredTextures;
+        MaterialTable materials;
+        VertexFormat format;
+        bool batched;
+        MeshBatch batch;
+        // Render queue state of each mesh: model id in the top 8 bits, then a distinct
+        // (material, textures) pair in the low 12 bits. stateFirstMesh is the first mesh with that state
+        std::vector<unsigned int> stateIds;
+        std::vector<unsigned int> stateFirstMesh;
+        // ShaderFeature bits of every mesh, without SHADER_INSTANCED
+        std::vector<unsigned int> meshFeatures;
+        // Node hierarchy and the node each mesh hangs off
+        TransformGraph graph;
+        std::vector<unsigned int> meshNodes;
+        // Model matrix times node world transform of every mesh, with the world bounds and scale that follow.
+        // Recomputed when the model matrix or any node moves
+        std::vector<glm::mat4> meshWorlds;
+        std::vector<Bounds> worldBounds;
+        std::vector<float> worldScales;
+        glm::mat4 worldModel;
+        unsigned int worldVersion;
+        bool worldValid;
+        // Node transforms alone, for the DrawInstanced overloads that aren't given them
+        std::vector<glm::mat4> nodeWorlds;
+        // Culling of the world bounds, rebuilt whenever they change
+        FrustumCuller culler;
+        bool cullerValid;
+        std::vector<unsigned char> visible;
+        // Draw list of the overloads that cull and queue in one go
+        std::vector<MeshDraw> draws;
+        // Per-instance transforms and tints of DrawInstanced, attached to the VAOs on first use
+        InstanceBuffer instances;
+        bool instancesAttached;
+
+        void attachInstances()
         {
-            std::vector<Texture> textures;
-            for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+            if(this->instancesAttached)
             {
-                aiString str;
-                mat->GetTexture(type, i, &str);
+                return;
+            }
 
-                bool skip = false;
-                for (unsigned int j = 0; j < this->textures_loaded.size(); j++)
+            if(this->batched)
+            {
+                glBindVertexArray(this->batch.getVAO());
+                this->instances.attach();
+            }
+            else
+            {
+                for (unsigned int i = 0; i < this->meshes.size(); i++)
                 {
-                    if(std::strcmp(this->textures_loaded[j].path.c_str(), str.C_Str()) == 0)
+                    if(this->meshes[i].indices.empty())
                     {
-                        textures.push_back(this->textures_loaded[j]);
-                        skip = true;
-                        break;
+                        continue;
                     }
+
+                    glBindVertexArray(this->meshes[i].getVAO());
+                    this->instances.attach();
+                }
+            }
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            this->instancesAttached = true;
+        }
+
+        unsigned int vertexFeatures() const
+        {
+            return this->format == VertexFormat::COMPACT ? SHADER_COMPACT_VERTEX : 0;
+        }
+
+        // Activates a variant for the direct draws. Returns its model uniform
+        Uniform<glm::mat4> useShader(Shader &shader)
+        {
+            shader.useProgram();
+
+            // Full vertices pass through the dequantization unchanged, compact meshes set their own
+            if(this->format == VertexFormat::FULL)
+            {
+                shader.set(shader.getUniform<glm::vec3>("positionScale"), glm::vec3(1.0f));
+                shader.set(shader.getUniform<glm::vec3>("positionOffset"), glm::vec3(0.0f));
+            }
+            return shader.getUniform<glm::mat4>("model");
+        }
+
+        // One queue item per draw, skipping meshes whose variant is still compiling
+        void queueMeshes(ShaderVariants &shaders, RenderQueue &queue, const std::vector<MeshDraw> &draws)
+        {
+            DrawItem item;
+            item.materials = &this->materials;
+            item.positionScale = glm::vec3(1.0f);
+            item.positionOffset = glm::vec3(0.0f);
+
+            for (unsigned int d = 0; d < draws.size(); d++)
+            {
+                unsigned int i = draws[d].mesh;
+                unsigned int lod = draws[d].lod;
+                const Mesh &mesh = this->meshes[i];
+
+                item.shader = shaders.get(this->meshFeatures[i]);
+                if(!item.shader)
+                {
+                    continue;
+                }
+
+                // Meshes of one state share a texture list, so the queue sees them as equal
+                const Mesh &stateMesh = this->meshes[this->stateFirstMesh[i]];
+                item.model = draws[d].model;
+                item.materialIndex = mesh.materialIndex;
+                item.textures = &stateMesh.textures;
+                item.samplerNames = &stateMesh.samplerNames;
+                item.indexCount = mesh.lods[lod].indexCount;
+
+                const QuantizationBounds *quantization;
+                if(this->batched)
+                {
+                    item.VAO = this->batch.getVAO();
+                    item.indexType = this->batch.getIndexType();
+                    item.indexOffset = this->batch.getIndexOffset(i, mesh.lods[lod].firstIndex);
+                    item.baseVertex = this->batch.ranges[i].baseVertex;
+                    quantization = &this->batch.getQuantization();
+                }
+                else
+                {
+                    item.VAO = mesh.getVAO();
+                    item.indexType = mesh.getIndexType();
+                    item.indexOffset = mesh.getIndexOffset(lod);
+                    item.baseVertex = 0;
+                    quantization = &mesh.quantization;
                 }
-                
-                // If texture has not been loaded already, load it
-                if(!skip)
+
+                if(this->format == VertexFormat::COMPACT)
                 {
-                    Texture texture;
-                    texture.id = TextureFromFile(str.C_Str());
-                    texture.type = typeName;
-                    texture.path = str.C_Str();
-                    textures.push_back(texture);
-                    this->textures_loaded.push_back(texture);
+                    item.positionScale = quantization->extent / SNORM16_MAX;
+                    item.positionOffset = quantization->center;
                 }
+
+                queue.push(item, this->stateIds[i], mesh.bounds.center);
             }
+        }
 
-            return textures;
+        // Static models with static nodes compute their world transforms once
+        void updateWorld(const glm::mat4 &model)
+        {
+            this->graph.update();
+            if(this->worldValid && model == this->worldModel && this->graph.getVersion() == this->worldVersion)
+            {
+                return;
+            }
+
+            this->meshWorlds.resize(this->meshes.size());
+            this->worldBounds.resize(this->meshes.size());
+            this->worldScales.resize(this->meshes.size());
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                MultiplyTransform(model, this->graph.getWorld(this->meshNodes[i]), this->meshWorlds[i]);
+                this->worldBounds[i] = TransformBounds(this->meshes[i].bounds, this->meshWorlds[i]);
+                this->worldScales[i] = MaxAxisScale(this->meshWorlds[i]);
+            }
+
+            this->worldModel = model;
+            this->worldVersion = this->graph.getVersion();
+            this->worldValid = true;
+            this->cullerValid = false;
         }
-};
 
-// unsigned int TextureFromFile(const char *path, const std::string &directory)
-unsigned int TextureFromFile(const char *path)
-{
-    std::string filename = std::string(path);
+        void assignStateIds()
+        {
+            static unsigned int nextModelId = 0;
+            unsigned int modelId = (nextModelId++) & 0xffu;
 
-    std::cout << filename << std::endl;
+            std::map<std::pair<unsigned int, std::vector<unsigned int> >, unsigned int> lookup;
+            std::vector<unsigned int> firstMesh;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+            this->stateIds.resize(this->meshes.size());
+            this->stateFirstMesh.resize(this->meshes.size());
+            for (unsigned int i = 0; i < this->meshes.size(); i++)
+            {
+                std::vector<unsigned int> textureIds;
+                for (unsigned int j = 0; j < this->meshes[i].textures.size(); j++)
+                {
+                    textureIds.push_back(this->meshes[i].textures[j].id);
+                }
+
+                std::pair<unsigned int, std::vector<unsigned int> > key(this->meshes[i].materialIndex, textureIds);
+                std::map<std::pair<unsigned int, std::vector<unsigned int> >, unsigned int>::iterator it = lookup.find(key);
+                if(it == lookup.end())
+                {
+                    it = lookup.insert(std::make_pair(key, (unsigned int)firstMesh.size())).first;
+                    firstMesh.push_back(i);
+                }
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+                this->stateIds[i] = (modelId << 12) | (it->second & 0xfffu);
+                this->stateFirstMesh[i] = firstMesh[it->second];
+            }
+        }
 
-    if(data)
-    {
-        unsigned int format;
-        if(nrComponents == 1)
+        void loadModel(std::string path)
         {
-            format = GL_RED;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            // Hash the source so edits to the model invalidate its cache
+            std::uint64_t sourceHash = 0;
+            AssetFile source(path);
+            if(source.isOpen())
+            {
+                sourceHash = hashBytes(source.data, source.size);
+            }
+
+            ModelData data;
+            std::string cachePath = path + ".cache";
+            ModelCache cache;
+            bool cached = sourceHash != 0 && cache.open(cachePath, sourceHash, MODEL_IMPORT_FLAGS);
+            if(cached)
+            {
+                cache.read(data);
+            }
+            else
+            {
+                // A packed model is imported from the mapping without a copy
+                bool imported = source.isPacked() ? ImportModel(source.data, source.size, path, data) : ImportModel(path, data);
+                if(!imported)
+                {
+                    return;
+                }
+
+                for (unsigned int i = 0; i < data.meshes.size(); i++)
+                {
+                    data.meshes[i].data.optimization.print(i);
+                }
+
+                if(sourceHash != 0)
+                {
+                    ModelCache::write(cachePath, sourceHash, MODEL_IMPORT_FLAGS, data);
+                }
+            }
+
+            this->upload(data);
+
+            std::cout << (cached ? "Model loaded from cache in " : "Model imported with Assimp in ") << elapsedMs(start) << " ms" << std::endl;
         }
-        else if(nrComponents == 3)
+
+        // Texture loading and GL uploads stay on the context thread
+        void upload(ModelData &data)
         {
-            format = GL_RGB;
+            // Materials are already unique, so their indices are kept as is
+            for (unsigned int i = 0; i < data.materials.size(); i++)
+            {
+                this->materials.add(data.materials[i]);
+            }
+            this->materials.upload();
+
+            for (unsigned int i = 0; i < data.nodes.size(); i++)
+            {
+                this->graph.addNode(data.nodes[i].parent, data.nodes[i].transform, data.nodes[i].name);
+            }
+            if(this->graph.size() == 0)
+            {
+                this->graph.addNode(TransformGraph::NO_NODE, glm::mat4(1.0f));
+            }
+
+            this->meshes.reserve(this->meshes.size() + data.meshes.size());
+            for (unsigned int i = 0; i < data.meshes.size(); i++)
+            {
+                LoadedMesh &mesh = data.meshes[i];
+
+                std::vector<Texture> textures;
+                for (unsigned int j = 0; j < mesh.textures.size(); j++)
+                {
+                    textures.push_back(this->loadTexture(mesh.textures[j].path, mesh.textures[j].type));
+                }
+
+                this->meshes.push_back(Mesh(std::move(mesh.data), std::move(textures), mesh.materialIndex, this->format, !this->batched));
+                this->meshNodes.push_back(mesh.node < this->graph.size() ? mesh.node : 0);
+                this->meshFeatures.push_back(MaterialFeatures(this->meshes.back().textures, this->materials.materials[mesh.materialIndex]) | this->vertexFeatures());
+            }
         }
-        else if(nrComponents == 4)
+
+        static double elapsedMs(std::chrono::steady_clock::time_point start)
         {
-            format = GL_RGBA;
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
         }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glBindTexture(GL_TEXTURE_2D, 0);
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
-}
+        // Shared through the global TextureCache; every acquire is released when the model goes away
+        Texture loadTexture(const std::string &path, const std::string &typeName)
+        {
+            Texture texture;
+            texture.id = TextureCache::global().acquire(path);
+            texture.type = typeName;
+            texture.path = path;
+            this->acquiredTextures.push_back(texture.id);
+
+            return texture;
+        }
+};
 
 #endif // MODEL_H
\ No newline at end of file
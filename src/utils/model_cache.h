@@ -0,0 +1,427 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "hash.h"
+#include "asset_pack.h"
+#include "mesh_data.h"
+#include "bounds.h"
+#include "lod.h"
+#include "model_loader.h"
+
+// On-disk cache of processed model data, so later runs can skip the Assimp import.
+//
+// File layout (offsets are from the start of the file, blobs are 8 byte aligned):
+//   CacheHeader
+//   CacheMeshEntry[meshCount]
+//   CacheTextureRef[textureCount]
+//   Material[materialCount]
+//   CacheNode[nodeCount]
+//   String table (texture types and paths, node names, not null terminated)
+//   Vertex, index and LOD index blobs
+struct CacheHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t sourceHash;
+    std::uint32_t importFlags;
+    std::uint32_t vertexSize;
+    std::uint32_t meshCount;
+    std::uint32_t textureCount;
+    std::uint32_t materialCount;
+    std::uint32_t nodeCount;
+    std::uint64_t stringTableOffset;
+    std::uint64_t stringTableSize;
+};
+
+struct CacheMeshEntry {
+    std::uint64_t vertexOffset;
+    std::uint64_t indexOffset;
+    std::uint32_t vertexCount;
+    std::uint32_t indexCount;
+    std::uint32_t firstTexture;
+    std::uint32_t textureCount;
+    std::uint32_t materialIndex;
+    std::uint32_t node;
+    Bounds bounds;
+    std::uint64_t lodIndexOffset;
+    std::uint32_t lodIndexCount;
+    std::uint32_t lodCount;
+    MeshLod lods[MAX_LOD_LEVELS];
+};
+
+struct CacheTextureRef {
+    std::uint32_t typeOffset;
+    std::uint32_t typeLength;
+    std::uint32_t pathOffset;
+    std::uint32_t pathLength;
+};
+
+struct CacheNode {
+    std::uint32_t parent;
+    std::uint32_t nameOffset;
+    std::uint32_t nameLength;
+    std::uint32_t reserved;
+    float transform[16];
+};
+
+// Mesh data pointing straight into the mapped cache file
+struct CachedMesh {
+    const Vertex *vertices;
+    unsigned int vertexCount;
+    const unsigned int *indices;
+    unsigned int indexCount;
+    std::vector<TextureRef> textures;
+    unsigned int materialIndex;
+    unsigned int node;
+    Bounds bounds;
+    const unsigned int *lodIndices;
+    unsigned int lodIndexCount;
+    std::vector<MeshLod> lods;
+};
+
+class ModelCache
+{
+public:
+    // Bump whenever the layout of the file or of Vertex, or the processing behind the data, changes
+    static const std::uint32_t VERSION = 6;
+
+    // Maps the cache file and checks it was built from the same source and import flags
+    bool open(const std::string &cachePath, std::uint64_t sourceHash, unsigned int importFlags)
+    {
+        if(!this->file.open(cachePath))
+        {
+            return false;
+        }
+
+        if(!this->validate(sourceHash, importFlags))
+        {
+            std::cout << "Model cache is stale: " << cachePath << std::endl;
+            this->file.close();
+            return false;
+        }
+
+        return true;
+    }
+
+    unsigned int getMeshCount() const
+    {
+        return this->header()->meshCount;
+    }
+
+    unsigned int getMaterialCount() const
+    {
+        return this->header()->materialCount;
+    }
+
+    const Material &getMaterial(unsigned int index) const
+    {
+        return this->materials()[index];
+    }
+
+    CachedMesh getMesh(unsigned int index) const
+    {
+        const CacheMeshEntry &entry = this->meshEntries()[index];
+
+        CachedMesh mesh;
+        mesh.vertices = reinterpret_cast<const Vertex*>(this->file.data + entry.vertexOffset);
+        mesh.vertexCount = entry.vertexCount;
+        mesh.indices = reinterpret_cast<const unsigned int*>(this->file.data + entry.indexOffset);
+        mesh.indexCount = entry.indexCount;
+        mesh.materialIndex = entry.materialIndex;
+        mesh.node = entry.node;
+        mesh.bounds = entry.bounds;
+        mesh.lodIndices = reinterpret_cast<const unsigned int*>(this->file.data + entry.lodIndexOffset);
+        mesh.lodIndexCount = entry.lodIndexCount;
+        mesh.lods.assign(entry.lods, entry.lods + entry.lodCount);
+
+        const char *strings = reinterpret_cast<const char*>(this->file.data + this->header()->stringTableOffset);
+        for(unsigned int i = 0; i < entry.textureCount; i++)
+        {
+            const CacheTextureRef &ref = this->textureRefs()[entry.firstTexture + i];
+
+            TextureRef texture;
+            texture.type.assign(strings + ref.typeOffset, ref.typeLength);
+            texture.path.assign(strings + ref.pathOffset, ref.pathLength);
+            mesh.textures.push_back(texture);
+        }
+
+        return mesh;
+    }
+
+    // Copies the whole cache into the form a fresh import produces
+    void read(ModelData &model) const
+    {
+        model.materials.assign(this->materials(), this->materials() + this->getMaterialCount());
+
+        const char *strings = reinterpret_cast<const char*>(this->file.data + this->header()->stringTableOffset);
+        model.nodes.resize(this->header()->nodeCount);
+        for(unsigned int i = 0; i < model.nodes.size(); i++)
+        {
+            const CacheNode &cached = this->nodes()[i];
+            SceneNode &node = model.nodes[i];
+            node.parent = cached.parent;
+            std::memcpy(&node.transform[0][0], cached.transform, sizeof(cached.transform));
+            node.name.assign(strings + cached.nameOffset, cached.nameLength);
+        }
+
+        model.meshes.resize(this->getMeshCount());
+        for(unsigned int i = 0; i < this->getMeshCount(); i++)
+        {
+            CachedMesh cached = this->getMesh(i);
+            LoadedMesh &mesh = model.meshes[i];
+
+            mesh.data.vertices.assign(cached.vertices, cached.vertices + cached.vertexCount);
+            mesh.data.indices.assign(cached.indices, cached.indices + cached.indexCount);
+            mesh.data.bounds = cached.bounds;
+            mesh.data.lodIndices.assign(cached.lodIndices, cached.lodIndices + cached.lodIndexCount);
+            mesh.data.lods = cached.lods;
+            mesh.materialIndex = cached.materialIndex;
+            mesh.node = cached.node;
+            mesh.textures = cached.textures;
+        }
+    }
+
+    // Serializes processed meshes. Writes to a temporary file first so a crash never leaves a torn cache
+    static bool write(const std::string &cachePath, std::uint64_t sourceHash, unsigned int importFlags, const ModelData &model)
+    {
+        const std::vector<LoadedMesh> &meshes = model.meshes;
+        const std::vector<Material> &materials = model.materials;
+
+        std::vector<CacheMeshEntry> entries(meshes.size());
+        std::vector<CacheTextureRef> refs;
+        std::vector<CacheNode> nodes(model.nodes.size());
+        std::string strings;
+
+        for(unsigned int i = 0; i < nodes.size(); i++)
+        {
+            const SceneNode &node = model.nodes[i];
+            nodes[i].parent = node.parent;
+            nodes[i].nameOffset = strings.size();
+            nodes[i].nameLength = node.name.size();
+            nodes[i].reserved = 0;
+            std::memcpy(nodes[i].transform, &node.transform[0][0], sizeof(nodes[i].transform));
+            strings += node.name;
+        }
+
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            const MeshData &data = meshes[i].data;
+            entries[i].vertexCount = data.vertices.size();
+            entries[i].indexCount = data.indices.size();
+            entries[i].firstTexture = refs.size();
+            entries[i].textureCount = meshes[i].textures.size();
+            entries[i].materialIndex = meshes[i].materialIndex;
+            entries[i].node = meshes[i].node;
+            entries[i].bounds = data.bounds;
+            entries[i].lodIndexCount = data.lodIndices.size();
+            entries[i].lodCount = std::min<std::size_t>(data.lods.size(), MAX_LOD_LEVELS);
+            std::memset(entries[i].lods, 0, sizeof(entries[i].lods));
+            std::copy(data.lods.begin(), data.lods.begin() + entries[i].lodCount, entries[i].lods);
+
+            for(unsigned int j = 0; j < meshes[i].textures.size(); j++)
+            {
+                const TextureRef &texture = meshes[i].textures[j];
+
+                CacheTextureRef ref;
+                ref.typeOffset = strings.size();
+                ref.typeLength = texture.type.size();
+                strings += texture.type;
+                ref.pathOffset = strings.size();
+                ref.pathLength = texture.path.size();
+                strings += texture.path;
+                refs.push_back(ref);
+            }
+        }
+
+        CacheHeader header;
+        std::memcpy(header.magic, "AMCC", 4);
+        header.version = VERSION;
+        header.sourceHash = sourceHash;
+        header.importFlags = importFlags;
+        header.vertexSize = sizeof(Vertex);
+        header.meshCount = entries.size();
+        header.textureCount = refs.size();
+        header.materialCount = materials.size();
+        header.nodeCount = nodes.size();
+        std::uint64_t materialOffset = sizeof(CacheHeader) + entries.size() * sizeof(CacheMeshEntry) + refs.size() * sizeof(CacheTextureRef);
+        std::uint64_t nodeOffset = materialOffset + materials.size() * sizeof(Material);
+        header.stringTableOffset = nodeOffset + nodes.size() * sizeof(CacheNode);
+        header.stringTableSize = strings.size();
+
+        // Place the geometry blobs after the string table
+        std::uint64_t offset = align(header.stringTableOffset + header.stringTableSize);
+        for(unsigned int i = 0; i < entries.size(); i++)
+        {
+            entries[i].vertexOffset = offset;
+            offset = align(offset + entries[i].vertexCount * sizeof(Vertex));
+            entries[i].indexOffset = offset;
+            offset = align(offset + entries[i].indexCount * sizeof(unsigned int));
+            entries[i].lodIndexOffset = offset;
+            offset = align(offset + entries[i].lodIndexCount * sizeof(unsigned int));
+        }
+
+        std::vector<char> buffer(offset, 0);
+        std::memcpy(&buffer[0], &header, sizeof(header));
+        if(!entries.empty())
+        {
+            std::memcpy(&buffer[sizeof(header)], &entries[0], entries.size() * sizeof(CacheMeshEntry));
+        }
+        if(!refs.empty())
+        {
+            std::memcpy(&buffer[sizeof(header) + entries.size() * sizeof(CacheMeshEntry)], &refs[0], refs.size() * sizeof(CacheTextureRef));
+        }
+        if(!materials.empty())
+        {
+            std::memcpy(&buffer[materialOffset], &materials[0], materials.size() * sizeof(Material));
+        }
+        if(!nodes.empty())
+        {
+            std::memcpy(&buffer[nodeOffset], &nodes[0], nodes.size() * sizeof(CacheNode));
+        }
+        if(!strings.empty())
+        {
+            std::memcpy(&buffer[header.stringTableOffset], strings.data(), strings.size());
+        }
+        for(unsigned int i = 0; i < entries.size(); i++)
+        {
+            if(entries[i].vertexCount)
+            {
+                std::memcpy(&buffer[entries[i].vertexOffset], &meshes[i].data.vertices[0], entries[i].vertexCount * sizeof(Vertex));
+            }
+            if(entries[i].indexCount)
+            {
+                std::memcpy(&buffer[entries[i].indexOffset], &meshes[i].data.indices[0], entries[i].indexCount * sizeof(unsigned int));
+            }
+            if(entries[i].lodIndexCount)
+            {
+                std::memcpy(&buffer[entries[i].lodIndexOffset], &meshes[i].data.lodIndices[0], entries[i].lodIndexCount * sizeof(unsigned int));
+            }
+        }
+
+        std::string tmpPath = cachePath + ".tmp";
+        std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(&buffer[0], buffer.size());
+        out.close();
+
+        if(!out || std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+        {
+            std::cout << "ERROR::MODEL_CACHE::WRITE_FAILED " << cachePath << std::endl;
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    // A cache shipped inside the asset pack is read from there
+    AssetFile file;
+
+    static std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + 7) & ~std::uint64_t(7);
+    }
+
+    const CacheHeader *header() const
+    {
+        return reinterpret_cast<const CacheHeader*>(this->file.data);
+    }
+
+    const CacheMeshEntry *meshEntries() const
+    {
+        return reinterpret_cast<const CacheMeshEntry*>(this->file.data + sizeof(CacheHeader));
+    }
+
+    const CacheTextureRef *textureRefs() const
+    {
+        return reinterpret_cast<const CacheTextureRef*>(this->file.data + sizeof(CacheHeader) + this->header()->meshCount * sizeof(CacheMeshEntry));
+    }
+
+    const Material *materials() const
+    {
+        return reinterpret_cast<const Material*>(this->textureRefs() + this->header()->textureCount);
+    }
+
+    const CacheNode *nodes() const
+    {
+        return reinterpret_cast<const CacheNode*>(this->materials() + this->header()->materialCount);
+    }
+
+    // Checks the key fields and that every offset stays inside the file
+    bool validate(std::uint64_t sourceHash, unsigned int importFlags) const
+    {
+        if(this->file.size < sizeof(CacheHeader))
+        {
+            return false;
+        }
+
+        const CacheHeader *h = this->header();
+        if(std::memcmp(h->magic, "AMCC", 4) != 0 || h->version != VERSION || h->vertexSize != sizeof(Vertex) ||
+           h->sourceHash != sourceHash || h->importFlags != importFlags)
+        {
+            return false;
+        }
+
+        std::uint64_t tables = sizeof(CacheHeader) + std::uint64_t(h->meshCount) * sizeof(CacheMeshEntry) +
+                               std::uint64_t(h->textureCount) * sizeof(CacheTextureRef) + std::uint64_t(h->materialCount) * sizeof(Material) +
+                               std::uint64_t(h->nodeCount) * sizeof(CacheNode);
+        if(tables > this->file.size || h->stringTableOffset != tables || h->stringTableOffset + h->stringTableSize > this->file.size)
+        {
+            return false;
+        }
+
+        for(unsigned int i = 0; i < h->meshCount; i++)
+        {
+            const CacheMeshEntry &entry = this->meshEntries()[i];
+            if(entry.vertexOffset + std::uint64_t(entry.vertexCount) * sizeof(Vertex) > this->file.size ||
+               entry.indexOffset + std::uint64_t(entry.indexCount) * sizeof(unsigned int) > this->file.size ||
+               std::uint64_t(entry.firstTexture) + entry.textureCount > h->textureCount ||
+               entry.lodIndexOffset + std::uint64_t(entry.lodIndexCount) * sizeof(unsigned int) > this->file.size ||
+               entry.materialIndex >= h->materialCount || entry.node >= h->nodeCount || entry.lodCount == 0 || entry.lodCount > MAX_LOD_LEVELS)
+            {
+                return false;
+            }
+
+            for(unsigned int j = 0; j < entry.lodCount; j++)
+            {
+                if(std::uint64_t(entry.lods[j].firstIndex) + entry.lods[j].indexCount > std::uint64_t(entry.indexCount) + entry.lodIndexCount)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // Parents come first, as TransformGraph requires
+        for(unsigned int i = 0; i < h->nodeCount; i++)
+        {
+            const CacheNode &node = this->nodes()[i];
+            if((node.parent != TransformGraph::NO_NODE && node.parent >= i) ||
+               std::uint64_t(node.nameOffset) + node.nameLength > h->stringTableSize)
+            {
+                return false;
+            }
+        }
+
+        for(unsigned int i = 0; i < h->textureCount; i++)
+        {
+            const CacheTextureRef &ref = this->textureRefs()[i];
+            if(std::uint64_t(ref.typeOffset) + ref.typeLength > h->stringTableSize ||
+               std::uint64_t(ref.pathOffset) + ref.pathLength > h->stringTableSize)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+#endif // MODEL_CACHE_H
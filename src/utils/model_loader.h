@@ -0,0 +1,329 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include "assimp/Importer.hpp"
+#include "assimp/scene.h"
+#include "assimp/postprocess.h"
+
+#include "mesh_data.h"
+#include "bounds.h"
+#include "lod.h"
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+#include "transform_graph.h"
+
+// CPU side of model loading: Assimp import, material extraction and mesh conversion. Nothing here
+// touches GL, so it runs on worker threads and in the benchmarks; Model does the uploads
+
+// Post-processing steps requested from Assimp. Part of the model cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+// Texture file a mesh samples and the sampler type it binds to, e.g. texture_diffuse
+struct TextureRef {
+    std::string type;
+    std::string path;
+};
+
+struct LoadedMesh {
+    MeshData data;
+    unsigned int materialIndex;
+    std::vector<TextureRef> textures;
+    // Node of ModelData::nodes the mesh hangs off
+    unsigned int node;
+};
+
+// One aiNode: its transform relative to the parent, parent == TransformGraph::NO_NODE for the root
+struct SceneNode {
+    unsigned int parent;
+    glm::mat4 transform;
+    std::string name;
+};
+
+// Everything a model file turns into before the first GL call
+struct ModelData {
+    // Already deduplicated, meshes index into it
+    std::vector<Material> materials;
+    // In draw order
+    std::vector<LoadedMesh> meshes;
+    // Breadth first, as TransformGraph wants them
+    std::vector<SceneNode> nodes;
+};
+
+// Assimp matrices are row-major, glm ones column-major
+inline glm::mat4 MatrixFromAssimp(const aiMatrix4x4 &m)
+{
+    glm::mat4 result;
+    result[0] = glm::vec4(m.a1, m.b1, m.c1, m.d1);
+    result[1] = glm::vec4(m.a2, m.b2, m.c2, m.d2);
+    result[2] = glm::vec4(m.a3, m.b3, m.c3, m.d3);
+    result[3] = glm::vec4(m.a4, m.b4, m.c4, m.d4);
+    return result;
+}
+
+// Walks the node tree breadth first. Every node reference to a mesh becomes one entry of meshList,
+// meshNodes holding the index of the node it came from
+inline void CollectNodes(const aiScene *scene, std::vector<SceneNode> &nodes, std::vector<const aiMesh*> &meshList, std::vector<unsigned int> &meshNodes)
+{
+    std::deque<std::pair<const aiNode*, unsigned int> > pending;
+    pending.push_back(std::make_pair(scene->mRootNode, TransformGraph::NO_NODE));
+
+    while(!pending.empty())
+    {
+        const aiNode *node = pending.front().first;
+        unsigned int index = nodes.size();
+
+        SceneNode sceneNode;
+        sceneNode.parent = pending.front().second;
+        sceneNode.transform = MatrixFromAssimp(node->mTransformation);
+        sceneNode.name = node->mName.C_Str();
+        nodes.push_back(sceneNode);
+        pending.pop_front();
+
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            meshList.push_back(scene->mMeshes[node->mMeshes[i]]);
+            meshNodes.push_back(index);
+        }
+
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            pending.push_back(std::make_pair(node->mChildren[i], index));
+        }
+    }
+}
+
+// Reads the colors of an Assimp material
+inline Material MaterialFromAssimp(const aiMaterial *material)
+{
+    Material result;
+
+    aiColor3D ambient;
+    if(AI_SUCCESS != material->Get(AI_MATKEY_COLOR_AMBIENT, ambient))
+    {
+        std::cout << "Error loading ambient color" << std::endl;
+    }
+    result.ambient = glm::vec3(ambient.r, ambient.g, ambient.b);
+
+    aiColor3D diffuse;
+    if(AI_SUCCESS != material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse))
+    {
+        std::cout << "Error loading diffuse color" << std::endl;
+    }
+    result.diffuse = glm::vec3(diffuse.r, diffuse.g, diffuse.b);
+
+    aiColor3D specular;
+    if(AI_SUCCESS != material->Get(AI_MATKEY_COLOR_SPECULAR, specular))
+    {
+        std::cout << "Error loading specular color" << std::endl;
+    }
+    result.specular = glm::vec3(specular.r, specular.g, specular.b);
+
+    float shininess = 0.0f;
+    if(AI_SUCCESS != material->Get(AI_MATKEY_SHININESS, shininess))
+    {
+        std::cout << "Error loading shininess" << std::endl;
+    }
+    result.shininess = shininess;
+
+    return result;
+}
+
+// Reads each aiMaterial once, identical ones share an entry. materialMap gets the entry of every aiMaterial
+inline void ExtractMaterials(const aiScene *scene, std::vector<Material> &materials, std::vector<unsigned int> &materialMap)
+{
+    materials.clear();
+    std::unordered_map<std::uint64_t, unsigned int> lookup;
+    materialMap.resize(scene->mNumMaterials);
+    for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+    {
+        materialMap[i] = AddUniqueMaterial(materials, lookup, MaterialFromAssimp(scene->mMaterials[i]));
+    }
+    if(materials.empty())
+    {
+        materials.push_back(Material());
+    }
+}
+
+inline void MaterialTextures(const aiMaterial *material, aiTextureType type, const std::string &typeName, std::vector<TextureRef> &textures)
+{
+    for (unsigned int i = 0; i < material->GetTextureCount(type); i++)
+    {
+        aiString str;
+        material->GetTexture(type, i, &str);
+
+        TextureRef texture;
+        texture.type = typeName;
+        texture.path = str.C_Str();
+        textures.push_back(texture);
+    }
+}
+
+inline void ExtractVertices(const aiMesh *mesh, std::vector<Vertex> &vertices)
+{
+    vertices.reserve(mesh->mNumVertices);
+
+    for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+    {
+        Vertex vertex;
+
+        // Process vertex positions, normals and texture coordinates
+        glm::vec3 vector;
+
+        // Position
+        vector.x = mesh->mVertices[i].x;
+        vector.y = mesh->mVertices[i].y;
+        vector.z = mesh->mVertices[i].z;
+        vertex.Position = vector;
+
+        // Normals
+        if(mesh->HasNormals())
+        {
+            vector.x = mesh->mNormals[i].x;
+            vector.y = mesh->mNormals[i].y;
+            vector.z = mesh->mNormals[i].z;
+            vertex.Normal = vector;
+        }
+        else
+        {
+            vertex.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+        }
+
+        // Process material
+        // Does the mesh contain texture coordinates?
+        if(mesh->mTextureCoords[0])
+        {
+            glm::vec2 vec;
+            vec.x = mesh->mTextureCoords[0][i].x;
+            vec.y = mesh->mTextureCoords[0][i].y;
+            vertex.TexCoords = vec;
+        }
+        else
+        {
+            vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+        }
+
+        vertices.push_back(vertex);
+    }
+}
+
+inline void ExtractIndices(const aiMesh *mesh, std::vector<unsigned int> &indices)
+{
+    indices.reserve(mesh->mNumFaces * 3);
+
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    {
+        // aiProcess_Triangulate leaves point and line faces as they are, and everything after this expects triangles
+        const aiFace &face = mesh->mFaces[i];
+        if(face.mNumIndices != 3)
+        {
+            continue;
+        }
+        for (unsigned int j = 0; j < face.mNumIndices; j++)
+        {
+            indices.push_back(face.mIndices[j]);
+        }
+    }
+}
+
+// Pure CPU conversion, safe to run on worker threads
+inline MeshData ConvertMesh(const aiMesh *mesh)
+{
+    MeshData data;
+    std::vector<Vertex> &vertices = data.vertices;
+    std::vector<unsigned int> &indices = data.indices;
+    ExtractVertices(mesh, vertices);
+    ExtractIndices(mesh, indices);
+
+    // Weld, then reorder for the post-transform cache, overdraw and fetch locality
+    data.optimization = OptimizeMesh(vertices, indices);
+
+    data.bounds = ComputeBounds(vertices);
+    GenerateLods(vertices, indices, data.bounds, data.lodIndices, data.lods);
+
+    // Simplification keeps the triangle order of the full level, so reorder each level as well
+    for (unsigned int i = 1; i < data.lods.size(); i++)
+    {
+        std::vector<unsigned int>::iterator first = data.lodIndices.begin() + (data.lods[i].firstIndex - indices.size());
+        std::vector<unsigned int> level(first, first + data.lods[i].indexCount);
+        OptimizeVertexCache(level, vertices.size());
+        std::copy(level.begin(), level.end(), first);
+    }
+
+    return data;
+}
+
+// Converts an imported scene. Every aiMesh converts independently on the thread pool, each into its own
+// slot so the order stays fixed
+inline void ConvertScene(const aiScene *scene, ModelData &model)
+{
+    std::vector<unsigned int> materialMap;
+    ExtractMaterials(scene, model.materials, materialMap);
+
+    std::vector<const aiMesh*> meshList;
+    std::vector<unsigned int> meshNodes;
+    CollectNodes(scene, model.nodes, meshList, meshNodes);
+
+    model.meshes.resize(meshList.size());
+    ThreadPool::global().parallelFor(meshList.size(), [&](size_t i) {
+        model.meshes[i].data = ConvertMesh(meshList[i]);
+    });
+
+    for (unsigned int i = 0; i < meshList.size(); i++)
+    {
+        LoadedMesh &mesh = model.meshes[i];
+        mesh.node = meshNodes[i];
+        mesh.materialIndex = 0;
+        if(meshList[i]->mMaterialIndex < scene->mNumMaterials)
+        {
+            mesh.materialIndex = materialMap[meshList[i]->mMaterialIndex];
+            const aiMaterial *material = scene->mMaterials[meshList[i]->mMaterialIndex];
+
+            MaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", mesh.textures);
+            MaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", mesh.textures);
+        }
+    }
+}
+
+// Loose files go through ReadFile, so formats referencing other files (.obj and its .mtl) still resolve them
+inline bool ImportModel(const std::string &path, ModelData &model)
+{
+    Assimp::Importer import;
+    const aiScene *scene = import.ReadFile(path, MODEL_IMPORT_FLAGS);
+
+    if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    {
+        std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+        return false;
+    }
+
+    ConvertScene(scene, model);
+    return true;
+}
+
+// Imports a model already in memory, e.g. inside the asset pack. path only supplies the format hint
+inline bool ImportModel(const unsigned char *data, size_t size, const std::string &path, ModelData &model)
+{
+    size_t dot = path.rfind('.');
+    std::string hint = dot == std::string::npos ? "" : path.substr(dot + 1);
+
+    Assimp::Importer import;
+    const aiScene *scene = import.ReadFileFromMemory(data, size, MODEL_IMPORT_FLAGS, hint.c_str());
+
+    if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    {
+        std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+        return false;
+    }
+
+    ConvertScene(scene, model);
+    return true;
+}
+
+#endif // MODEL_LOADER_H
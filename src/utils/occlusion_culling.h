@@ -0,0 +1,778 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <map>
+#include <cmath>
+#include <cfloat>
+#include <future>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_CULLING_SSE 1
+#endif
+
+#include "glm/glm.hpp"
+
+#include "bounds.h"
+#include "thread_pool.h"
+
+// Software hierarchical-Z occlusion culling. A few large occluders are rasterized on the CPU into a small
+// depth buffer, which is reduced level by level to the farthest depth of every 2x2 block. A box is occluded
+// when its nearest point lies behind the farthest occluder depth over the whole screen area it covers, which
+// a level where that area spans at most 2x2 texels answers in four reads. Depths are NDC z.
+//
+// The buffer is conservative: a texel only gets a depth when one piece of an occluder covers all of it, and that depth
+// is the farthest its surface reaches inside the texel. A texel counts as covered when its center is inside
+// a sheet of the occluder and none of the sheet's outline crosses it. A sheet is a run of triangles facing
+// the same way and joined by edges with a triangle on either side on screen; the other edges are its
+// outline. Every sheet is covered on its own, so neither the back of a closed mesh nor another part behind
+// it pushes the depth of the front away. Pure CPU, needs no GL context
+class OcclusionCuller
+{
+public:
+    static const int WIDTH = 256;
+    static const int HEIGHT = 128;
+    // Rows one task rasterizes; bands run in parallel on the thread pool
+    static const int BAND_HEIGHT = 16;
+
+    OcclusionCuller()
+        : hasDepth(false)
+    {
+        for (int width = WIDTH, height = HEIGHT; width >= 1 && height >= 1; width /= 2, height /= 2)
+        {
+            Level level;
+            level.width = width;
+            level.height = height;
+            level.depth.assign(width * height, 1.0f);
+            this->levels.push_back(level);
+        }
+        this->farthest.resize(WIDTH * HEIGHT);
+        this->centerCovered.resize(WIDTH * HEIGHT);
+        this->onOutline.resize(WIDTH * HEIGHT);
+    }
+
+    // A render still running on the pool reads this object
+    ~OcclusionCuller()
+    {
+        this->wait();
+    }
+
+    void clearOccluders()
+    {
+        this->wait();
+        this->occluders.clear();
+    }
+
+    // Only the positions are read, by render(). vertices and indices must outlive it and not change, the
+    // triangle adjacency found the first time a mesh is added is kept for the next frames
+    template<typename V>
+    void addOccluder(const std::vector<V> &vertices, const std::vector<unsigned int> &indices, const glm::mat4 &model)
+    {
+        if(vertices.empty() || indices.size() < 3)
+        {
+            return;
+        }
+
+        this->wait();
+        Occluder occluder;
+        occluder.positions = reinterpret_cast<const unsigned char*>(&vertices[0].Position);
+        occluder.stride = sizeof(V);
+        occluder.vertexCount = vertices.size();
+        occluder.indices = indices.data();
+        occluder.indexCount = indices.size() / 3 * 3;
+        occluder.model = model;
+        occluder.neighbors = &this->findNeighbors(occluder);
+        this->occluders.push_back(occluder);
+    }
+
+    unsigned int getOccluderCount() const
+    {
+        return this->occluders.size();
+    }
+
+    // Rasterizes the occluders seen through viewProjection and builds the pyramid
+    void render(const glm::mat4 &viewProjection)
+    {
+        this->setupTriangles(viewProjection);
+
+        std::fill(this->levels[0].depth.begin(), this->levels[0].depth.end(), 1.0f);
+        ThreadPool::global().parallelFor(HEIGHT / BAND_HEIGHT, [this](size_t band) {
+            this->rasterizeBand(band * BAND_HEIGHT);
+        });
+        this->buildPyramid();
+
+        this->viewProjection = viewProjection;
+        this->hasDepth = true;
+    }
+
+    // Same on a worker thread, overlapping whatever the caller records next. Call wait() before testing
+    void renderAsync(const glm::mat4 &viewProjection)
+    {
+        this->wait();
+
+        std::shared_ptr<std::promise<void> > done = std::make_shared<std::promise<void> >();
+        this->pending = done->get_future();
+        ThreadPool::global().enqueue([this, viewProjection, done]() {
+            this->render(viewProjection);
+            done->set_value();
+        });
+    }
+
+    void wait()
+    {
+        if(this->pending.valid())
+        {
+            this->pending.get();
+        }
+    }
+
+    // False only when every occluder texel the box covers is nearer than the box. Boxes crossing the near
+    // plane or leaving the screen are left to the frustum culler and count as visible
+    bool isVisible(const Bounds &bounds) const
+    {
+        if(!this->hasDepth)
+        {
+            return true;
+        }
+
+        float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+        float maxX = -FLT_MAX, maxY = -FLT_MAX;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? bounds.max.x : bounds.min.x, (i & 2) ? bounds.max.y : bounds.min.y, (i & 4) ? bounds.max.z : bounds.min.z);
+            glm::vec4 clip = this->viewProjection * glm::vec4(corner, 1.0f);
+            if(clip.w <= 0.0f || clip.z < -clip.w)
+            {
+                return true;
+            }
+
+            float inverse = 1.0f / clip.w;
+            float x = (clip.x * inverse * 0.5f + 0.5f) * WIDTH;
+            float y = (clip.y * inverse * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            minZ = std::min(minZ, clip.z * inverse);
+        }
+
+        int x0 = std::max(0, (int)std::floor(minX));
+        int x1 = std::min(WIDTH - 1, (int)std::floor(maxX));
+        int y0 = std::max(0, (int)std::floor(minY));
+        int y1 = std::min(HEIGHT - 1, (int)std::floor(maxY));
+        if(x0 > x1 || y0 > y1)
+        {
+            return true;
+        }
+
+        // Coarsest detail needed: the level where the box covers at most 2x2 texels
+        unsigned int level = 0;
+        while(level + 1 < this->levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+        {
+            level++;
+        }
+
+        for (int y = y0 >> level; y <= (y1 >> level); y++)
+        {
+            for (int x = x0 >> level; x <= (x1 >> level); x++)
+            {
+                if(this->getDepth(level, x, y) >= minZ)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Clears visible[i] for every box i that is occluded. Returns how many were
+    unsigned int cull(const std::vector<Bounds> &bounds, std::vector<unsigned char> &visible) const
+    {
+        unsigned int occluded = 0;
+        for (unsigned int i = 0; i < bounds.size(); i++)
+        {
+            if(visible[i] && !this->isVisible(bounds[i]))
+            {
+                visible[i] = 0;
+                occluded++;
+            }
+        }
+        return occluded;
+    }
+
+    unsigned int getLevelCount() const
+    {
+        return this->levels.size();
+    }
+
+    // Farthest occluder depth of a texel, 1 where no occluder covers it completely. Level 0 is the rasterized buffer
+    float getDepth(unsigned int level, int x, int y) const
+    {
+        const Level &l = this->levels[level];
+        return l.depth[y * l.width + x];
+    }
+
+private:
+    // Triangle adjacency of one mesh. Entry t * 3 + k is the triangle and edge across edge k of triangle t,
+    // as triangle * 3 + edge, or -1 on the mesh's border and where more than two triangles meet
+    struct Neighbors {
+        const unsigned char *positions;
+        unsigned int vertexCount;
+        unsigned int indexCount;
+        std::vector<int> across;
+    };
+
+    struct Occluder {
+        const unsigned char *positions;
+        size_t stride;
+        unsigned int vertexCount;
+        const unsigned int *indices;
+        unsigned int indexCount;
+        glm::mat4 model;
+        const Neighbors *neighbors;
+    };
+
+    // In pixels, z in NDC. Bit k of outline is set when edge k, from vertex k to the next, is part of the outline
+    struct ScreenTriangle {
+        float x[3], y[3], z[3];
+        int minY, maxY;
+        unsigned int outline;
+    };
+
+    // Triangles of one sheet, and the texels they touch
+    struct TriangleGroup {
+        unsigned int first, count;
+        int minX, maxX, minY, maxY;
+    };
+
+    struct Level {
+        int width, height;
+        std::vector<float> depth;
+    };
+
+    std::vector<Occluder> occluders;
+    std::map<const unsigned int*, Neighbors> neighborCache;
+    std::vector<ScreenTriangle> triangles;
+    std::vector<TriangleGroup> groups;
+    std::vector<Level> levels;
+    glm::mat4 viewProjection;
+    bool hasDepth;
+    std::future<void> pending;
+
+    // Scratch of setupTriangles
+    std::vector<glm::vec4> clip;
+    std::vector<ScreenTriangle> projected;
+    std::vector<unsigned char> clean;
+    std::vector<unsigned int> sheet;
+    std::vector<std::pair<unsigned int, unsigned int> > order;
+    // One group at a time per band: the farthest depth a triangle reaches in each texel, whether a triangle
+    // covers its center and whether the outline crosses it
+    std::vector<float> farthest;
+    std::vector<float> centerCovered;
+    std::vector<unsigned char> onOutline;
+
+    // Welds vertices by position, so edges split only for their normals or texture coordinates still match
+    const Neighbors &findNeighbors(const Occluder &occluder)
+    {
+        Neighbors &neighbors = this->neighborCache[occluder.indices];
+        if(neighbors.positions == occluder.positions && neighbors.vertexCount == occluder.vertexCount &&
+           neighbors.indexCount == occluder.indexCount && !neighbors.across.empty())
+        {
+            return neighbors;
+        }
+        neighbors.positions = occluder.positions;
+        neighbors.vertexCount = occluder.vertexCount;
+        neighbors.indexCount = occluder.indexCount;
+
+        std::vector<unsigned int> order(occluder.vertexCount);
+        for (unsigned int i = 0; i < occluder.vertexCount; i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&occluder](unsigned int a, unsigned int b) {
+            return std::memcmp(occluder.positions + a * occluder.stride, occluder.positions + b * occluder.stride, sizeof(glm::vec3)) < 0;
+        });
+        std::vector<unsigned int> weld(occluder.vertexCount);
+        for (unsigned int i = 0; i < order.size(); i++)
+        {
+            bool same = i > 0 && std::memcmp(occluder.positions + order[i] * occluder.stride, occluder.positions + order[i - 1] * occluder.stride, sizeof(glm::vec3)) == 0;
+            weld[order[i]] = same ? weld[order[i - 1]] : order[i];
+        }
+
+        // Edges keyed by their welded ends, lower first
+        std::vector<std::pair<std::uint64_t, unsigned int> > edges;
+        edges.reserve(occluder.indexCount);
+        for (unsigned int i = 0; i < occluder.indexCount; i++)
+        {
+            std::uint64_t a = weld[occluder.indices[i]];
+            std::uint64_t b = weld[occluder.indices[i % 3 == 2 ? i - 2 : i + 1]];
+            edges.push_back(std::make_pair(a < b ? (a << 32) | b : (b << 32) | a, i));
+        }
+        std::sort(edges.begin(), edges.end());
+
+        neighbors.across.assign(occluder.indexCount, -1);
+        for (unsigned int i = 0; i < edges.size(); )
+        {
+            unsigned int end = i + 1;
+            while(end < edges.size() && edges[end].first == edges[i].first)
+            {
+                end++;
+            }
+            if(end - i == 2 && edges[i].first >> 32 != (edges[i].first & 0xffffffffu))
+            {
+                neighbors.across[edges[i].second] = edges[i + 1].second;
+                neighbors.across[edges[i + 1].second] = edges[i].second;
+            }
+            i = end;
+        }
+        return neighbors;
+    }
+
+    // Transforms the occluders, clips what crosses the near plane and groups the triangles by sheet
+    void setupTriangles(const glm::mat4 &viewProjection)
+    {
+        this->triangles.clear();
+        this->groups.clear();
+
+        for (unsigned int i = 0; i < this->occluders.size(); i++)
+        {
+            const Occluder &occluder = this->occluders[i];
+            glm::mat4 transform = viewProjection * occluder.model;
+
+            this->clip.resize(occluder.vertexCount);
+            for (unsigned int j = 0; j < occluder.vertexCount; j++)
+            {
+                const glm::vec3 &position = *reinterpret_cast<const glm::vec3*>(occluder.positions + j * occluder.stride);
+                this->clip[j] = transform * glm::vec4(position, 1.0f);
+            }
+
+            // Triangles entirely in front of the near plane project as they are
+            unsigned int triangleCount = occluder.indexCount / 3;
+            this->projected.resize(triangleCount);
+            this->clean.assign(triangleCount, 0);
+            for (unsigned int t = 0; t < triangleCount; t++)
+            {
+                const unsigned int *index = occluder.indices + t * 3;
+                const glm::vec4 &a = this->clip[index[0]], &b = this->clip[index[1]], &c = this->clip[index[2]];
+                if(a.z >= -a.w && b.z >= -b.w && c.z >= -c.w)
+                {
+                    this->clean[t] = Project(a, b, c, this->projected[t]);
+                }
+            }
+
+            // Triangles joined across edges that aren't outline form one sheet
+            this->sheet.resize(triangleCount);
+            for (unsigned int t = 0; t < triangleCount; t++)
+            {
+                this->sheet[t] = t;
+            }
+
+            for (unsigned int t = 0; t < triangleCount; t++)
+            {
+                if(!this->clean[t])
+                {
+                    continue;
+                }
+
+                ScreenTriangle &triangle = this->projected[t];
+                float area = SignedArea(triangle);
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    // Not outline when the triangle across faces the same way and lies on the other side of the edge
+                    int across = occluder.neighbors->across[t * 3 + k];
+                    bool inner = false;
+                    if(across >= 0 && this->clean[across / 3])
+                    {
+                        const ScreenTriangle &other = this->projected[across / 3];
+                        unsigned int j = (k + 1) % 3;
+                        float ex = triangle.x[j] - triangle.x[k];
+                        float ey = triangle.y[j] - triangle.y[k];
+                        unsigned int opposite = (k + 2) % 3;
+                        unsigned int otherOpposite = (across % 3 + 2) % 3;
+                        float side = ex * (triangle.y[opposite] - triangle.y[k]) - ey * (triangle.x[opposite] - triangle.x[k]);
+                        float otherSide = ex * (other.y[otherOpposite] - triangle.y[k]) - ey * (other.x[otherOpposite] - triangle.x[k]);
+                        inner = (SignedArea(other) > 0.0f) == (area > 0.0f) && side * otherSide < 0.0f;
+                    }
+
+                    if(inner)
+                    {
+                        this->sheet[this->findSheet(t)] = this->findSheet(across / 3);
+                    }
+                    else
+                    {
+                        triangle.outline |= 1u << k;
+                    }
+                }
+            }
+
+            this->order.clear();
+            for (unsigned int t = 0; t < triangleCount; t++)
+            {
+                if(this->clean[t])
+                {
+                    this->order.push_back(std::make_pair(this->findSheet(t), t));
+                }
+            }
+            std::sort(this->order.begin(), this->order.end());
+            for (unsigned int i = 0; i < this->order.size(); i++)
+            {
+                if(i > 0 && this->order[i].first != this->order[i - 1].first)
+                {
+                    this->closeGroup();
+                }
+                this->triangles.push_back(this->projected[this->order[i].second]);
+            }
+            this->closeGroup();
+
+            // Near clipped triangles are sheets of their own, and every edge is outline, also the ones the clip added
+            for (unsigned int t = 0; t < triangleCount; t++)
+            {
+                if(this->clean[t])
+                {
+                    continue;
+                }
+
+                const unsigned int *index = occluder.indices + t * 3;
+                glm::vec4 polygon[4];
+                unsigned int count = ClipNear(this->clip[index[0]], this->clip[index[1]], this->clip[index[2]], polygon);
+                for (unsigned int k = 1; k + 1 < count; k++)
+                {
+                    ScreenTriangle triangle;
+                    if(Project(polygon[0], polygon[k], polygon[k + 1], triangle))
+                    {
+                        triangle.outline = 7;
+                        this->triangles.push_back(triangle);
+                    }
+                }
+                this->closeGroup();
+            }
+        }
+    }
+
+    unsigned int findSheet(unsigned int triangle)
+    {
+        while(this->sheet[triangle] != triangle)
+        {
+            this->sheet[triangle] = this->sheet[this->sheet[triangle]];
+            triangle = this->sheet[triangle];
+        }
+        return triangle;
+    }
+
+    // Screen position of a triangle, false when it is degenerate or not in front of the eye. Its edges start
+    // out not being outline
+    static bool Project(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c, ScreenTriangle &triangle)
+    {
+        const glm::vec4 *vertices[3] = { &a, &b, &c };
+        float minY = FLT_MAX, maxY = -FLT_MAX;
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4 &v = *vertices[i];
+            if(v.w <= 0.0f)
+            {
+                return false;
+            }
+
+            float inverse = 1.0f / v.w;
+            triangle.x[i] = (v.x * inverse * 0.5f + 0.5f) * WIDTH;
+            triangle.y[i] = (v.y * inverse * 0.5f + 0.5f) * HEIGHT;
+            triangle.z[i] = v.z * inverse;
+            minY = std::min(minY, triangle.y[i]);
+            maxY = std::max(maxY, triangle.y[i]);
+        }
+
+        // Every row it touches
+        triangle.minY = std::max(0.0f, std::floor(minY)) < HEIGHT ? (int)std::max(0.0f, std::floor(minY)) : HEIGHT;
+        triangle.maxY = std::min((float)HEIGHT - 1, std::floor(maxY)) >= 0.0f ? (int)std::min((float)HEIGHT - 1, std::floor(maxY)) : -1;
+        triangle.outline = 0;
+        return triangle.minY <= triangle.maxY && SignedArea(triangle) != 0.0f;
+    }
+
+    static float SignedArea(const ScreenTriangle &tri)
+    {
+        return (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+    }
+
+    // Makes the triangles added since the last group one more group
+    void closeGroup()
+    {
+        TriangleGroup group;
+        group.first = this->groups.empty() ? 0 : this->groups.back().first + this->groups.back().count;
+        group.count = this->triangles.size() - group.first;
+        if(group.count == 0)
+        {
+            return;
+        }
+
+        float minX = FLT_MAX, maxX = -FLT_MAX;
+        group.minY = HEIGHT;
+        group.maxY = -1;
+        for (unsigned int i = group.first; i < this->triangles.size(); i++)
+        {
+            const ScreenTriangle &triangle = this->triangles[i];
+            minX = std::min(minX, std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2])));
+            maxX = std::max(maxX, std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2])));
+            group.minY = std::min(group.minY, triangle.minY);
+            group.maxY = std::max(group.maxY, triangle.maxY);
+        }
+        group.minX = (int)std::max(0.0f, std::min((float)WIDTH - 1, std::floor(minX)));
+        group.maxX = (int)std::max(0.0f, std::min((float)WIDTH - 1, std::floor(maxX)));
+        this->groups.push_back(group);
+    }
+
+    // Sutherland-Hodgman against z >= -w. A triangle becomes at most a quad
+    static unsigned int ClipNear(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c, glm::vec4 *out)
+    {
+        const glm::vec4 *input[3] = { &a, &b, &c };
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            const glm::vec4 &p = *input[i];
+            const glm::vec4 &q = *input[(i + 1) % 3];
+            float dp = p.z + p.w;
+            float dq = q.z + q.w;
+
+            if(dp >= 0.0f)
+            {
+                out[count++] = p;
+            }
+            if((dp >= 0.0f) != (dq >= 0.0f))
+            {
+                out[count++] = p + (q - p) * (dp / (dp - dq));
+            }
+        }
+        return count;
+    }
+
+    // Rasterizes every group over the rows [first, first + BAND_HEIGHT) and keeps, in each texel it covers
+    // completely, the nearest of the groups' depths
+    void rasterizeBand(int first)
+    {
+        int last = first + BAND_HEIGHT - 1;
+        std::vector<float> &depth = this->levels[0].depth;
+
+        for (unsigned int g = 0; g < this->groups.size(); g++)
+        {
+            const TriangleGroup &group = this->groups[g];
+            int y0 = std::max(first, group.minY);
+            int y1 = std::min(last, group.maxY);
+            if(y0 > y1)
+            {
+                continue;
+            }
+
+            int x0 = group.minX & ~3;
+            for (int y = y0; y <= y1; y++)
+            {
+                std::fill(&this->farthest[y * WIDTH + x0], &this->farthest[y * WIDTH + group.maxX + 1], -FLT_MAX);
+                std::fill(&this->centerCovered[y * WIDTH + x0], &this->centerCovered[y * WIDTH + group.maxX + 1], 0.0f);
+                std::fill(&this->onOutline[y * WIDTH + x0], &this->onOutline[y * WIDTH + group.maxX + 1], 0);
+            }
+
+            for (unsigned int t = group.first; t < group.first + group.count; t++)
+            {
+                const ScreenTriangle &tri = this->triangles[t];
+                if(tri.maxY < y0 || tri.minY > y1)
+                {
+                    continue;
+                }
+                this->rasterizeTriangle(tri, y0, y1);
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    if(tri.outline & (1u << k))
+                    {
+                        unsigned int j = (k + 1) % 3;
+                        this->markOutline(tri.x[k], tri.y[k], tri.x[j], tri.y[j], y0, y1);
+                    }
+                }
+            }
+
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = group.minX; x <= group.maxX; x++)
+                {
+                    int texel = y * WIDTH + x;
+                    if(this->centerCovered[texel] != 0.0f && !this->onOutline[texel])
+                    {
+                        depth[texel] = std::min(depth[texel], this->farthest[texel]);
+                    }
+                }
+            }
+        }
+    }
+
+    // For every texel of the rows [y0, y1] the triangle may overlap, raises farthest to the largest depth of
+    // its plane over the texel, and flags centerCovered when the texel center is inside
+    void rasterizeTriangle(const ScreenTriangle &tri, int y0, int y1)
+    {
+        float area = SignedArea(tri);
+
+        // Edge i runs from vertex i to the next; inside is where all three are >= 0 for either winding.
+        // Adding half of |A| + |B| moves the test to the texel corner farthest inside the edge
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        float A[3], B[3], C[3], slack[3];
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            A[i] = (tri.y[i] - tri.y[j]) * sign;
+            B[i] = (tri.x[j] - tri.x[i]) * sign;
+            C[i] = (tri.x[i] * tri.y[j] - tri.x[j] * tri.y[i]) * sign;
+            slack[i] = 0.5f * (std::fabs(A[i]) + std::fabs(B[i]));
+        }
+
+        // Depth plane z = z0 + dzdx * x + dzdy * y, largest over a texel at its center plus zSlack. Never
+        // beyond the triangle's own farthest vertex
+        float dzdx = ((tri.z[1] - tri.z[0]) * (tri.y[2] - tri.y[0]) - (tri.z[2] - tri.z[0]) * (tri.y[1] - tri.y[0])) / area;
+        float dzdy = ((tri.z[2] - tri.z[0]) * (tri.x[1] - tri.x[0]) - (tri.z[1] - tri.z[0]) * (tri.x[2] - tri.x[0])) / area;
+        float z0 = tri.z[0] - dzdx * tri.x[0] - dzdy * tri.y[0];
+        float zSlack = 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+        float maxZ = std::max(tri.z[0], std::max(tri.z[1], tri.z[2]));
+
+        float minX = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+        float maxX = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+        int x0 = (int)std::max(0.0f, std::min((float)WIDTH - 1, std::floor(minX))) & ~3;
+        int x1 = (int)std::max(0.0f, std::min((float)WIDTH - 1, std::floor(maxX)));
+        y0 = std::max(y0, tri.minY);
+        y1 = std::min(y1, tri.maxY);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            float py = y + 0.5f;
+            float *far = &this->farthest[y * WIDTH];
+            float *covered = &this->centerCovered[y * WIDTH];
+
+#ifdef OCCLUSION_CULLING_SSE
+            __m128 rowE0 = _mm_set1_ps(B[0] * py + C[0]);
+            __m128 rowE1 = _mm_set1_ps(B[1] * py + C[1]);
+            __m128 rowE2 = _mm_set1_ps(B[2] * py + C[2]);
+            __m128 slack0 = _mm_set1_ps(slack[0]), slack1 = _mm_set1_ps(slack[1]), slack2 = _mm_set1_ps(slack[2]);
+            __m128 rowZ = _mm_set1_ps(z0 + dzdy * py + zSlack);
+            __m128 a0 = _mm_set1_ps(A[0]), a1 = _mm_set1_ps(A[1]), a2 = _mm_set1_ps(A[2]);
+            __m128 dz = _mm_set1_ps(dzdx);
+            __m128 limit = _mm_set1_ps(maxZ);
+            __m128 lowest = _mm_set1_ps(-FLT_MAX);
+            __m128 one = _mm_set1_ps(1.0f);
+            __m128 zero = _mm_setzero_ps();
+
+            for (int x = x0; x <= x1; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), rowE0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), rowE1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), rowE2);
+                __m128 touches = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(e0, slack0), zero), _mm_cmpge_ps(_mm_add_ps(e1, slack1), zero)),
+                                            _mm_cmpge_ps(_mm_add_ps(e2, slack2), zero));
+                if(_mm_movemask_ps(touches) == 0)
+                {
+                    continue;
+                }
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+                __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(dz, px), rowZ), limit);
+                z = _mm_or_ps(_mm_and_ps(touches, z), _mm_andnot_ps(touches, lowest));
+                _mm_storeu_ps(far + x, _mm_max_ps(_mm_loadu_ps(far + x), z));
+                _mm_storeu_ps(covered + x, _mm_or_ps(_mm_loadu_ps(covered + x), _mm_and_ps(inside, one)));
+            }
+#else
+            for (int x = x0; x <= x1; x++)
+            {
+                float px = x + 0.5f;
+                float e[3];
+                bool touches = true, inside = true;
+                for (int i = 0; i < 3; i++)
+                {
+                    e[i] = A[i] * px + (B[i] * py + C[i]);
+                    touches = touches && e[i] + slack[i] >= 0.0f;
+                    inside = inside && e[i] >= 0.0f;
+                }
+                if(touches)
+                {
+                    far[x] = std::max(far[x], std::min(dzdx * px + (z0 + dzdy * py + zSlack), maxZ));
+                    covered[x] = inside ? 1.0f : covered[x];
+                }
+            }
+#endif
+        }
+    }
+
+    // Flags every texel of the rows [y0, y1] the segment touches, erring a little towards more
+    void markOutline(float xa, float ya, float xb, float yb, int y0, int y1)
+    {
+        const float EPSILON = 1e-3f;
+        int first = std::max(y0, (int)std::floor(std::min(ya, yb) - EPSILON));
+        int last = std::min(y1, (int)std::floor(std::max(ya, yb) + EPSILON));
+        float dy = yb - ya;
+
+        for (int y = first; y <= last; y++)
+        {
+            // Part of the segment within the row
+            float t0 = 0.0f, t1 = 1.0f;
+            if(std::fabs(dy) > 1e-6f)
+            {
+                t0 = (y - EPSILON - ya) / dy;
+                t1 = (y + 1 + EPSILON - ya) / dy;
+                if(t0 > t1)
+                {
+                    std::swap(t0, t1);
+                }
+                t0 = std::max(t0, 0.0f);
+                t1 = std::min(t1, 1.0f);
+                if(t0 > t1)
+                {
+                    continue;
+                }
+            }
+
+            float xStart = xa + (xb - xa) * t0;
+            float xEnd = xa + (xb - xa) * t1;
+            int left = (int)std::max(0.0f, std::floor(std::min(xStart, xEnd) - EPSILON));
+            int right = (int)std::min((float)WIDTH - 1, std::floor(std::max(xStart, xEnd) + EPSILON));
+            if(left <= right)
+            {
+                std::fill(&this->onOutline[y * WIDTH + left], &this->onOutline[y * WIDTH + right + 1], 1);
+            }
+        }
+    }
+
+    // Every texel keeps the farthest of the 2x2 below it
+    void buildPyramid()
+    {
+        for (unsigned int i = 1; i < this->levels.size(); i++)
+        {
+            const Level &source = this->levels[i - 1];
+            Level &target = this->levels[i];
+
+            for (int y = 0; y < target.height; y++)
+            {
+                const float *top = &source.depth[(y * 2) * source.width];
+                const float *bottom = top + source.width;
+                float *out = &target.depth[y * target.width];
+                int x = 0;
+
+#ifdef OCCLUSION_CULLING_SSE
+                for (; x + 4 <= target.width; x += 4)
+                {
+                    __m128 left = _mm_max_ps(_mm_loadu_ps(top + x * 2), _mm_loadu_ps(bottom + x * 2));
+                    __m128 right = _mm_max_ps(_mm_loadu_ps(top + x * 2 + 4), _mm_loadu_ps(bottom + x * 2 + 4));
+                    __m128 even = _mm_shuffle_ps(left, right, _MM_SHUFFLE(2, 0, 2, 0));
+                    __m128 odd = _mm_shuffle_ps(left, right, _MM_SHUFFLE(3, 1, 3, 1));
+                    _mm_storeu_ps(out + x, _mm_max_ps(even, odd));
+                }
+#endif
+                for (; x < target.width; x++)
+                {
+                    out[x] = std::max(std::max(top[x * 2], top[x * 2 + 1]), std::max(bottom[x * 2], bottom[x * 2 + 1]));
+                }
+            }
+        }
+    }
+};
+
+#endif // OCCLUSION_CULLING_H
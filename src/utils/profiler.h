@@ -0,0 +1,390 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+#include "glad/glad.h"
+
+// One timed scope. Names are string literals, never copied
+struct ProfileSample {
+    const char *name;
+    std::uint64_t begin;        // Microseconds since the profiler started
+    std::uint64_t duration;     // Microseconds
+    unsigned int thread;        // 0 is the GPU
+    unsigned int frame;
+};
+
+// Fixed size ring that any thread can push to without locking. A writer claims a slot with one atomic
+// increment and publishes it by storing the slot's sequence number last; the reader skips slots whose
+// sequence doesn't match, i.e. ones still being written or already overwritten by a later lap. The
+// sample itself is stored as relaxed atomic words, since a reader may copy a slot a writer is filling
+template<size_t N>
+class SampleRing
+{
+public:
+    SampleRing()
+        : head(0), tail(0)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            this->slots[i].sequence.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void push(const ProfileSample &sample)
+    {
+        std::uint64_t index = this->head.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = this->slots[index % N];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.words[0].store(reinterpret_cast<std::uintptr_t>(sample.name), std::memory_order_relaxed);
+        slot.words[1].store(sample.begin, std::memory_order_relaxed);
+        slot.words[2].store(sample.duration, std::memory_order_relaxed);
+        slot.words[3].store(std::uint64_t(sample.thread) << 32 | sample.frame, std::memory_order_relaxed);
+        slot.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    // Moves everything pushed since the last drain into out, returns how many samples were lost
+    size_t drain(std::vector<ProfileSample> &out)
+    {
+        std::uint64_t end = this->head.load(std::memory_order_acquire);
+        std::uint64_t begin = end - this->tail > N ? end - N : this->tail;
+        size_t lost = begin - this->tail;
+
+        for (std::uint64_t index = begin; index < end; index++)
+        {
+            const Slot &slot = this->slots[index % N];
+            if(slot.sequence.load(std::memory_order_acquire) != index + 1)
+            {
+                lost++;
+                continue;
+            }
+
+            ProfileSample sample;
+            sample.name = reinterpret_cast<const char*>(static_cast<std::uintptr_t>(slot.words[0].load(std::memory_order_relaxed)));
+            sample.begin = slot.words[1].load(std::memory_order_relaxed);
+            sample.duration = slot.words[2].load(std::memory_order_relaxed);
+            std::uint64_t threadFrame = slot.words[3].load(std::memory_order_relaxed);
+            sample.thread = static_cast<unsigned int>(threadFrame >> 32);
+            sample.frame = static_cast<unsigned int>(threadFrame);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.sequence.load(std::memory_order_relaxed) != index + 1)
+            {
+                lost++;
+                continue;
+            }
+            out.push_back(sample);
+        }
+
+        this->tail = end;
+        return lost;
+    }
+
+private:
+    struct Slot {
+        std::atomic<std::uint64_t> sequence;
+        // Name, begin, duration, then thread and frame packed into one
+        std::atomic<std::uint64_t> words[4];
+    };
+
+    std::atomic<std::uint64_t> head;
+    std::uint64_t tail;
+    Slot slots[N];
+};
+
+// Frame profiler. CPU scopes come from any thread, GPU scopes from the thread owning the GL context.
+// Nothing is recorded until capture() is called; the requested number of frames is then written as a
+// Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+// GPU scopes are pairs of GL_TIMESTAMP queries rather than GL_TIME_ELAPSED ones so they may nest
+// (a pass inside the frame). Each frame in flight has its own query set, read back FRAME_LATENCY frames
+// later when the results are long available, so profiling doesn't stall the pipeline
+class Profiler
+{
+public:
+    static const unsigned int FRAME_LATENCY = 3;
+    static const unsigned int MAX_GPU_SCOPES = 64;      // Per frame, extra scopes are not timed
+    static const size_t RING_SIZE = 1 << 16;
+
+    Profiler()
+        : start(std::chrono::steady_clock::now()), capturing(false), frameIndex(0),
+          requestedFrames(0), remainingFrames(0), frameBegin(0), queriesCreated(false)
+    {
+        for (unsigned int i = 0; i < FRAME_LATENCY; i++)
+        {
+            this->gpuFrames[i].count = 0;
+            this->gpuFrames[i].pending = false;
+        }
+    }
+
+    static Profiler &global()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // Records the next frames and writes them to path. Ignored while a capture is running
+    void capture(unsigned int frames, const std::string &path)
+    {
+        if(frames == 0 || this->requestedFrames > 0 || this->remainingFrames > 0)
+        {
+            return;
+        }
+
+        this->requestedFrames = frames;
+        this->tracePath = path;
+    }
+
+    bool isCapturing() const
+    {
+        return this->capturing.load(std::memory_order_relaxed);
+    }
+
+    // Microseconds since the profiler started
+    std::uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->start).count();
+    }
+
+    void beginFrame()
+    {
+        if(this->requestedFrames > 0)
+        {
+            this->createQueries();
+            this->remainingFrames = this->requestedFrames;
+            this->requestedFrames = 0;
+            this->samples.clear();
+            this->ring.drain(this->samples);
+            this->samples.clear();
+            this->capturing.store(true, std::memory_order_relaxed);
+            std::cout << "Profiler: capturing " << this->remainingFrames << " frames" << std::endl;
+        }
+
+        // The queries of this slot were issued FRAME_LATENCY frames ago
+        GpuFrame &gpu = this->gpuFrames[this->frameIndex % FRAME_LATENCY];
+        this->resolve(gpu);
+
+        if(!this->isCapturing())
+        {
+            return;
+        }
+
+        // Maps GPU timestamps onto the CPU timeline of this frame
+        GLint64 gpuNow;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpu.offset = (std::int64_t)this->now() - gpuNow / 1000;
+        gpu.frame = this->frameIndex;
+        gpu.count = 0;
+        gpu.pending = true;
+
+        this->frameBegin = this->now();
+    }
+
+    void endFrame()
+    {
+        unsigned int frame = this->frameIndex;
+        if(!this->isCapturing())
+        {
+            this->frameIndex++;
+            return;
+        }
+
+        this->record("Frame", this->frameBegin, this->now());
+        this->frameIndex++;
+        if(--this->remainingFrames > 0)
+        {
+            return;
+        }
+
+        this->capturing.store(false, std::memory_order_relaxed);
+        for (unsigned int i = 0; i < FRAME_LATENCY; i++)
+        {
+            this->resolve(this->gpuFrames[i]);
+        }
+
+        size_t lost = this->ring.drain(this->samples);
+        if(lost > 0)
+        {
+            std::cout << "Profiler: " << lost << " samples lost, ring too small" << std::endl;
+        }
+        this->writeTrace();
+        std::cout << "Profiler: wrote " << this->samples.size() << " samples up to frame " << frame
+                  << " to " << this->tracePath << std::endl;
+        this->samples.clear();
+    }
+
+    // CPU scope that ran from begin to end on the calling thread
+    void record(const char *name, std::uint64_t begin, std::uint64_t end)
+    {
+        ProfileSample sample;
+        sample.name = name;
+        sample.begin = begin;
+        sample.duration = end - begin;
+        sample.thread = ThreadID();
+        sample.frame = this->frameIndex;
+        this->ring.push(sample);
+    }
+
+    // Starts a GPU scope, -1 when not capturing or out of queries
+    int beginGpu(const char *name)
+    {
+        GpuFrame &gpu = this->gpuFrames[this->frameIndex % FRAME_LATENCY];
+        if(!this->isCapturing() || gpu.count >= MAX_GPU_SCOPES)
+        {
+            return -1;
+        }
+
+        unsigned int scope = gpu.count++;
+        gpu.names[scope] = name;
+        glQueryCounter(gpu.queries[scope * 2], GL_TIMESTAMP);
+        return scope;
+    }
+
+    void endGpu(int scope)
+    {
+        if(scope < 0)
+        {
+            return;
+        }
+
+        GpuFrame &gpu = this->gpuFrames[this->frameIndex % FRAME_LATENCY];
+        glQueryCounter(gpu.queries[scope * 2 + 1], GL_TIMESTAMP);
+    }
+
+private:
+    struct GpuFrame {
+        unsigned int queries[MAX_GPU_SCOPES * 2];
+        const char *names[MAX_GPU_SCOPES];
+        unsigned int count;
+        unsigned int frame;
+        std::int64_t offset;        // CPU microseconds minus GPU microseconds
+        bool pending;
+    };
+
+    std::chrono::steady_clock::time_point start;
+    std::atomic<bool> capturing;
+    std::atomic<unsigned int> frameIndex;
+    unsigned int requestedFrames;
+    unsigned int remainingFrames;
+    std::string tracePath;
+    std::uint64_t frameBegin;
+
+    bool queriesCreated;
+    GpuFrame gpuFrames[FRAME_LATENCY];
+
+    SampleRing<RING_SIZE> ring;
+    std::vector<ProfileSample> samples;
+
+    // Small stable number per thread for the trace, the GPU being 0
+    static unsigned int ThreadID()
+    {
+        static std::atomic<unsigned int> next(1);
+        thread_local unsigned int id = next.fetch_add(1);
+        return id;
+    }
+
+    void createQueries()
+    {
+        if(this->queriesCreated)
+        {
+            return;
+        }
+
+        for (unsigned int i = 0; i < FRAME_LATENCY; i++)
+        {
+            glGenQueries(MAX_GPU_SCOPES * 2, this->gpuFrames[i].queries);
+        }
+        this->queriesCreated = true;
+    }
+
+    void resolve(GpuFrame &gpu)
+    {
+        if(!gpu.pending)
+        {
+            return;
+        }
+
+        for (unsigned int i = 0; i < gpu.count; i++)
+        {
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(gpu.queries[i * 2], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(gpu.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+
+            ProfileSample sample;
+            sample.name = gpu.names[i];
+            sample.begin = (std::uint64_t)((std::int64_t)(begin / 1000) + gpu.offset);
+            sample.duration = (end - begin) / 1000;
+            sample.thread = 0;
+            sample.frame = gpu.frame;
+            this->samples.push_back(sample);
+        }
+
+        gpu.count = 0;
+        gpu.pending = false;
+    }
+
+    void writeTrace() const
+    {
+        std::ofstream out(this->tracePath.c_str(), std::ios::trunc);
+        out << "{\"traceEvents\":[\n"
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        for (unsigned int i = 0; i < this->samples.size(); i++)
+        {
+            const ProfileSample &sample = this->samples[i];
+            out << ",\n{\"name\":\"" << sample.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << sample.thread
+                << ",\"ts\":" << sample.begin << ",\"dur\":" << sample.duration
+                << ",\"args\":{\"frame\":" << sample.frame << "}}";
+        }
+        out << "\n]}\n";
+
+        if(!out)
+        {
+            std::cout << "ERROR::PROFILER::WRITE_FAILED " << this->tracePath << std::endl;
+        }
+    }
+};
+
+// Times the enclosing block on the CPU, and on the GPU as well when gpu is set
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *name, bool gpu = false)
+        : name(name), gpuScope(-1), active(Profiler::global().isCapturing()), begin(0)
+    {
+        if(this->active)
+        {
+            this->begin = Profiler::global().now();
+            if(gpu)
+            {
+                this->gpuScope = Profiler::global().beginGpu(name);
+            }
+        }
+    }
+
+    ~ProfileScope()
+    {
+        if(this->active)
+        {
+            Profiler::global().endGpu(this->gpuScope);
+            Profiler::global().record(this->name, this->begin, Profiler::global().now());
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope &operator=(const ProfileScope&) = delete;
+
+private:
+    const char *name;
+    int gpuScope;
+    bool active;
+    std::uint64_t begin;
+};
+
+#endif // PROFILER_H
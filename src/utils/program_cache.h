@@ -0,0 +1,264 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "glad/glad.h"
+
+#include "hash.h"
+#include "mapped_file.h"
+
+struct ProgramCacheStats {
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int rejected;      // Binaries the driver refused, recompiled instead
+    double loadMs;              // Spent in glProgramBinary on hits
+    double compileMs;           // From request to usable program on misses
+
+    void print() const
+    {
+        std::cout << "Program cache: hits " << this->hits
+                  << " (" << this->loadMs << " ms)"
+                  << ", misses " << this->misses
+                  << " (" << this->compileMs << " ms compile and link)"
+                  << ", rejected " << this->rejected << std::endl;
+    }
+};
+
+// Header of a cached program binary. One file per program, named after the key
+struct ProgramBinaryHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t key;
+    std::uint32_t binaryFormat;
+    std::uint32_t length;
+};
+
+// Linked programs saved with glGetProgramBinary and restored with glProgramBinary on later runs.
+// Binaries are only valid for the driver that produced them, so the key covers the sources, the
+// defines and the GL vendor, renderer and version strings. A driver update changes the key; a binary
+// the driver rejects anyway is deleted and the caller recompiles
+class ProgramCache
+{
+public:
+    static const std::uint32_t VERSION = 1;
+
+    ProgramCache()
+        : directory("shader_cache"), enabled(true), supported(-1)
+    {
+        this->stats.hits = 0;
+        this->stats.misses = 0;
+        this->stats.rejected = 0;
+        this->stats.loadMs = 0.0;
+        this->stats.compileMs = 0.0;
+    }
+
+    static ProgramCache &global()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    void setDirectory(const std::string &path)
+    {
+        this->directory = path;
+    }
+
+    void setEnabled(bool enable)
+    {
+        this->enabled = enable;
+    }
+
+    // Needs ARB_get_program_binary (core in 4.1) and at least one binary format. Call with a current context
+    bool isEnabled()
+    {
+        if(this->supported < 0)
+        {
+            GLint formats = 0;
+            if(HasProgramBinary())
+            {
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            }
+            this->supported = formats > 0;
+        }
+        return this->enabled && this->supported == 1;
+    }
+
+    std::uint64_t key(const char *vertexSource, const char *fragmentSource, const std::string &defines)
+    {
+        if(this->driver.empty())
+        {
+            this->driver = GLString(GL_VENDOR) + "\n" + GLString(GL_RENDERER) + "\n" + GLString(GL_VERSION);
+        }
+
+        std::uint64_t hash = hashBytes(this->driver.data(), this->driver.size());
+        hash = hashBytes(defines.data(), defines.size() + 1, hash);
+        hash = hashBytes(vertexSource, std::strlen(vertexSource) + 1, hash);
+        return hashBytes(fragmentSource, std::strlen(fragmentSource), hash);
+    }
+
+    // Restores the program from its binary. False when there is none or the driver rejected it;
+    // the program is then unlinked and can be built from source as usual
+    bool load(std::uint64_t key, unsigned int program)
+    {
+        if(!this->isEnabled())
+        {
+            return false;
+        }
+
+        std::string path = this->pathFor(key);
+        MappedFile file(path);
+        if(!file.isOpen() || file.size < sizeof(ProgramBinaryHeader))
+        {
+            return false;
+        }
+
+        ProgramBinaryHeader header;
+        std::memcpy(&header, file.data, sizeof(header));
+        if(std::memcmp(header.magic, "AMPB", 4) != 0 || header.version != VERSION || header.key != key ||
+           sizeof(header) + std::uint64_t(header.length) > file.size)
+        {
+            this->reject(path);
+            return false;
+        }
+
+        glProgramBinary(program, header.binaryFormat, file.data + sizeof(header), header.length);
+
+        GLint success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            this->reject(path);
+            return false;
+        }
+        return true;
+    }
+
+    // Call before linking a program that will be stored
+    void prepare(unsigned int program)
+    {
+        if(this->isEnabled())
+        {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+    }
+
+    // Saves a linked program. Writes to a temporary file first so a crash never leaves a torn binary
+    void store(std::uint64_t key, unsigned int program)
+    {
+        if(!this->isEnabled())
+        {
+            return;
+        }
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0)
+        {
+            return;
+        }
+
+        ProgramBinaryHeader header;
+        std::memcpy(header.magic, "AMPB", 4);
+        header.version = VERSION;
+        header.key = key;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        glGetProgramBinary(program, length, &written, &format, binary.data());
+        header.binaryFormat = format;
+        header.length = written;
+
+        mkdir(this->directory.c_str(), 0755);
+        std::string path = this->pathFor(key);
+        std::string tmpPath = path + ".tmp";
+        std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), written);
+        out.close();
+
+        if(!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "ERROR::PROGRAM_CACHE::WRITE_FAILED " << path << std::endl;
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    void recordHit(double ms)
+    {
+        this->stats.hits++;
+        this->stats.loadMs += ms;
+    }
+
+    void recordMiss(double ms)
+    {
+        this->stats.misses++;
+        this->stats.compileMs += ms;
+    }
+
+    const ProgramCacheStats &getStats() const
+    {
+        return this->stats;
+    }
+
+private:
+    std::string directory;
+    bool enabled;
+    int supported;
+    std::string driver;
+    ProgramCacheStats stats;
+
+    static bool HasProgramBinary()
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        if(major > 4 || (major == 4 && minor >= 1))
+        {
+            return true;
+        }
+
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if(name && std::strcmp(name, "GL_ARB_get_program_binary") == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static std::string GLString(GLenum name)
+    {
+        const char *value = reinterpret_cast<const char*>(glGetString(name));
+        return value ? value : "";
+    }
+
+    std::string pathFor(std::uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return this->directory + "/" + name;
+    }
+
+    void reject(const std::string &path)
+    {
+        std::cout << "Program binary rejected, recompiling: " << path << std::endl;
+        std::remove(path.c_str());
+        this->stats.rejected++;
+    }
+};
+
+#endif // PROGRAM_CACHE_H
@@ -0,0 +1,445 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "shader.h"
+#include "mesh.h"
+#include "material.h"
+#include "gl_stats.h"
+#include "profiler.h"
+
+enum class RenderPass
+{
+    DEPTH = 0,      // Depth-only pre-pass, front to back
+    OPAQUE = 1
+};
+
+// Everything needed to submit one indexed draw
+struct DrawItem {
+    std::uint64_t key;
+
+    Shader *shader;
+    unsigned int VAO;
+    unsigned int indexType;
+    unsigned int indexCount;
+    const void *indexOffset;
+    int baseVertex;
+
+    const MaterialTable *materials;
+    unsigned int materialIndex;
+    const std::vector<Texture> *textures;
+    const std::vector<std::string> *samplerNames;
+
+    glm::mat4 model;
+    glm::vec3 positionScale;
+    glm::vec3 positionOffset;
+};
+
+// Collects the draws of a frame, sorts them by a 64-bit key and submits them with minimal state changes.
+//
+// Opaque key, most significant first:
+//   pass (2) | program (10) | material/texture state (20) | front-to-back depth (24) | unused (8)
+// Depth pre-pass key:
+//   pass (2) | front-to-back depth (24) | material/texture state (20) | unused (18)
+class RenderQueue
+{
+public:
+    struct Stats {
+        unsigned int items;
+        unsigned int submissions;
+        unsigned int binds;
+        unsigned int bindsSaved;
+    };
+
+    RenderQueue()
+        : depthShader(NULL), farPlane(100.0f), pendingItem(NULL)
+    {
+        this->resetStats();
+    }
+
+    // A non-null shader enables the depth-only pre-pass, NULL disables it
+    void setDepthPrepass(Shader *shader)
+    {
+        this->depthShader = shader;
+    }
+
+    bool hasDepthPrepass() const
+    {
+        return this->depthShader != NULL;
+    }
+
+    // Camera used for the depth part of the keys
+    void begin(const glm::mat4 &view, float farPlane)
+    {
+        this->view = view;
+        this->farPlane = farPlane;
+        this->items.clear();
+        this->resetStats();
+    }
+
+    // stateId groups draws sharing material and textures; center is in model space
+    void push(const DrawItem &item, unsigned int stateId, const glm::vec3 &center)
+    {
+        glm::vec4 viewPos = this->view * item.model * glm::vec4(center, 1.0f);
+        float depth = glm::clamp(-viewPos.z / this->farPlane, 0.0f, 1.0f);
+        std::uint64_t depthBits = (std::uint64_t)(depth * 16777215.0f);
+        std::uint64_t state = stateId & 0xfffffu;
+
+        if(this->depthShader)
+        {
+            DrawItem depthItem = item;
+            depthItem.shader = this->depthShader;
+            depthItem.key = ((std::uint64_t)RenderPass::DEPTH << 62) | (depthBits << 38) | (state << 18);
+            this->items.push_back(depthItem);
+        }
+
+        DrawItem opaque = item;
+        std::uint64_t program = item.shader->ID & 0x3ffu;
+        opaque.key = ((std::uint64_t)RenderPass::OPAQUE << 62) | (program << 52) | (state << 32) | (depthBits << 8);
+        this->items.push_back(opaque);
+    }
+
+    // Sorts and submits every queued item, then empties the queue
+    void flush()
+    {
+        this->stats.items = this->items.size();
+
+        this->order.resize(this->items.size());
+        for (unsigned int i = 0; i < this->items.size(); i++)
+        {
+            this->order[i].key = this->items[i].key;
+            this->order[i].index = i;
+        }
+        RadixSort(this->order, this->scratch);
+
+        this->current = BoundState();
+
+        // Items are sorted by pass, each pass is one contiguous run
+        unsigned int first = 0;
+        while(first < this->order.size())
+        {
+            RenderPass pass = (RenderPass)(this->items[this->order[first].index].key >> 62);
+            unsigned int last = first;
+            while(last < this->order.size() && (RenderPass)(this->items[this->order[last].index].key >> 62) == pass)
+            {
+                last++;
+            }
+
+            ProfileScope scope(pass == RenderPass::DEPTH ? "Depth pre-pass" : "Opaque pass", true);
+            this->beginPass(pass);
+
+            for (unsigned int i = first; i < last; i++)
+            {
+                const DrawItem &item = this->items[this->order[i].index];
+
+                if(!this->canMerge(item))
+                {
+                    this->submitPending();
+                    this->applyState(item, pass);
+                    this->pendingItem = &item;
+                }
+
+                this->counts.push_back(item.indexCount);
+                this->offsets.push_back(item.indexOffset);
+                this->baseVertices.push_back(item.baseVertex);
+            }
+            this->submitPending();
+
+            first = last;
+        }
+
+        // Back to the default state
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glBindVertexArray(0);
+
+        this->items.clear();
+    }
+
+    const Stats &getStats() const
+    {
+        return this->stats;
+    }
+
+    void printStats() const
+    {
+        std::cout << "Render queue: items " << this->stats.items
+                  << ", submissions " << this->stats.submissions
+                  << ", binds " << this->stats.binds
+                  << ", binds saved " << this->stats.bindsSaved << std::endl;
+    }
+
+    struct SortEntry {
+        std::uint64_t key;
+        unsigned int index;
+    };
+
+    // Stable LSD radix sort, 8 bits per pass. Passes where every key shares the byte are skipped
+    static void RadixSort(std::vector<SortEntry> &entries, std::vector<SortEntry> &scratch)
+    {
+        size_t count = entries.size();
+        if(count < 2)
+        {
+            return;
+        }
+        scratch.resize(count);
+
+        // All histograms in one read of the keys
+        unsigned int histograms[8][256] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            std::uint64_t key = entries[i].key;
+            for (int b = 0; b < 8; b++)
+            {
+                histograms[b][(key >> (b * 8)) & 0xff]++;
+            }
+        }
+
+        SortEntry *source = &entries[0];
+        SortEntry *destination = &scratch[0];
+        for (int b = 0; b < 8; b++)
+        {
+            unsigned int *histogram = histograms[b];
+            if(histogram[(source[0].key >> (b * 8)) & 0xff] == count)
+            {
+                continue;
+            }
+
+            unsigned int offset = 0;
+            for (int i = 0; i < 256; i++)
+            {
+                unsigned int n = histogram[i];
+                histogram[i] = offset;
+                offset += n;
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                destination[histogram[(source[i].key >> (b * 8)) & 0xff]++] = source[i];
+            }
+
+            SortEntry *swap = source;
+            source = destination;
+            destination = swap;
+        }
+
+        if(source != &entries[0])
+        {
+            entries.swap(scratch);
+        }
+    }
+
+private:
+    // Uniform handles of a shader, resolved on first use
+    struct ShaderHandles {
+        Uniform<glm::mat4> model;
+        Uniform<glm::vec3> positionScale;
+        Uniform<glm::vec3> positionOffset;
+    };
+
+    // What is currently bound, so unchanged state is skipped
+    struct BoundState {
+        BoundState()
+            : shader(NULL), VAO(0), materials(NULL), materialIndex(~0u), textures(NULL), hasModel(false), hasQuantization(false)
+        {
+        }
+
+        Shader *shader;
+        unsigned int VAO;
+        const MaterialTable *materials;
+        unsigned int materialIndex;
+        const std::vector<Texture> *textures;
+        bool hasModel;
+        glm::mat4 model;
+        bool hasQuantization;
+        glm::vec3 positionScale;
+        glm::vec3 positionOffset;
+    };
+
+    std::vector<DrawItem> items;
+    std::vector<SortEntry> order;
+    std::vector<SortEntry> scratch;
+    Shader *depthShader;
+    glm::mat4 view;
+    float farPlane;
+    Stats stats;
+
+    BoundState current;
+    const DrawItem *pendingItem;
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+    std::unordered_map<const Shader*, ShaderHandles> handles;
+
+    void resetStats()
+    {
+        this->stats.items = 0;
+        this->stats.submissions = 0;
+        this->stats.binds = 0;
+        this->stats.bindsSaved = 0;
+    }
+
+    void beginPass(RenderPass pass)
+    {
+        if(pass == RenderPass::DEPTH)
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+        }
+        else if(this->depthShader)
+        {
+            // Depth is already resolved, only the visible fragment of each pixel gets shaded
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthMask(GL_FALSE);
+            glDepthFunc(GL_LEQUAL);
+        }
+    }
+
+    const ShaderHandles &getHandles(Shader *shader)
+    {
+        std::unordered_map<const Shader*, ShaderHandles>::iterator it = this->handles.find(shader);
+        if(it == this->handles.end())
+        {
+            ShaderHandles h;
+            h.model = shader->getUniform<glm::mat4>("model");
+            h.positionScale = shader->getUniform<glm::vec3>("positionScale");
+            h.positionOffset = shader->getUniform<glm::vec3>("positionOffset");
+            it = this->handles.insert(std::make_pair(shader, h)).first;
+        }
+        return it->second;
+    }
+
+    // Consecutive items can share one multi-draw when nothing but the index range differs
+    bool canMerge(const DrawItem &item) const
+    {
+        if(this->counts.empty())
+        {
+            return false;
+        }
+
+        const DrawItem &pending = *this->pendingItem;
+        return pending.shader == item.shader && pending.VAO == item.VAO && pending.indexType == item.indexType &&
+               pending.materials == item.materials && pending.materialIndex == item.materialIndex &&
+               pending.textures == item.textures && pending.model == item.model &&
+               pending.positionScale == item.positionScale &&
+               pending.positionOffset == item.positionOffset;
+    }
+
+    void countBind(bool changed)
+    {
+        if(changed)
+        {
+            this->stats.binds++;
+        }
+        else
+        {
+            this->stats.bindsSaved++;
+        }
+    }
+
+    void applyState(const DrawItem &item, RenderPass pass)
+    {
+        bool changed = this->current.shader != item.shader;
+        if(changed)
+        {
+            item.shader->useProgram();
+            this->current.shader = item.shader;
+            // Uniforms are per program
+            this->current.hasModel = false;
+            this->current.hasQuantization = false;
+        }
+        this->countBind(changed);
+
+        changed = this->current.VAO != item.VAO;
+        if(changed)
+        {
+            glBindVertexArray(item.VAO);
+            this->current.VAO = item.VAO;
+        }
+        this->countBind(changed);
+
+        const ShaderHandles &h = this->getHandles(item.shader);
+
+        changed = !this->current.hasModel || this->current.model != item.model;
+        if(changed)
+        {
+            item.shader->set(h.model, item.model);
+            this->current.hasModel = true;
+            this->current.model = item.model;
+        }
+        this->countBind(changed);
+
+        changed = !this->current.hasQuantization ||
+                  this->current.positionScale != item.positionScale || this->current.positionOffset != item.positionOffset;
+        if(changed)
+        {
+            item.shader->set(h.positionScale, item.positionScale);
+            item.shader->set(h.positionOffset, item.positionOffset);
+            this->current.hasQuantization = true;
+            this->current.positionScale = item.positionScale;
+            this->current.positionOffset = item.positionOffset;
+        }
+        this->countBind(changed);
+
+        // The depth pass writes no color, materials and textures are irrelevant
+        if(pass == RenderPass::DEPTH)
+        {
+            return;
+        }
+
+        changed = this->current.materials != item.materials || this->current.materialIndex != item.materialIndex;
+        if(changed)
+        {
+            item.materials->bind(item.materialIndex);
+            this->current.materials = item.materials;
+            this->current.materialIndex = item.materialIndex;
+        }
+        this->countBind(changed);
+
+        changed = this->current.textures != item.textures;
+        if(changed)
+        {
+            BindTextures(*item.shader, *item.textures, *item.samplerNames);
+            this->current.textures = item.textures;
+        }
+        this->countBind(changed);
+    }
+
+    void submitPending()
+    {
+        if(this->counts.empty())
+        {
+            return;
+        }
+
+        const DrawItem &item = *this->pendingItem;
+
+        GLStats::frame().drawCalls++;
+        this->stats.submissions++;
+        if(this->counts.size() == 1)
+        {
+            glDrawElementsBaseVertex(GL_TRIANGLES, this->counts[0], item.indexType, const_cast<void*>(this->offsets[0]), this->baseVertices[0]);
+        }
+        else
+        {
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, this->counts.data(), item.indexType, this->offsets.data(),
+                                          this->counts.size(), const_cast<GLint*>(this->baseVertices.data()));
+        }
+
+        this->counts.clear();
+        this->offsets.clear();
+        this->baseVertices.clear();
+    }
+};
+
+#endif // RENDER_QUEUE_H
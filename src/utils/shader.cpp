@@ -1,45 +1,134 @@
 #include "shader.h"
 
+#include "program_cache.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Whether the driver compiles and links in the background and reports progress through GL_COMPLETION_STATUS_KHR
+static bool SupportsParallelCompile()
+{
+    static int supported = -1;
+    if(supported < 0)
+    {
+        supported = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if(name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+            {
+                supported = 1;
+            }
+        }
+    }
+    return supported == 1;
+}
+
+// Source with the defines placed right after its #version line, which must stay first
+static std::string InjectDefines(const char *source, const std::string &defines)
+{
+    std::string result(source);
+    if(defines.empty())
+    {
+        return result;
+    }
+
+    size_t line = result.find('\n');
+    result.insert(line == std::string::npos ? result.size() : line + 1, defines);
+    return result;
+}
+
 // Constructor
-Shader::Shader(const char *vertexSource, const char *fragmentSource)
+Shader::Shader(const char *vertexSource, const char *fragmentSource, const std::string &defines, bool async)
+    : vertex(0), fragment(0), ready(false), linked(false), buildStart(std::chrono::steady_clock::now())
+{
+    ProgramCache &cache = ProgramCache::global();
+
+    // 1. Try the binary linked by an earlier run
+    ID = glCreateProgram();
+    this->cacheKey = cache.key(vertexSource, fragmentSource, defines);
+    if(cache.load(this->cacheKey, ID))
+    {
+        cache.recordHit(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->buildStart).count());
+        this->ready = true;
+        this->linked = true;
+        this->reflect();
+        return;
+    }
+
+    // A rejected binary leaves the program unlinked, so it is built from source in place
+    this->compile(vertexSource, fragmentSource, defines);
+    if(!async || !SupportsParallelCompile())
+    {
+        this->finish();
+    }
+}
+
+bool Shader::isReady()
+{
+    if(this->ready)
+    {
+        return true;
+    }
+
+    GLint complete = 0;
+    glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+    if(complete)
+    {
+        this->finish();
+    }
+    return this->ready;
+}
+
+void Shader::compile(const char *vertexSource, const char *fragmentSource, const std::string &defines)
 {
     // 2. Compile shaders and create shader program
-    int success;
-    char infoLog[512];
+    std::string vertexCode = InjectDefines(vertexSource, defines);
+    std::string fragmentCode = InjectDefines(fragmentSource, defines);
+    const char *vertexString = vertexCode.c_str();
+    const char *fragmentString = fragmentCode.c_str();
 
     // Vertex Shader
-    unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vertexSource, NULL);
-    glCompileShader(vertex);
+    this->vertex = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(this->vertex, 1, &vertexString, NULL);
+    glCompileShader(this->vertex);
+
+    // Fragment Shader
+    this->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(this->fragment, 1, &fragmentString, NULL);
+    glCompileShader(this->fragment);
+
+    // Shader Program
+    ProgramCache::global().prepare(ID);
+    glAttachShader(ID, this->vertex);
+    glAttachShader(ID, this->fragment);
+    glLinkProgram(ID);
+    //glValidateProgram(ID);
+}
+
+void Shader::finish()
+{
+    int success;
+    char infoLog[512];
 
     // Print compile errors if any
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(this->vertex, GL_COMPILE_STATUS, &success);
     if(!success)
     {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
+        glGetShaderInfoLog(this->vertex, 512, NULL, infoLog);
         std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
     }
 
-    // Fragment Shader
-    unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fragmentSource, NULL);
-    glCompileShader(fragment);
-
-    // Print compile errors if any
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(this->fragment, GL_COMPILE_STATUS, &success);
     if(!success)
     {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
+        glGetShaderInfoLog(this->fragment, 512, NULL, infoLog);
         std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
     }
 
-    // Shader Program
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-    //glValidateProgram(ID);
-
     // Print linking errors if any
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if(!success)
@@ -50,8 +139,70 @@ Shader::Shader(const char *vertexSource, const char *fragmentSource)
 
     // 3. Delete shaders
     //    They are linked into our program and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    glDetachShader(ID, this->vertex);
+    glDetachShader(ID, this->fragment);
+    glDeleteShader(this->vertex);
+    glDeleteShader(this->fragment);
+    this->vertex = 0;
+    this->fragment = 0;
+
+    this->ready = true;
+    this->linked = success != 0;
+    if(this->linked)
+    {
+        ProgramCache::global().store(this->cacheKey, ID);
+    }
+    ProgramCache::global().recordMiss(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->buildStart).count());
+
+    // 4. Look up every uniform once, so nothing queries GL by name while rendering
+    if(this->linked)
+    {
+        this->reflect();
+    }
+}
+
+void Shader::reflect()
+{
+    char name[256];
+
+    int count = 0;
+    glGetProgramiv(Shader::ID, GL_ACTIVE_UNIFORMS, &count);
+    for (int i = 0; i < count; i++)
+    {
+        int length = 0;
+        UniformInfo info;
+        glGetActiveUniform(Shader::ID, i, sizeof(name), &length, &info.size, &info.type, name);
+
+        // Members of uniform blocks have no location
+        info.location = glGetUniformLocation(Shader::ID, name);
+        if(info.location < 0)
+        {
+            continue;
+        }
+
+        std::string uniformName(name, length);
+        this->uniforms[uniformName] = info;
+
+        // Arrays are reported as "name[0]", make them reachable as "name" too
+        if(uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+        {
+            this->uniforms[uniformName.substr(0, uniformName.size() - 3)] = info;
+        }
+    }
+
+    count = 0;
+    glGetProgramiv(Shader::ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (int i = 0; i < count; i++)
+    {
+        int length = 0;
+        glGetActiveUniformBlockName(Shader::ID, i, sizeof(name), &length, name);
+
+        UniformBlockInfo info;
+        info.index = i;
+        glGetActiveUniformBlockiv(Shader::ID, i, GL_UNIFORM_BLOCK_DATA_SIZE, &info.dataSize);
+
+        this->uniformBlocks[std::string(name, length)] = info;
+    }
 }
 
 // Use/activate the shader program
@@ -60,32 +211,109 @@ void Shader::useProgram()
     glUseProgram(Shader::ID);
 }
 
+// Typed handles
+void Shader::set(Uniform<bool> uniform, bool value) const
+{
+    GLStats::frame().uniformUploads++;
+    glUniform1i(uniform.location, (int)value);
+}
+
+void Shader::set(Uniform<int> uniform, int value) const
+{
+    GLStats::frame().uniformUploads++;
+    glUniform1i(uniform.location, value);
+}
+
+void Shader::set(Uniform<float> uniform, float value) const
+{
+    GLStats::frame().uniformUploads++;
+    glUniform1f(uniform.location, value);
+}
+
+void Shader::set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const
+{
+    GLStats::frame().uniformUploads++;
+    glUniform3fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const
+{
+    GLStats::frame().uniformUploads++;
+    glUniform4fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(Uniform<glm::mat4> uniform, const glm::mat4 &value) const
+{
+    GLStats::frame().uniformUploads++;
+    glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &value[0][0]);
+}
+
 // Utility uniform functions
 void Shader::setUniformBool(const std::string &name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(Shader::ID, name.c_str()), (int)value);
+    GLStats::frame().uniformUploads++;
+    glUniform1i(this->getUniformLocation(name), (int)value);
 }
 
 void Shader::setUniformInt(const std::string &name, int value) const
 {
-    glUniform1i(glGetUniformLocation(Shader::ID, name.c_str()), value);
+    GLStats::frame().uniformUploads++;
+    glUniform1i(this->getUniformLocation(name), value);
 }
 
 void Shader::setUniformFloat(const std::string &name, float value) const
 {
-    glUniform1f(glGetUniformLocation(Shader::ID, name.c_str()), value);
+    GLStats::frame().uniformUploads++;
+    glUniform1f(this->getUniformLocation(name), value);
 }
 
 void Shader::setUniformVec3(const std::string &name, const glm::vec3 &value) const
 {
-    glUniform3fv(glGetUniformLocation(Shader::ID, name.c_str()), 1, &value[0]);
+    GLStats::frame().uniformUploads++;
+    glUniform3fv(this->getUniformLocation(name), 1, &value[0]);
 }
 void Shader::setUniformVec3(const std::string &name, float x, float y, float z) const
 {
-    glUniform3f(glGetUniformLocation(Shader::ID, name.c_str()), x, y, z);
+    GLStats::frame().uniformUploads++;
+    glUniform3f(this->getUniformLocation(name), x, y, z);
 }
 
 void Shader::setUniformMatrixMat4(const std::string &name, const glm::mat4 &mat) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(Shader::ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    GLStats::frame().uniformUploads++;
+    glUniformMatrix4fv(this->getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+int Shader::getUniformLocation(const std::string &name) const
+{
+    GLStats::frame().uniformLookups++;
+    std::unordered_map<std::string, UniformInfo>::const_iterator it = this->uniforms.find(name);
+    if(it == this->uniforms.end())
+    {
+        return -1;
+    }
+    return it->second.location;
+}
+
+void Shader::bindUniformBlock(const std::string &name, unsigned int binding, int expectedSize) const
+{
+    std::unordered_map<std::string, UniformBlockInfo>::const_iterator it = this->uniformBlocks.find(name);
+    if(it == this->uniformBlocks.end())
+    {
+        std::cout << "ERROR::SHADER::UNIFORM_BLOCK_NOT_FOUND " << name << std::endl;
+        return;
+    }
+
+    if(expectedSize != 0 && it->second.dataSize != expectedSize)
+    {
+        std::cout << "ERROR::SHADER::UNIFORM_BLOCK_SIZE_MISMATCH " << name << " is " << it->second.dataSize
+                  << " bytes, expected " << expectedSize << std::endl;
+    }
+
+    glUniformBlockBinding(Shader::ID, it->second.index, binding);
+}
+
+bool Shader::hasUniformBlock(const std::string &name) const
+{
+    return this->uniformBlocks.find(name) != this->uniformBlocks.end();
 }
\ No newline at end of file
@@ -2,25 +2,109 @@
 #define SHADER_H
 
 #include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
 
 #include "glad/glad.h"
 #include "glm/glm.hpp"
 
+#include "gl_stats.h"
+
+// GL type a uniform must have to be set from a given C++ type
+template<typename T> struct UniformType;
+template<> struct UniformType<bool> { static bool matches(GLenum type) { return type == GL_BOOL; } };
+template<> struct UniformType<int> { static bool matches(GLenum type) { return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_BUFFER; } };
+template<> struct UniformType<float> { static bool matches(GLenum type) { return type == GL_FLOAT; } };
+template<> struct UniformType<glm::vec3> { static bool matches(GLenum type) { return type == GL_FLOAT_VEC3; } };
+template<> struct UniformType<glm::vec4> { static bool matches(GLenum type) { return type == GL_FLOAT_VEC4; } };
+template<> struct UniformType<glm::mat4> { static bool matches(GLenum type) { return type == GL_FLOAT_MAT4; } };
+
+// Typed handle to a uniform location, resolved once from the reflected program
+template<typename T>
+struct Uniform {
+    int location;
+
+    Uniform()
+        : location(-1)
+    {
+    }
+
+    bool isValid() const
+    {
+        return this->location >= 0;
+    }
+};
+
+// Reflected active uniform of the default block
+struct UniformInfo {
+    int location;
+    GLenum type;
+    int size;
+};
+
+// Reflected uniform block
+struct UniformBlockInfo {
+    unsigned int index;
+    int dataSize;
+};
+
 class Shader
 {
 public:
     // The program ID
     unsigned int ID;
 
-    // Constructor reads and builds the shader
-    Shader(const char *vertexSource, const char *fragmentSource);
+    // Constructor builds the program, from the ProgramCache when it holds a binary of it. defines are
+    // "#define" lines inserted after each #version line. With async the driver may compile in the
+    // background (KHR_parallel_shader_compile); the program is usable once isReady() returns true
+    Shader(const char *vertexSource, const char *fragmentSource, const std::string &defines = std::string(), bool async = false);
+
+    // Never waits on the driver. True once the program is built, whether or not it linked
+    bool isReady();
+
+    bool isLinked() const
+    {
+        return this->linked;
+    }
 
     // Use/activate the shader program
     void useProgram();
 
+    // Typed handle to a uniform, invalid (and ignored when set) if the program does not use it
+    template<typename T>
+    Uniform<T> getUniform(const std::string &name) const
+    {
+        GLStats::frame().uniformLookups++;
+        Uniform<T> handle;
+
+        std::unordered_map<std::string, UniformInfo>::const_iterator it = this->uniforms.find(name);
+        if(it == this->uniforms.end())
+        {
+            return handle;
+        }
+
+        if(!UniformType<T>::matches(it->second.type))
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH " << name << std::endl;
+            return handle;
+        }
+
+        handle.location = it->second.location;
+        return handle;
+    }
+
+    void set(Uniform<bool> uniform, bool value) const;
+    void set(Uniform<int> uniform, int value) const;
+    void set(Uniform<float> uniform, float value) const;
+    void set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const;
+    void set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const;
+    void set(Uniform<glm::mat4> uniform, const glm::mat4 &value) const;
+
     // Utility uniform function
     void setUniformBool(const std::string &name, bool value) const;
     void setUniformInt(const std::string &name, int value) const;
@@ -28,6 +112,36 @@ public:
     void setUniformVec3(const std::string &name, const glm::vec3 &value) const;
     void setUniformVec3(const std::string &name, float x, float y, float z) const;
     void setUniformMatrixMat4(const std::string &name, const glm::mat4 &mat) const;
+
+    // Location from the reflection tables, -1 if the program does not use it
+    int getUniformLocation(const std::string &name) const;
+
+    // Connects a uniform block to a uniform buffer binding point.
+    // A non-zero expectedSize is checked against the block size reported by the driver
+    void bindUniformBlock(const std::string &name, unsigned int binding, int expectedSize = 0) const;
+
+    bool hasUniformBlock(const std::string &name) const;
+
+private:
+    std::unordered_map<std::string, UniformInfo> uniforms;
+    std::unordered_map<std::string, UniformBlockInfo> uniformBlocks;
+
+    // Build state: the stages stay alive until the link result has been read
+    std::uint64_t cacheKey;
+    unsigned int vertex;
+    unsigned int fragment;
+    bool ready;
+    bool linked;
+    std::chrono::steady_clock::time_point buildStart;
+
+    // Issues compilation of both stages and the link into ID without reading any result
+    void compile(const char *vertexSource, const char *fragmentSource, const std::string &defines);
+
+    // Reads the compile and link results, which waits for the driver when it is still busy
+    void finish();
+
+    // Reads every active uniform and uniform block of the linked program
+    void reflect();
 };
 
-#endif // SHADER_H
\ No newline at end of file
+#endif // SHADER_H
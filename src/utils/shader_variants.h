@@ -0,0 +1,188 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <functional>
+
+#include "glm/glm.hpp"
+
+#include "shader.h"
+#include "mesh.h"
+#include "material.h"
+
+// Compile-time features of the main shader, each one a #define of the same name
+enum ShaderFeature
+{
+    SHADER_TEXTURED = 1 << 0,           // Samples texture_diffuse1
+    SHADER_SPECULAR = 1 << 1,           // Adds the specular term
+    SHADER_SPECULAR_MAP = 1 << 2,       // Scales it by texture_specular1
+    SHADER_INSTANCED = 1 << 3,          // Transform and tint come from the instance attributes
+    SHADER_COMPACT_VERTEX = 1 << 4,     // Normals are octahedral encoded
+    SHADER_CLUSTERED_LIGHTS = 1 << 5    // Adds the point lights of the fragment's cluster
+};
+
+// Names of the set features, each followed by separator
+inline std::string ShaderFeatureNames(unsigned int features, const std::string &prefix, const std::string &separator)
+{
+    static const char *names[] = { "TEXTURED", "SPECULAR", "SPECULAR_MAP", "INSTANCED", "COMPACT_VERTEX", "CLUSTERED_LIGHTS" };
+
+    std::string result;
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if(features & (1u << i))
+        {
+            result += prefix + names[i] + separator;
+        }
+    }
+    return result;
+}
+
+inline std::string ShaderDefines(unsigned int features)
+{
+    return ShaderFeatureNames(features, "#define ", "\n");
+}
+
+// What a mesh needs from the fragment shader, given its textures and material
+inline unsigned int MaterialFeatures(const std::vector<Texture> &textures, const Material &material)
+{
+    unsigned int features = 0;
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        if(textures[i].type == "texture_diffuse")
+        {
+            features |= SHADER_TEXTURED;
+        }
+        else if(textures[i].type == "texture_specular")
+        {
+            features |= SHADER_SPECULAR_MAP;
+        }
+    }
+
+    // A black specular color with no map to brighten it contributes nothing
+    if(material.specular != glm::vec3(0.0f) && material.shininess > 0.0f)
+    {
+        features |= SHADER_SPECULAR;
+    }
+    if(!(features & SHADER_SPECULAR))
+    {
+        features &= ~SHADER_SPECULAR_MAP;
+    }
+    return features;
+}
+
+// Permutations of one vertex and fragment source pair, built on first request only. Variants compile
+// asynchronously where the driver supports KHR_parallel_shader_compile; get() returns NULL until a variant
+// is ready, so the render loop never waits on the compiler and a mesh simply appears a few frames later
+class ShaderVariants
+{
+public:
+    ShaderVariants(const char *vertexSource, const char *fragmentSource)
+        : vertexSource(vertexSource), fragmentSource(fragmentSource), globalFeatures(0)
+    {
+    }
+
+    // Features added to every variant requested from now on, e.g. scene wide lighting
+    void setGlobalFeatures(unsigned int features)
+    {
+        this->globalFeatures = features;
+    }
+
+    // Runs once on every variant when it becomes ready, e.g. to bind uniform blocks
+    void setSetup(std::function<void(Shader&)> setup)
+    {
+        this->setup = setup;
+    }
+
+    // Starts building a variant without waiting for it
+    void request(unsigned int features)
+    {
+        features |= this->globalFeatures;
+        if(this->variants.find(features) != this->variants.end())
+        {
+            return;
+        }
+
+        Variant &variant = this->variants[features];
+        variant.shader.reset(new Shader(this->vertexSource, this->fragmentSource, ShaderDefines(features), true));
+        variant.ready = false;
+        this->poll(features, variant);
+    }
+
+    // The linked variant, NULL while it is still compiling or if it failed
+    Shader *get(unsigned int features)
+    {
+        features |= this->globalFeatures;
+        std::map<unsigned int, Variant>::iterator it = this->variants.find(features);
+        if(it == this->variants.end())
+        {
+            this->request(features);
+            it = this->variants.find(features);
+        }
+
+        Variant &variant = it->second;
+        if(!variant.ready && !this->poll(features, variant))
+        {
+            return NULL;
+        }
+        return variant.shader->isLinked() ? variant.shader.get() : NULL;
+    }
+
+    // Variants requested but not ready yet
+    unsigned int pending()
+    {
+        unsigned int count = 0;
+        for (std::map<unsigned int, Variant>::iterator it = this->variants.begin(); it != this->variants.end(); ++it)
+        {
+            if(!it->second.ready && !this->poll(it->first, it->second))
+            {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // Deletes the program of every variant. Call while the context is still current
+    void clear()
+    {
+        for (std::map<unsigned int, Variant>::iterator it = this->variants.begin(); it != this->variants.end(); ++it)
+        {
+            glDeleteProgram(it->second.shader->ID);
+        }
+        this->variants.clear();
+    }
+
+private:
+    struct Variant {
+        std::unique_ptr<Shader> shader;
+        bool ready;
+    };
+
+    const char *vertexSource;
+    const char *fragmentSource;
+    unsigned int globalFeatures;
+    std::function<void(Shader&)> setup;
+    std::map<unsigned int, Variant> variants;
+
+    bool poll(unsigned int features, Variant &variant)
+    {
+        if(!variant.shader->isReady())
+        {
+            return false;
+        }
+
+        variant.ready = true;
+        if(variant.shader->isLinked() && this->setup)
+        {
+            this->setup(*variant.shader);
+        }
+
+        std::cout << "Shader variant " << ShaderFeatureNames(features, "", " ") << (variant.shader->isLinked() ? "ready" : "failed") << std::endl;
+        return true;
+    }
+};
+
+#endif // SHADER_VARIANTS_H
@@ -0,0 +1,226 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <list>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+#include "glad/glad.h"
+#include "stb/stb_image.h"
+
+#include "hash.h"
+#include "asset_pack.h"
+#include "ktx.h"
+#include "texture_loader.h"
+
+struct TextureCacheStats {
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int evictions;
+    unsigned int textures;      // Textures currently held, referenced or not
+    size_t residentBytes;       // Estimated GPU memory of those, mip chains included
+
+    void print() const
+    {
+        std::cout << "Texture cache: hits " << this->hits
+                  << ", misses " << this->misses
+                  << ", evictions " << this->evictions
+                  << ", textures " << this->textures
+                  << ", resident " << this->residentBytes << " bytes" << std::endl;
+    }
+};
+
+// Process wide texture cache. Files are keyed by normalized path, and identical contents found
+// under different paths share one texture. Handles are reference counted: without a budget a texture
+// is deleted when its last user releases it; with one, unreferenced textures stay around for reuse
+// and the least recently used are evicted once the resident bytes exceed the budget
+class TextureCache
+{
+public:
+    TextureCache()
+        : budget(0)
+    {
+        this->stats.hits = 0;
+        this->stats.misses = 0;
+        this->stats.evictions = 0;
+        this->stats.textures = 0;
+        this->stats.residentBytes = 0;
+    }
+
+    static TextureCache &global()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // 0 disables the budget
+    void setBudget(size_t bytes)
+    {
+        this->budget = bytes;
+        this->evict();
+    }
+
+    // Texture name for the file, loaded through the TextureLoader on a miss. Pair with release()
+    unsigned int acquire(const std::string &path)
+    {
+        std::string normalized = NormalizePath(path);
+
+        std::unordered_map<std::string, std::uint64_t>::const_iterator known = this->paths.find(normalized);
+        if(known != this->paths.end())
+        {
+            return this->reference(this->entries.find(known->second)->second);
+        }
+
+        // Hashing the file is far cheaper than decoding it and catches copies under other names
+        AssetFile file(normalized);
+        std::uint64_t key = file.isOpen() ? hashBytes(file.data, file.size) : hashBytes(normalized.data(), normalized.size());
+
+        std::unordered_map<std::uint64_t, Entry>::iterator it = this->entries.find(key);
+        if(it != this->entries.end())
+        {
+            this->paths[normalized] = key;
+            it->second.paths.push_back(normalized);
+            return this->reference(it->second);
+        }
+
+        Entry entry;
+        entry.textureID = TextureLoader::global().request(normalized);
+        entry.references = 1;
+        entry.bytes = file.isOpen() ? EstimateBytes(normalized, file) : 0;
+        entry.paths.push_back(normalized);
+        entry.lru = this->unused.end();
+
+        this->byID[entry.textureID] = key;
+        this->paths[normalized] = key;
+        this->entries[key] = entry;
+
+        this->stats.misses++;
+        this->stats.textures++;
+        this->stats.residentBytes += entry.bytes;
+        this->evict();
+
+        return entry.textureID;
+    }
+
+    void release(unsigned int textureID)
+    {
+        std::unordered_map<unsigned int, std::uint64_t>::const_iterator id = this->byID.find(textureID);
+        if(id == this->byID.end())
+        {
+            std::cout << "ERROR::TEXTURE_CACHE::UNKNOWN_TEXTURE " << textureID << std::endl;
+            return;
+        }
+
+        Entry &entry = this->entries.find(id->second)->second;
+        if(--entry.references > 0)
+        {
+            return;
+        }
+
+        if(this->budget == 0)
+        {
+            this->destroy(id->second);
+            return;
+        }
+
+        this->unused.push_front(id->second);
+        entry.lru = this->unused.begin();
+        this->evict();
+    }
+
+    const TextureCacheStats &getStats() const
+    {
+        return this->stats;
+    }
+
+private:
+    struct Entry {
+        unsigned int textureID;
+        unsigned int references;
+        size_t bytes;
+        // Every normalized path that resolved to this content
+        std::vector<std::string> paths;
+        // Position in unused while nothing references the texture
+        std::list<std::uint64_t>::iterator lru;
+    };
+
+    size_t budget;
+    TextureCacheStats stats;
+    std::unordered_map<std::uint64_t, Entry> entries;
+    std::unordered_map<std::string, std::uint64_t> paths;
+    std::unordered_map<unsigned int, std::uint64_t> byID;
+    // Unreferenced textures, most recently released first
+    std::list<std::uint64_t> unused;
+
+    unsigned int reference(Entry &entry)
+    {
+        if(entry.references++ == 0)
+        {
+            this->unused.erase(entry.lru);
+            entry.lru = this->unused.end();
+        }
+
+        this->stats.hits++;
+        return entry.textureID;
+    }
+
+    void evict()
+    {
+        while(this->budget > 0 && this->stats.residentBytes > this->budget && !this->unused.empty())
+        {
+            std::uint64_t key = this->unused.back();
+            this->unused.pop_back();
+            this->destroy(key);
+            this->stats.evictions++;
+        }
+    }
+
+    void destroy(std::uint64_t key)
+    {
+        std::unordered_map<std::uint64_t, Entry>::iterator it = this->entries.find(key);
+        Entry &entry = it->second;
+
+        for (unsigned int i = 0; i < entry.paths.size(); i++)
+        {
+            this->paths.erase(entry.paths[i]);
+        }
+        this->byID.erase(entry.textureID);
+
+        TextureLoader::global().cancel(entry.textureID);
+        glDeleteTextures(1, &entry.textureID);
+
+        this->stats.textures--;
+        this->stats.residentBytes -= entry.bytes;
+        this->entries.erase(it);
+    }
+
+    // Size of the uploaded image from headers alone. A baked file is uploaded as it is stored;
+    // otherwise 8 bit channels plus a third for the mips
+    static size_t EstimateBytes(const std::string &path, const AssetFile &file)
+    {
+        AssetFile baked(BakedTexturePath(path));
+        KtxFile ktx;
+        if(baked.isOpen() && ReadKtx(baked.data, baked.size, ktx))
+        {
+            size_t bytes = 0;
+            for (unsigned int i = 0; i < ktx.levels.size(); i++)
+            {
+                bytes += ktx.levels[i].size;
+            }
+            return bytes;
+        }
+
+        int width, height, components;
+        if(!stbi_info_from_memory(file.data, file.size, &width, &height, &components))
+        {
+            return 0;
+        }
+        return size_t(width) * height * components * 4 / 3;
+    }
+};
+
+#endif // TEXTURE_CACHE_H
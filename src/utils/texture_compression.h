@@ -0,0 +1,448 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+
+// GL internal formats of the block compressed textures (EXT_texture_compression_s3tc)
+const unsigned int TEXTURE_FORMAT_BC1 = 0x83F0;     // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+const unsigned int TEXTURE_FORMAT_BC3 = 0x83F3;     // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+
+// 8 bit RGBA pixels, rows top to bottom
+struct ImageRGBA {
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+
+    ImageRGBA()
+        : width(0), height(0)
+    {
+    }
+
+    ImageRGBA(int width, int height)
+        : width(width), height(height), pixels(size_t(width) * height * 4, 0)
+    {
+    }
+
+    unsigned char *at(int x, int y)
+    {
+        return &this->pixels[(size_t(y) * this->width + x) * 4];
+    }
+
+    const unsigned char *at(int x, int y) const
+    {
+        return &this->pixels[(size_t(y) * this->width + x) * 4];
+    }
+
+    bool isOpaque() const
+    {
+        for (size_t i = 3; i < this->pixels.size(); i += 4)
+        {
+            if(this->pixels[i] != 255)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Next mip level: 2x2 box filter, odd sizes clamp at the last row and column
+inline ImageRGBA DownsampleImage(const ImageRGBA &image)
+{
+    ImageRGBA result(std::max(1, image.width / 2), std::max(1, image.height / 2));
+    for (int y = 0; y < result.height; y++)
+    {
+        int y0 = std::min(y * 2, image.height - 1);
+        int y1 = std::min(y * 2 + 1, image.height - 1);
+        for (int x = 0; x < result.width; x++)
+        {
+            int x0 = std::min(x * 2, image.width - 1);
+            int x1 = std::min(x * 2 + 1, image.width - 1);
+            for (int c = 0; c < 4; c++)
+            {
+                unsigned int sum = image.at(x0, y0)[c] + image.at(x1, y0)[c] + image.at(x0, y1)[c] + image.at(x1, y1)[c];
+                result.at(x, y)[c] = (sum + 2) / 4;
+            }
+        }
+    }
+    return result;
+}
+
+// Level 0 down to 1x1
+inline std::vector<ImageRGBA> BuildMipChain(const ImageRGBA &image)
+{
+    std::vector<ImageRGBA> levels(1, image);
+    while(levels.back().width > 1 || levels.back().height > 1)
+    {
+        levels.push_back(DownsampleImage(levels.back()));
+    }
+    return levels;
+}
+
+inline std::uint16_t PackRGB565(const float color[3])
+{
+    int r = std::min(31, std::max(0, int(color[0] * 31.0f / 255.0f + 0.5f)));
+    int g = std::min(63, std::max(0, int(color[1] * 63.0f / 255.0f + 0.5f)));
+    int b = std::min(31, std::max(0, int(color[2] * 31.0f / 255.0f + 0.5f)));
+    return std::uint16_t((r << 11) | (g << 5) | b);
+}
+
+inline void UnpackRGB565(std::uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// BC1 color block (8 bytes) of 16 RGBA pixels. Endpoints span the principal axis of the colors,
+// inset by 1/16 of the range; always the four color mode
+inline void EncodeColorBlock(const unsigned char block[64], unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            mean[c] += block[i * 4 + c] / 16.0f;
+        }
+    }
+
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        float r = block[i * 4] - mean[0];
+        float g = block[i * 4 + 1] - mean[1];
+        float b = block[i * 4 + 2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+
+    // Power iteration for the principal axis
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+        };
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if(length < 1e-6f)
+        {
+            break;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            axis[c] = next[c] / length;
+        }
+    }
+
+    float minimum = std::numeric_limits<float>::max();
+    float maximum = -std::numeric_limits<float>::max();
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            t += (block[i * 4 + c] - mean[c]) * axis[c];
+        }
+        minimum = std::min(minimum, t);
+        maximum = std::max(maximum, t);
+    }
+
+    float inset = (maximum - minimum) / 16.0f;
+    float end0[3], end1[3];
+    for (int c = 0; c < 3; c++)
+    {
+        end0[c] = mean[c] + axis[c] * (maximum - inset);
+        end1[c] = mean[c] + axis[c] * (minimum + inset);
+    }
+
+    std::uint16_t color0 = PackRGB565(end0);
+    std::uint16_t color1 = PackRGB565(end1);
+    if(color0 < color1)
+    {
+        std::swap(color0, color1);
+    }
+
+    std::uint32_t indices = 0;
+    if(color0 != color1)
+    {
+        int palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            int bestDistance = std::numeric_limits<int>::max();
+            for (int p = 0; p < 4; p++)
+            {
+                int distance = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    int d = block[i * 4 + c] - palette[p][c];
+                    distance += d * d;
+                }
+                if(distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= std::uint32_t(best) << (i * 2);
+        }
+    }
+
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++)
+    {
+        out[4 + i] = (indices >> (i * 8)) & 0xff;
+    }
+}
+
+inline void DecodeColorBlock(const unsigned char in[8], unsigned char block[64])
+{
+    std::uint16_t color0 = in[0] | (in[1] << 8);
+    std::uint16_t color1 = in[2] | (in[3] << 8);
+    std::uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (std::uint32_t(in[7]) << 24);
+
+    int palette[4][3];
+    UnpackRGB565(color0, palette[0]);
+    UnpackRGB565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        if(color0 > color1)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        int index = (indices >> (i * 2)) & 3;
+        for (int c = 0; c < 3; c++)
+        {
+            block[i * 4 + c] = palette[index][c];
+        }
+        block[i * 4 + 3] = color0 <= color1 && index == 3 ? 0 : 255;
+    }
+}
+
+// BC3 alpha block (8 bytes): two endpoints and eight interpolated steps
+inline void EncodeAlphaBlock(const unsigned char block[64], unsigned char out[8])
+{
+    int alpha0 = 0;
+    int alpha1 = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        alpha0 = std::max(alpha0, int(block[i * 4 + 3]));
+        alpha1 = std::min(alpha1, int(block[i * 4 + 3]));
+    }
+
+    std::uint64_t indices = 0;
+    if(alpha0 != alpha1)
+    {
+        int palette[8];
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+        for (int p = 1; p < 7; p++)
+        {
+            palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+        }
+
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            int bestDistance = 256;
+            for (int p = 0; p < 8; p++)
+            {
+                int distance = std::abs(int(block[i * 4 + 3]) - palette[p]);
+                if(distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= std::uint64_t(best) << (i * 3);
+        }
+    }
+
+    out[0] = alpha0;
+    out[1] = alpha1;
+    for (int i = 0; i < 6; i++)
+    {
+        out[2 + i] = (indices >> (i * 8)) & 0xff;
+    }
+}
+
+inline void DecodeAlphaBlock(const unsigned char in[8], unsigned char block[64])
+{
+    int palette[8];
+    palette[0] = in[0];
+    palette[1] = in[1];
+    if(palette[0] > palette[1])
+    {
+        for (int p = 1; p < 7; p++)
+        {
+            palette[p + 1] = ((7 - p) * palette[0] + p * palette[1]) / 7;
+        }
+    }
+    else
+    {
+        for (int p = 1; p < 5; p++)
+        {
+            palette[p + 1] = ((5 - p) * palette[0] + p * palette[1]) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    std::uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= std::uint64_t(in[2 + i]) << (i * 8);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        block[i * 4 + 3] = palette[(indices >> (i * 3)) & 7];
+    }
+}
+
+inline size_t BlockSize(unsigned int format)
+{
+    return format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+}
+
+inline size_t CompressedSize(unsigned int format, int width, int height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+}
+
+// Compresses block rows [firstRow, lastRow) into out, which holds CompressedSize bytes.
+// Rows are independent, so callers may split an image across threads
+inline void CompressBlockRows(const ImageRGBA &image, unsigned int format, int firstRow, int lastRow, unsigned char *out)
+{
+    int blocksWide = (image.width + 3) / 4;
+    size_t blockSize = BlockSize(format);
+
+    unsigned char block[64];
+    for (int by = firstRow; by < lastRow; by++)
+    {
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            // Edge blocks repeat the last row and column
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    const unsigned char *pixel = image.at(std::min(bx * 4 + x, image.width - 1), std::min(by * 4 + y, image.height - 1));
+                    std::copy(pixel, pixel + 4, &block[(y * 4 + x) * 4]);
+                }
+            }
+
+            unsigned char *target = out + (size_t(by) * blocksWide + bx) * blockSize;
+            if(format == TEXTURE_FORMAT_BC3)
+            {
+                EncodeAlphaBlock(block, target);
+                EncodeColorBlock(block, target + 8);
+            }
+            else
+            {
+                EncodeColorBlock(block, target);
+            }
+        }
+    }
+}
+
+inline std::vector<unsigned char> CompressImage(const ImageRGBA &image, unsigned int format)
+{
+    std::vector<unsigned char> out(CompressedSize(format, image.width, image.height));
+    CompressBlockRows(image, format, 0, (image.height + 3) / 4, out.data());
+    return out;
+}
+
+inline ImageRGBA DecompressImage(const unsigned char *data, unsigned int format, int width, int height)
+{
+    ImageRGBA image(width, height);
+    int blocksWide = (width + 3) / 4;
+    size_t blockSize = BlockSize(format);
+
+    unsigned char block[64];
+    for (int by = 0; by < (height + 3) / 4; by++)
+    {
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            const unsigned char *source = data + (size_t(by) * blocksWide + bx) * blockSize;
+            if(format == TEXTURE_FORMAT_BC3)
+            {
+                DecodeColorBlock(source + 8, block);
+                DecodeAlphaBlock(source, block);
+            }
+            else
+            {
+                DecodeColorBlock(source, block);
+            }
+
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+            {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                {
+                    std::copy(&block[(y * 4 + x) * 4], &block[(y * 4 + x) * 4 + 4], image.at(bx * 4 + x, by * 4 + y));
+                }
+            }
+        }
+    }
+    return image;
+}
+
+// Peak signal to noise ratio over the given channels, in dB. Infinity for identical images
+inline double ComputePSNR(const ImageRGBA &a, const ImageRGBA &b, int channels = 3)
+{
+    if(a.width != b.width || a.height != b.height || a.pixels.empty())
+    {
+        return 0.0;
+    }
+
+    double squaredError = 0.0;
+    for (size_t i = 0; i < a.pixels.size(); i += 4)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            double d = double(a.pixels[i + c]) - double(b.pixels[i + c]);
+            squaredError += d * d;
+        }
+    }
+
+    double mse = squaredError / (double(a.pixels.size() / 4) * channels);
+    if(mse == 0.0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+#endif // TEXTURE_COMPRESSION_H
@@ -0,0 +1,422 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "glad/glad.h"
+#include "stb/stb_image.h"
+
+#include "gl_stats.h"
+#include "thread_pool.h"
+#include "asset_pack.h"
+#include "ktx.h"
+#include "texture_compression.h"
+#include "profiler.h"
+
+// Streaming counters of the frame being recorded
+struct TextureLoaderStats {
+    unsigned int queueDepth;        // Textures requested but not resident yet
+    unsigned int texturesUploaded;
+    size_t bytesUploaded;
+
+    TextureLoaderStats()
+    {
+        this->reset();
+    }
+
+    void reset()
+    {
+        this->queueDepth = 0;
+        this->texturesUploaded = 0;
+        this->bytesUploaded = 0;
+    }
+
+    void print() const
+    {
+        std::cout << "Texture streaming: queued " << this->queueDepth
+                  << ", uploaded " << this->texturesUploaded
+                  << " (" << this->bytesUploaded << " bytes)" << std::endl;
+    }
+
+    static TextureLoaderStats &frame()
+    {
+        static TextureLoaderStats stats;
+        return stats;
+    }
+};
+
+// Whether the driver takes the BC1/BC3 files written by texbake
+inline bool SupportsS3TC()
+{
+    static int supported = -1;
+    if(supported < 0)
+    {
+        supported = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if(name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+            {
+                supported = 1;
+            }
+        }
+    }
+    return supported == 1;
+}
+
+// Decodes image files on the shared ThreadPool and uploads them a few per frame through a ring of
+// pixel buffer objects. A requested texture shows a one pixel placeholder until its data is resident;
+// the GL name never changes, so meshes can bind it right away. A baked <path>.ktx next to the image
+// is preferred and uploaded compressed with its precomputed mips
+class TextureLoader
+{
+public:
+    // Pixel buffers in the upload ring
+    static const unsigned int RING_SIZE = 3;
+
+    explicit TextureLoader(size_t frameBudget = 8 * 1024 * 1024)
+        : frameBudget(frameBudget), nextSlot(0), nextSerial(0), shared(std::make_shared<SharedState>())
+    {
+        for (unsigned int i = 0; i < RING_SIZE; i++)
+        {
+            this->ring[i].buffer = 0;
+            this->ring[i].size = 0;
+            this->ring[i].fence = 0;
+        }
+    }
+
+    // Loader used by the models
+    static TextureLoader &global()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    // Returns a texture name holding the placeholder and queues the file for decoding. Call on the GL thread
+    unsigned int request(const std::string &path)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+
+        // Neutral grey, so lit surfaces look plausible before their texture arrives
+        const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // GL may hand out a deleted name again, the serial tells the two requests apart
+        unsigned int serial = this->nextSerial++;
+        this->active[textureID] = serial;
+
+        std::shared_ptr<SharedState> state = this->shared;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->pending++;
+        }
+
+        bool compressed = SupportsS3TC();
+        ThreadPool::global().enqueue([state, textureID, serial, path, compressed]() {
+            ProfileScope scope("TextureLoader::decode");
+            DecodedImage image;
+            image.textureID = textureID;
+            image.serial = serial;
+            image.path = path;
+            image.pixels = NULL;
+            image.internalFormat = 0;
+            if(!compressed || !readBaked(BakedTexturePath(path), image))
+            {
+                // Decoded straight from the mapping, packed or loose
+                AssetFile file(path);
+                if(file.isOpen())
+                {
+                    image.pixels = stbi_load_from_memory(file.data, file.size, &image.width, &image.height, &image.components, 0);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->pending--;
+            state->decoded.push_back(image);
+        });
+
+        return textureID;
+    }
+
+    // Uploads decoded images until the frame budget is spent. Call once per frame on the GL thread
+    void update()
+    {
+        ProfileScope scope("TextureLoader::update", true);
+        TextureLoaderStats &stats = TextureLoaderStats::frame();
+        size_t bytes = 0;
+
+        for (;;)
+        {
+            DecodedImage image;
+            {
+                std::lock_guard<std::mutex> lock(this->shared->mutex);
+                if(this->shared->decoded.empty())
+                {
+                    break;
+                }
+
+                // Always make progress on a single image larger than the budget
+                const DecodedImage &next = this->shared->decoded.front();
+                size_t size = next.size();
+                if(bytes > 0 && bytes + size > this->frameBudget)
+                {
+                    break;
+                }
+
+                if(next.isValid() && !this->slotReady())
+                {
+                    break;
+                }
+
+                image = std::move(this->shared->decoded.front());
+                this->shared->decoded.pop_front();
+            }
+
+            // Cancelled, or superseded by a newer request for a reused name
+            std::unordered_map<unsigned int, unsigned int>::iterator it = this->active.find(image.textureID);
+            if(it == this->active.end() || it->second != image.serial)
+            {
+                stbi_image_free(image.pixels);
+                continue;
+            }
+            this->active.erase(it);
+
+            if(!image.isValid())
+            {
+                std::cout << "Texture failed to load at path: " << image.path << std::endl;
+                continue;
+            }
+
+            this->upload(image);
+            bytes += image.size();
+            stats.texturesUploaded++;
+            stbi_image_free(image.pixels);
+        }
+
+        stats.bytesUploaded += bytes;
+        stats.queueDepth = this->queueDepth();
+    }
+
+    // Drops a queued texture whose GL name is about to be deleted
+    void cancel(unsigned int textureID)
+    {
+        this->active.erase(textureID);
+    }
+
+    // Textures requested but not resident yet
+    unsigned int queueDepth() const
+    {
+        std::lock_guard<std::mutex> lock(this->shared->mutex);
+        return this->shared->pending + this->shared->decoded.size();
+    }
+
+    bool idle() const
+    {
+        return this->queueDepth() == 0;
+    }
+
+private:
+    struct DecodedImage {
+        unsigned int textureID;
+        unsigned int serial;
+        std::string path;
+        // stb_image result
+        unsigned char *pixels;
+        int width;
+        int height;
+        int components;
+        // Baked file: every mip level back to back, internalFormat != 0
+        unsigned int internalFormat;
+        std::vector<unsigned char> compressed;
+        std::vector<KtxLevel> levels;
+
+        bool isValid() const
+        {
+            return this->pixels != NULL || !this->compressed.empty();
+        }
+
+        size_t size() const
+        {
+            if(this->internalFormat)
+            {
+                return this->compressed.size();
+            }
+            return this->pixels ? size_t(this->width) * this->height * this->components : 0;
+        }
+    };
+
+    // Outlives the loader while decode tasks are still in flight
+    struct SharedState {
+        SharedState()
+            : pending(0)
+        {
+        }
+
+        ~SharedState()
+        {
+            for (unsigned int i = 0; i < this->decoded.size(); i++)
+            {
+                stbi_image_free(this->decoded[i].pixels);
+            }
+        }
+
+        std::mutex mutex;
+        unsigned int pending;
+        std::deque<DecodedImage> decoded;
+    };
+
+    struct RingSlot {
+        unsigned int buffer;
+        size_t size;
+        GLsync fence;
+    };
+
+    size_t frameBudget;
+    RingSlot ring[RING_SIZE];
+    unsigned int nextSlot;
+    unsigned int nextSerial;
+    std::shared_ptr<SharedState> shared;
+    // Texture name to serial of its pending request; only touched on the GL thread
+    std::unordered_map<unsigned int, unsigned int> active;
+
+    // Copies the levels of a baked file; their data pointers become offsets into image.compressed
+    static bool readBaked(const std::string &bakedPath, DecodedImage &image)
+    {
+        AssetFile file(bakedPath);
+        KtxFile ktx;
+        if(!file.isOpen() || !ReadKtx(file.data, file.size, ktx) ||
+           (ktx.internalFormat != TEXTURE_FORMAT_BC1 && ktx.internalFormat != TEXTURE_FORMAT_BC3))
+        {
+            return false;
+        }
+
+        for (unsigned int i = 0; i < ktx.levels.size(); i++)
+        {
+            KtxLevel level = ktx.levels[i];
+            image.compressed.insert(image.compressed.end(), level.data, level.data + level.size);
+            level.data = reinterpret_cast<const unsigned char*>((uintptr_t)(image.compressed.size() - level.size));
+            image.levels.push_back(level);
+        }
+
+        image.internalFormat = ktx.internalFormat;
+        image.width = ktx.levels[0].width;
+        image.height = ktx.levels[0].height;
+        image.components = ktx.internalFormat == TEXTURE_FORMAT_BC1 ? 3 : 4;
+        return true;
+    }
+
+    // The next slot is free once the GPU has consumed its last upload; never waits
+    bool slotReady()
+    {
+        RingSlot &slot = this->ring[this->nextSlot];
+        if(!slot.fence)
+        {
+            return true;
+        }
+
+        GLenum result = glClientWaitSync(slot.fence, 0, 0);
+        if(result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+        {
+            return false;
+        }
+
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        return true;
+    }
+
+    void upload(const DecodedImage &image)
+    {
+        RingSlot &slot = this->ring[this->nextSlot];
+        this->nextSlot = (this->nextSlot + 1) % RING_SIZE;
+
+        size_t size = image.size();
+        if(!slot.buffer)
+        {
+            glGenBuffers(1, &slot.buffer);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if(slot.size < size)
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            slot.size = size;
+        }
+
+        // The fence already guaranteed the GPU is done with this slot
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if(!mapped)
+        {
+            std::cout << "ERROR::TEXTURE_LOADER::MAP_FAILED " << image.path << std::endl;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+        std::memcpy(mapped, image.internalFormat ? image.compressed.data() : image.pixels, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        GLStats::frame().textureBinds++;
+        glBindTexture(GL_TEXTURE_2D, image.textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        if(image.internalFormat)
+        {
+            // Mips come precomputed from the baker, level data pointers are offsets into the buffer
+            for (unsigned int i = 0; i < image.levels.size(); i++)
+            {
+                const KtxLevel &level = image.levels[i];
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, image.internalFormat, level.width, level.height, 0, level.size, level.data);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+        }
+        else
+        {
+            this->uploadPixels(image);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // Raw pixels from the bound pixel buffer into the bound texture
+    static void uploadPixels(const DecodedImage &image)
+    {
+        unsigned int format = GL_RGBA;
+        if(image.components == 1)
+        {
+            format = GL_RED;
+        }
+        else if(image.components == 3)
+        {
+            format = GL_RGB;
+        }
+
+        // Rows of 1 and 3 component images are not 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+};
+
+#endif // TEXTURE_LOADER_H
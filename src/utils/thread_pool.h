@@ -0,0 +1,154 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of worker threads fed from a shared task queue
+class ThreadPool
+{
+public:
+    // threadCount == 0 uses one worker per hardware thread, minus the caller
+    explicit ThreadPool(unsigned int threadCount = 0)
+        : stopping(false)
+    {
+        if(threadCount == 0)
+        {
+            unsigned int hardware = std::thread::hardware_concurrency();
+            threadCount = hardware > 1 ? hardware - 1 : 1;
+        }
+
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            this->workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->condition.notify_all();
+
+        for (unsigned int i = 0; i < this->workers.size(); i++)
+        {
+            this->workers[i].join();
+        }
+    }
+
+    // Shared pool used by the loaders
+    static ThreadPool &global()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    unsigned int getThreadCount() const
+    {
+        return this->workers.size();
+    }
+
+    void enqueue(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->tasks.push_back(std::move(task));
+        }
+        this->condition.notify_one();
+    }
+
+    // Calls body(i) for every i in [0, count) and blocks until all of them returned.
+    // The calling thread takes part, so this never waits on a busy pool to make progress
+    void parallelFor(size_t count, std::function<void(size_t)> body)
+    {
+        if(count == 0)
+        {
+            return;
+        }
+
+        std::shared_ptr<ForState> state = std::make_shared<ForState>();
+        state->count = count;
+        state->body = std::move(body);
+
+        // Helpers that start after the work ran out just return; the shared state keeps them safe
+        size_t helpers = count - 1 < this->workers.size() ? count - 1 : this->workers.size();
+        for (size_t i = 0; i < helpers; i++)
+        {
+            this->enqueue([state]() { runFor(*state); });
+        }
+
+        runFor(*state);
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&state]() { return state->done.load() == state->count; });
+    }
+
+private:
+    struct ForState {
+        ForState()
+            : next(0), done(0), count(0)
+        {
+        }
+
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        size_t count;
+        std::function<void(size_t)> body;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    static void runFor(ForState &state)
+    {
+        size_t i;
+        while((i = state.next.fetch_add(1)) < state.count)
+        {
+            state.body(i);
+
+            if(state.done.fetch_add(1) + 1 == state.count)
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.finished.notify_all();
+            }
+        }
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->condition.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+
+                if(this->stopping && this->tasks.empty())
+                {
+                    return;
+                }
+
+                task = std::move(this->tasks.front());
+                this->tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,207 @@
+#ifndef TRANSFORM_GRAPH_H
+#define TRANSFORM_GRAPH_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRANSFORM_GRAPH_SSE 1
+#endif
+
+// out = a * b for column-major matrices. out must not alias b
+inline void MultiplyTransform(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out)
+{
+#ifdef TRANSFORM_GRAPH_SSE
+    const float *pa = &a[0][0];
+    const float *pb = &b[0][0];
+    float *po = &out[0][0];
+
+    __m128 a0 = _mm_loadu_ps(pa);
+    __m128 a1 = _mm_loadu_ps(pa + 4);
+    __m128 a2 = _mm_loadu_ps(pa + 8);
+    __m128 a3 = _mm_loadu_ps(pa + 12);
+
+    // Column j of the product is a's columns weighted by column j of b
+    for (int j = 0; j < 4; j++)
+    {
+        __m128 column = _mm_mul_ps(a0, _mm_set1_ps(pb[j * 4 + 0]));
+        column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(pb[j * 4 + 1])));
+        column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(pb[j * 4 + 2])));
+        column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(pb[j * 4 + 3])));
+        _mm_storeu_ps(po + j * 4, column);
+    }
+#else
+    out = a * b;
+#endif
+}
+
+// Node hierarchy with local and world transforms in structure-of-arrays form. Nodes are stored breadth
+// first, so every parent precedes its children and each depth is one contiguous range. update() only
+// recomputes the subtrees below nodes whose local transform changed: it walks the levels in order,
+// gathers the dirty nodes of a level into a list and multiplies them in one tight loop, parents being
+// final by then
+class TransformGraph
+{
+public:
+    TransformGraph()
+        : firstDirty(NO_NODE), version(0)
+    {
+    }
+
+    static const unsigned int NO_NODE = ~0u;
+
+    // parent == NO_NODE adds a root. Nodes must come in breadth-first order
+    unsigned int addNode(unsigned int parent, const glm::mat4 &local, const std::string &name = std::string())
+    {
+        unsigned int index = this->locals.size();
+        unsigned int level = parent == NO_NODE ? 0 : this->levelOf(parent) + 1;
+        if((parent != NO_NODE && parent >= index) || (!this->levelStarts.empty() && level + 1 < this->levelStarts.size()))
+        {
+            std::cout << "ERROR::TRANSFORM_GRAPH::NOT_BREADTH_FIRST " << name << std::endl;
+            return NO_NODE;
+        }
+        if(level == this->levelStarts.size())
+        {
+            this->levelStarts.push_back(index);
+        }
+
+        this->parents.push_back(parent);
+        this->locals.push_back(local);
+        this->worlds.push_back(local);
+        this->dirty.push_back(1);
+        this->names.push_back(name);
+        this->markDirty(index);
+        return index;
+    }
+
+    void setLocal(unsigned int node, const glm::mat4 &local)
+    {
+        this->locals[node] = local;
+        this->markDirty(node);
+    }
+
+    const glm::mat4 &getLocal(unsigned int node) const
+    {
+        return this->locals[node];
+    }
+
+    // Valid after update()
+    const glm::mat4 &getWorld(unsigned int node) const
+    {
+        return this->worlds[node];
+    }
+
+    unsigned int getParent(unsigned int node) const
+    {
+        return this->parents[node];
+    }
+
+    const std::string &getName(unsigned int node) const
+    {
+        return this->names[node];
+    }
+
+    // First node with the name, NO_NODE if there is none
+    unsigned int find(const std::string &name) const
+    {
+        for (unsigned int i = 0; i < this->names.size(); i++)
+        {
+            if(this->names[i] == name)
+            {
+                return i;
+            }
+        }
+        return NO_NODE;
+    }
+
+    unsigned int size() const
+    {
+        return this->locals.size();
+    }
+
+    // Changes whenever update() moved any world transform
+    unsigned int getVersion() const
+    {
+        return this->version;
+    }
+
+    void update()
+    {
+        if(this->firstDirty == NO_NODE)
+        {
+            return;
+        }
+
+        unsigned int level = this->levelOf(this->firstDirty);
+        for (; level < this->levelStarts.size(); level++)
+        {
+            unsigned int begin = std::max(this->levelStarts[level], this->firstDirty);
+            unsigned int end = level + 1 < this->levelStarts.size() ? this->levelStarts[level + 1] : this->size();
+
+            // A node is dirty when it changed itself or its parent's world did
+            this->batch.clear();
+            for (unsigned int i = begin; i < end; i++)
+            {
+                unsigned int parent = this->parents[i];
+                this->dirty[i] |= parent != NO_NODE && this->dirty[parent];
+                if(this->dirty[i])
+                {
+                    this->batch.push_back(i);
+                }
+            }
+
+            for (unsigned int i = 0; i < this->batch.size(); i++)
+            {
+                unsigned int node = this->batch[i];
+                unsigned int parent = this->parents[node];
+                if(parent == NO_NODE)
+                {
+                    this->worlds[node] = this->locals[node];
+                }
+                else
+                {
+                    MultiplyTransform(this->worlds[parent], this->locals[node], this->worlds[node]);
+                }
+            }
+        }
+
+        std::memset(&this->dirty[this->firstDirty], 0, this->size() - this->firstDirty);
+        this->firstDirty = NO_NODE;
+        this->version++;
+    }
+
+private:
+    std::vector<unsigned int> parents;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<unsigned char> dirty;
+    std::vector<std::string> names;
+    // First node of every depth
+    std::vector<unsigned int> levelStarts;
+    // Lowest dirty node, update() starts there
+    unsigned int firstDirty;
+    unsigned int version;
+    std::vector<unsigned int> batch;
+
+    unsigned int levelOf(unsigned int node) const
+    {
+        return std::upper_bound(this->levelStarts.begin(), this->levelStarts.end(), node) - this->levelStarts.begin() - 1;
+    }
+
+    void markDirty(unsigned int node)
+    {
+        this->dirty[node] = 1;
+        if(this->firstDirty == NO_NODE || node < this->firstDirty)
+        {
+            this->firstDirty = node;
+        }
+    }
+};
+
+#endif // TRANSFORM_GRAPH_H
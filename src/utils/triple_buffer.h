@@ -0,0 +1,99 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// Hands the newest value from one writer thread to one reader thread without locking. The writer fills
+// the back slot and publishes it by swapping it with the middle slot; the reader swaps the middle slot with
+// its front slot whenever the middle one holds something newer. Neither side has to wait on the other, the
+// reader simply skips values that were replaced before it got to them. Slots are reused, not cleared, so
+// their buffers keep their capacity from one value to the next.
+// A side that has nothing to do can sleep in waitForPublish() or waitForAcquire() instead of polling; the
+// exchanges stay lock-free, the lock only guards the sleeping
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : back(0), middle(1), front(2)
+    {
+    }
+
+    // Slot the writer fills, owned by it until publish()
+    T &write()
+    {
+        return this->slots[this->back];
+    }
+
+    void publish()
+    {
+        this->back = this->middle.exchange(this->back | FRESH, std::memory_order_acq_rel) & INDEX;
+        this->wake();
+    }
+
+    // Blocks until the reader has acquired everything published so far, so the next publish() replaces nothing
+    void waitForAcquire()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->changed.wait(lock, [this]() {
+            return !(this->middle.load(std::memory_order_acquire) & FRESH);
+        });
+    }
+
+    // Takes the newest published value if there is one the reader hasn't seen yet
+    bool acquire()
+    {
+        if(!(this->middle.load(std::memory_order_relaxed) & FRESH))
+        {
+            return false;
+        }
+
+        this->front = this->middle.exchange(this->front, std::memory_order_acq_rel) & INDEX;
+        this->wake();
+        return true;
+    }
+
+    // Blocks until there is a value acquire() will take
+    void waitForPublish()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->changed.wait(lock, [this]() {
+            return (this->middle.load(std::memory_order_acquire) & FRESH) != 0;
+        });
+    }
+
+    // Value the last acquire() took, owned by the reader until the next one
+    const T &read() const
+    {
+        return this->slots[this->front];
+    }
+
+private:
+    // The middle index carries a flag telling whether it was published after the reader's last acquire
+    static const unsigned int INDEX = 3;
+    static const unsigned int FRESH = 4;
+
+    T slots[3];
+    unsigned int back;
+    std::atomic<unsigned int> middle;
+    unsigned int front;
+    // Taking the lock before notifying means a waiter is either not checking yet or already asleep, so no
+    // wake-up gets lost between its check and its wait
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+        }
+        this->changed.notify_all();
+    }
+
+    TripleBuffer(const TripleBuffer&);
+    TripleBuffer &operator=(const TripleBuffer&);
+};
+
+#endif // TRIPLE_BUFFER_H
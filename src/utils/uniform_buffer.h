@@ -0,0 +1,113 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <cstring>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "gl_stats.h"
+#include "dynamic_buffer.h"
+
+// Uniform buffer binding points shared by every shader
+const unsigned int FRAME_UBO_BINDING = 0;
+const unsigned int MATERIAL_UBO_BINDING = 1;
+
+// Matches the std140 layout of Light in the shaders
+struct LightUniforms {
+    glm::vec3 ambient;
+    float pad0;
+    glm::vec3 diffuse;
+    float pad1;
+    glm::vec3 specular;
+    float pad2;
+};
+
+// Matches the std140 layout of FrameBlock in the shaders
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float pad0;
+    glm::vec3 lightPos;
+    float pad1;
+    LightUniforms light;
+    glm::vec4 clusterScale;     // Clusters per pixel in x and y, then slice = log(depth) * z + w
+    glm::ivec4 clusterSize;     // Clusters along x, y and z
+};
+
+// Offsets glBindBufferRange accepts for uniform blocks
+inline size_t UniformOffsetAlignment()
+{
+    static GLint alignment = 0;
+    if(alignment == 0)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        alignment = alignment > 0 ? alignment : 256;
+    }
+    return alignment;
+}
+
+// One uniform buffer holding a std140 struct, bound to a fixed binding point
+template<typename T>
+class UniformBuffer
+{
+public:
+    explicit UniformBuffer(unsigned int binding)
+        : binding(binding)
+    {
+        glGenBuffers(1, &this->UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        this->bind();
+    }
+
+    // Replaces the whole block in one call
+    void update(const T &data)
+    {
+        GLStats::frame().bufferUpdates++;
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Same, written into this frame's region of a DynamicBuffer and bound from there, so the update never
+    // waits on draws of earlier frames. Falls back to the buffer's own storage if the region is full
+    void update(const T &data, DynamicBuffer &dynamic)
+    {
+        DynamicAllocation allocation = dynamic.allocate(sizeof(T), UniformOffsetAlignment());
+        if(!allocation.data)
+        {
+            this->update(data);
+            this->bind();
+            return;
+        }
+
+        std::memcpy(allocation.data, &data, sizeof(T));
+        dynamic.flush();
+        GLStats::frame().bufferBinds++;
+        glBindBufferRange(GL_UNIFORM_BUFFER, this->binding, allocation.buffer, allocation.offset, sizeof(T));
+    }
+
+    void bind() const
+    {
+        GLStats::frame().bufferBinds++;
+        glBindBufferBase(GL_UNIFORM_BUFFER, this->binding, this->UBO);
+    }
+
+    static int size()
+    {
+        return sizeof(T);
+    }
+
+private:
+    unsigned int UBO;
+    unsigned int binding;
+
+    UniformBuffer(const UniformBuffer&);
+    UniformBuffer &operator=(const UniformBuffer&);
+};
+
+#endif // UNIFORM_BUFFER_H
@@ -0,0 +1,248 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <cmath>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+// Layout of the vertex buffers uploaded by Mesh::setupMesh
+enum class VertexFormat
+{
+    FULL,       // Vertex as is: 32-bit float position, normal and texture coordinates
+    COMPACT     // CompactVertex: quantized position, octahedral normal, half float texture coordinates
+};
+
+// 16 bytes instead of the 32 of Vertex
+struct CompactVertex {
+    std::int16_t Position[4];   // Signed 16-bit, relative to the mesh bounds. The 4th value pads to 8 bytes
+    std::int16_t Normal[2];     // Octahedral encoding, signed 16-bit
+    std::uint16_t TexCoords[2]; // Half float
+};
+
+// Maps mesh space positions to [-1, 1]: quantized = (position - center) / extent
+struct QuantizationBounds {
+    glm::vec3 center;
+    glm::vec3 extent;
+};
+
+const float SNORM16_MAX = 32767.0f;
+
+inline std::int16_t quantizeSnorm16(float value)
+{
+    if(value > 1.0f)
+    {
+        value = 1.0f;
+    }
+    if(value < -1.0f)
+    {
+        value = -1.0f;
+    }
+    return static_cast<std::int16_t>(std::floor(value * SNORM16_MAX + 0.5f));
+}
+
+inline float dequantizeSnorm16(std::int16_t value)
+{
+    return value / SNORM16_MAX;
+}
+
+// IEEE 754 binary16 conversion with round to nearest even
+inline std::uint16_t floatToHalf(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::uint32_t sign = (bits >> 16) & 0x8000u;
+    std::uint32_t exponent = (bits >> 23) & 0xffu;
+    std::uint32_t mantissa = bits & 0x7fffffu;
+
+    // NaN and infinity
+    if(exponent == 0xffu)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+    }
+
+    int halfExponent = static_cast<int>(exponent) - 127 + 15;
+
+    // Overflow to infinity
+    if(halfExponent >= 31)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+
+    // Subnormal or zero
+    if(halfExponent <= 0)
+    {
+        if(halfExponent < -10)
+        {
+            return static_cast<std::uint16_t>(sign);
+        }
+        mantissa |= 0x800000u;
+        unsigned int shift = 14 - halfExponent;
+        std::uint32_t half = mantissa >> shift;
+        std::uint32_t rest = mantissa & ((1u << shift) - 1);
+        std::uint32_t halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1u)))
+        {
+            half++;
+        }
+        return static_cast<std::uint16_t>(sign | half);
+    }
+
+    std::uint32_t half = (static_cast<std::uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    std::uint32_t rest = mantissa & 0x1fffu;
+    // A carry out of the mantissa correctly bumps the exponent
+    if(rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+    {
+        half++;
+    }
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+inline float halfToFloat(std::uint16_t value)
+{
+    std::uint32_t sign = static_cast<std::uint32_t>(value & 0x8000u) << 16;
+    std::uint32_t exponent = (value >> 10) & 0x1fu;
+    std::uint32_t mantissa = value & 0x3ffu;
+    std::uint32_t bits;
+
+    if(exponent == 0)
+    {
+        if(mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // Normalize the subnormal
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400u))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ffu;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else if(exponent == 31)
+    {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Octahedral normal encoding: unit vector to a point in [-1, 1]^2
+inline glm::vec2 octEncode(glm::vec3 n)
+{
+    n /= (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+
+    glm::vec2 result(n.x, n.y);
+    if(n.z < 0.0f)
+    {
+        result.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        result.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return result;
+}
+
+// Mirrors octDecode in the vertex shader
+inline glm::vec3 octDecode(glm::vec2 e)
+{
+    glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    if(n.z < 0.0f)
+    {
+        float x = n.x;
+        n.x = (1.0f - std::fabs(n.y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::fabs(x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(n);
+}
+
+template<typename V>
+QuantizationBounds ComputeQuantizationBounds(const std::vector<V> &vertices)
+{
+    QuantizationBounds bounds;
+    bounds.center = glm::vec3(0.0f);
+    bounds.extent = glm::vec3(1.0f);
+
+    if(vertices.empty())
+    {
+        return bounds;
+    }
+
+    glm::vec3 minimum = vertices[0].Position;
+    glm::vec3 maximum = vertices[0].Position;
+    for (unsigned int i = 1; i < vertices.size(); i++)
+    {
+        minimum = glm::min(minimum, vertices[i].Position);
+        maximum = glm::max(maximum, vertices[i].Position);
+    }
+
+    bounds.center = (minimum + maximum) * 0.5f;
+    bounds.extent = (maximum - minimum) * 0.5f;
+
+    // Flat axes still need a non-zero scale
+    for (int i = 0; i < 3; i++)
+    {
+        if(bounds.extent[i] <= 0.0f)
+        {
+            bounds.extent[i] = 1.0f;
+        }
+    }
+
+    return bounds;
+}
+
+template<typename V>
+CompactVertex CompactFromVertex(const V &vertex, const QuantizationBounds &bounds)
+{
+    CompactVertex compact;
+
+    glm::vec3 position = (vertex.Position - bounds.center) / bounds.extent;
+    compact.Position[0] = quantizeSnorm16(position.x);
+    compact.Position[1] = quantizeSnorm16(position.y);
+    compact.Position[2] = quantizeSnorm16(position.z);
+    compact.Position[3] = 0;
+
+    glm::vec2 normal(0.0f, 0.0f);
+    if(glm::dot(vertex.Normal, vertex.Normal) > 0.0f)
+    {
+        normal = octEncode(vertex.Normal);
+    }
+    compact.Normal[0] = quantizeSnorm16(normal.x);
+    compact.Normal[1] = quantizeSnorm16(normal.y);
+
+    compact.TexCoords[0] = floatToHalf(vertex.TexCoords.x);
+    compact.TexCoords[1] = floatToHalf(vertex.TexCoords.y);
+
+    return compact;
+}
+
+// Inverse of CompactFromVertex, the same math the vertex shader does
+inline glm::vec3 DequantizePosition(const CompactVertex &compact, const QuantizationBounds &bounds)
+{
+    glm::vec3 position(compact.Position[0], compact.Position[1], compact.Position[2]);
+    return position * (bounds.extent / SNORM16_MAX) + bounds.center;
+}
+
+inline glm::vec3 DequantizeNormal(const CompactVertex &compact)
+{
+    return octDecode(glm::vec2(dequantizeSnorm16(compact.Normal[0]), dequantizeSnorm16(compact.Normal[1])));
+}
+
+inline glm::vec2 DequantizeTexCoords(const CompactVertex &compact)
+{
+    return glm::vec2(halfToFloat(compact.TexCoords[0]), halfToFloat(compact.TexCoords[1]));
+}
+
+#endif // VERTEX_FORMAT_H